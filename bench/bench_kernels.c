@@ -0,0 +1,179 @@
+/*
+ * Microbenchmarks for the per-pixel kernels of the font and compositor code.
+ *
+ * Every kernel runs on fixed synthetic RGB565 surfaces, once per embedded
+ * font and once with a TTF font. Each measurement is pinned to one CPU,
+ * warmed up, then repeated; min and median time per call are reported.
+ *
+ * usage: bench-kernels [-cpu N] [-reps N] [-ttf font.ttf] [-fontsize N] [-nosimd]
+ */
+#include <SDL2/SDL.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "blit.h"
+#include "cpu.h"
+#include "font.h"
+#include "keyboard.h"
+
+#define USAGE "usage: bench-kernels [-cpu N] [-reps N] [-ttf font.ttf] [-fontsize N] [-nosimd]\n"
+
+#define SURFACE_W 640
+#define SURFACE_H 480
+#define REP_MIN_NS 2000000 /* calibrate each repetition to at least 2 ms */
+
+void init_keyboard(int _embedded_font_name, int _use_embedded_font_for_keyboard);
+
+/* keyboard.c sends keys to the shell, there is none here */
+void tty_write(const char *s, size_t n) {}
+
+static SDL_Surface *surface, *rotated;
+static int font_id;
+static int reps = 25;
+static const char *line = "drwxr-xr-x  2 root root 4096 Jan  1 00:00 simple-terminal -rotate 270 {}[]()";
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void k_draw_char(void) {
+    for (int c = 32, x = 0; c < 127; c++, x += 8) draw_char(surface, c, x % (SURFACE_W - 8), 16 * (x / (SURFACE_W - 8)), 0xFFFF, font_id);
+}
+
+static void k_draw_string(void) {
+    int h = get_embedded_font_char_height(font_id);
+    for (int y = 0; y + h <= SURFACE_H; y += h) draw_string(surface, line, 0, y, 0xFFFF, font_id);
+}
+
+static void k_draw_string_ttf(void) {
+    int h = get_ttf_char_height();
+    for (int y = 0; y + h <= SURFACE_H; y += h) draw_string_ttf(surface, line, 0, y, (SDL_Color){255, 255, 255, 255}, (SDL_Color){0, 0, 0, 255});
+}
+
+static void k_fill_rows(void) {
+    int h = get_embedded_font_char_height(font_id);
+    for (int y = 0; y + h <= SURFACE_H; y += h) {
+        SDL_Rect r = {0, y, SURFACE_W, h};
+        SDL_FillRect(surface, &r, y);
+    }
+}
+
+static void k_osk_copy(void) { memcpy(rotated->pixels, surface->pixels, surface->w * surface->h * 2); }
+
+static void k_rotate_90(void) { blit_rotate(surface, rotated, 90); }
+
+static void k_rotate_270(void) { blit_rotate(surface, rotated, 270); }
+
+static void k_draw_keyboard(void) { draw_keyboard(surface); }
+
+static void measure(const char *name, const char *font, void (*kernel)(void)) {
+    double samples[256], t;
+    long iters = 1;
+
+    /* warm up, and find how many calls make a repetition long enough to time */
+    for (;;) {
+        t = now_ns();
+        for (long i = 0; i < iters; i++) kernel();
+        t = now_ns() - t;
+        if (t >= REP_MIN_NS) break;
+        iters *= 2;
+    }
+
+    for (int r = 0; r < reps; r++) {
+        t = now_ns();
+        for (long i = 0; i < iters; i++) kernel();
+        samples[r] = (now_ns() - t) / iters;
+    }
+    qsort(samples, reps, sizeof(*samples), cmp);
+    printf("%-18s %-12s %12.0f %12.0f\n", name, font, samples[0], samples[reps / 2]);
+}
+
+static void pin_cpu(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) fprintf(stderr, "Couldn't pin to cpu %d, timings may be noisy\n", cpu);
+}
+
+int main(int argc, char *argv[]) {
+    const char *ttf = NULL;
+    int cpu = 0, fontsize = 12, simd = 1;
+    char font[16];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-nosimd") == 0) {
+            simd = 0;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, USAGE);
+            return 1;
+        }
+        if (strcmp(argv[i], "-cpu") == 0) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-reps") == 0) {
+            reps = atoi(argv[++i]);
+            if (reps < 1 || reps > 256) reps = 25;
+        } else if (strcmp(argv[i], "-ttf") == 0) {
+            ttf = argv[++i];
+        } else if (strcmp(argv[i], "-fontsize") == 0) {
+            fontsize = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, USAGE);
+            return 1;
+        }
+    }
+
+    pin_cpu(cpu);
+    cpu_init(simd ? ~0u : 0);
+    surface = SDL_CreateRGBSurface(0, SURFACE_W, SURFACE_H, 16, 0xF800, 0x7E0, 0x1F, 0);
+    rotated = SDL_CreateRGBSurface(0, SURFACE_H, SURFACE_W, 16, 0xF800, 0x7E0, 0x1F, 0);
+    if (!surface || !rotated) {
+        fprintf(stderr, "Unable to create surfaces: %s\n", SDL_GetError());
+        return 1;
+    }
+    show_help = 0;
+
+    printf("cpu kernels: %s\n", cpu_describe());
+    printf("%-18s %-12s %12s %12s\n", "kernel", "font", "min ns", "median ns");
+    measure("osk_copy", "-", k_osk_copy);
+    measure("rotate_90", "-", k_rotate_90);
+    measure("rotate_270", "-", k_rotate_270);
+    for (font_id = 1; font_id <= 5; font_id++) {
+        snprintf(font, sizeof(font), "embedded%d", font_id);
+        init_keyboard(font_id, 1);
+        measure("draw_char", font, k_draw_char);
+        measure("draw_string", font, k_draw_string);
+        measure("fill_rows", font, k_fill_rows);
+        measure("draw_keyboard", font, k_draw_keyboard);
+    }
+
+    if (ttf && init_ttf_font(ttf, fontsize, 0)) {
+        for (int shade = 0; shade <= 2; shade++) {
+            cleanup_ttf_font();
+            init_ttf_font(ttf, fontsize, shade);
+            snprintf(font, sizeof(font), "ttf-shade%d", shade);
+            init_keyboard(1, 0);
+            measure("draw_string_ttf", font, k_draw_string_ttf);
+            measure("draw_keyboard", font, k_draw_keyboard);
+        }
+        cleanup_ttf_font();
+    } else {
+        fprintf(stderr, "No TTF font, skipping draw_string_ttf (use -ttf font.ttf)\n");
+    }
+
+    SDL_FreeSurface(rotated);
+    SDL_FreeSurface(surface);
+    return 0;
+}
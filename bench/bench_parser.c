@@ -0,0 +1,145 @@
+/*
+ * Headless parser throughput benchmark.
+ *
+ * Links src/vt100.c without SDL and replays byte corpora through t_write(),
+ * in the same BUFSIZ sized chunks tty_read() hands to the parser.
+ *
+ * usage: bench-parser [-size KiB] [-reps N] [-cols N] [-rows N] [-dump dir] [-trigger action:pattern] [-nosimd] [capture ...]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "cpu.h"
+#include "trigger.h"
+#include "vt100.h"
+
+#define USAGE "usage: bench-parser [-size KiB] [-reps N] [-cols N] [-rows N] [-dump dir] [-trigger action:pattern] [-nosimd] [capture ...]\n"
+
+/* Mirrors of the config.h / main.c globals vt100.c links against */
+unsigned int defaultfg = 7;
+unsigned int defaultbg = 0;
+unsigned int tabspaces = 4;
+char default_shell[] = "/bin/sh";
+char termname[] = "xterm";
+int scrollback_kb = 4096;
+char *opt_io = NULL;
+int opt_io_format = 0;
+int opt_batch = 0;
+int opt_spill = 0;
+int opt_spill_keep = 0;
+char **opt_cmd = NULL;
+int opt_cmd_size = 0;
+int show_help = 0;
+
+void die(const char *errstr, ...) {
+    va_list ap;
+    va_start(ap, errstr);
+    vfprintf(stderr, errstr, ap);
+    va_end(ap);
+    exit(EXIT_FAILURE);
+}
+
+void redraw(void) {}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Feed a whole corpus the way tty_read() would, carrying partial utf8 chars */
+static void replay(const Corpus *c) {
+    char buf[BUFSIZ];
+    size_t pos = 0;
+    int buflen = 0, written;
+
+    while (pos < c->len) {
+        int n = MIN((size_t)(LEN(buf) - buflen), c->len - pos);
+        memcpy(buf + buflen, c->data + pos, n);
+        pos += n;
+        buflen += n;
+        written = t_write(buf, buflen);
+        buflen -= written;
+        memmove(buf, buf + written, buflen);
+    }
+}
+
+static void run(const Corpus *c, int reps) {
+    double best = 0, t;
+
+    /* warm up caches and the scrollback ring */
+    t_reset();
+    replay(c);
+
+    for (int i = 0; i < reps; i++) {
+        t_reset();
+        t = now_ns();
+        replay(c);
+        t = now_ns() - t;
+        if (i == 0 || t < best) best = t;
+    }
+    printf("%-16s %10zu %10.2f %10.2f\n", c->name, c->len, c->len / (best / 1e9) / (1024 * 1024), best / c->len);
+}
+
+int main(int argc, char *argv[]) {
+    size_t size = 4096 * 1024;
+    int reps = 5, cols = 80, rows = 24;
+    char *dump_dir = NULL;
+    int simd = 1;
+    Corpus c;
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-nosimd") == 0) {
+            simd = 0;
+            continue;
+        }
+        if (i + 1 >= argc) die(USAGE);
+        if (strcmp(argv[i], "-size") == 0) {
+            size = (size_t)atoi(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "-reps") == 0) {
+            reps = atoi(argv[++i]);
+            reps = MAX(1, reps);
+        } else if (strcmp(argv[i], "-cols") == 0) {
+            cols = atoi(argv[++i]);
+            cols = MAX(20, cols);
+        } else if (strcmp(argv[i], "-rows") == 0) {
+            rows = atoi(argv[++i]);
+            rows = MAX(8, rows);
+        } else if (strcmp(argv[i], "-dump") == 0) {
+            dump_dir = argv[++i];
+        } else if (strcmp(argv[i], "-trigger") == 0) {
+            if (!trigger_add(argv[++i])) die(USAGE);
+        } else {
+            die(USAGE);
+        }
+    }
+
+    /* replies to queries (DA, window size) go nowhere */
+    if ((term->cmdfd = open("/dev/null", O_WRONLY)) < 0) die("open /dev/null failed: %s\n", strerror(errno));
+    t_new(cols, rows);
+    cpu_init(simd ? ~0u : 0);
+
+    printf("cpu kernels: %s\n", cpu_describe());
+    printf("%-16s %10s %10s %10s\n", "corpus", "bytes", "MB/s", "ns/byte");
+    for (const char **name = corpus_names; *name; name++) {
+        if (!corpus_build(&c, *name, size, cols, rows)) die("Unable to build corpus %s\n", *name);
+        if (dump_dir) corpus_dump(&c, dump_dir);
+        run(&c, reps);
+        corpus_free(&c);
+    }
+    for (; i < argc; i++) {
+        if (!corpus_load(&c, argv[i])) continue;
+        run(&c, reps);
+        corpus_free(&c);
+    }
+
+    return 0;
+}
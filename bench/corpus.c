@@ -0,0 +1,296 @@
+#include "corpus.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Deterministic generators for the kind of output the terminal sees on
+ * device. They are not real captures, but they exercise the same parser
+ * paths: printable runs, SGR, utf8 decoding, cursor addressing and
+ * scrolling regions. Real captures (see -o) can be loaded from files.
+ */
+
+const char *corpus_names[] = {"ascii", "sgr", "cjk", "vim", "htop", "scroll", "dense", "color256", "typing", NULL};
+
+static const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "make", "build", "src/vt100.c", "warning:", "unused", "variable", "-Wall", "return", "int", "static", "void", "0x7e", "#include", "{", "}", "();", "[OK]", "done"};
+
+static unsigned int seed;
+
+static unsigned int rnd(void) {
+    /* xorshift32 */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void put(Corpus *c, size_t *cap, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(c->data + c->len, *cap - c->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (c->len + n < *cap) break;
+        *cap = *cap * 2 + n;
+        c->data = realloc(c->data, *cap);
+        if (!c->data) {
+            fprintf(stderr, "corpus: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    c->len += n;
+}
+
+static const char *word(void) { return words[rnd() % (sizeof(words) / sizeof(words[0]))]; }
+
+static void gen_ascii(Corpus *c, size_t *cap, int cols, int rows) {
+    int x = 0;
+    while (x < cols - 12) {
+        const char *w = word();
+        put(c, cap, "%s ", w);
+        x += strlen(w) + 1;
+    }
+    put(c, cap, "\r\n");
+}
+
+static void gen_sgr(Corpus *c, size_t *cap, int cols, int rows) {
+    int x = 0;
+    while (x < cols - 12) {
+        const char *w = word();
+        switch (rnd() % 4) {
+            case 0:
+                put(c, cap, "\033[38;5;%dm%s ", rnd() % 256, w);
+                break;
+            case 1:
+                put(c, cap, "\033[1;%dm%s\033[0m ", 30 + rnd() % 8, w);
+                break;
+            case 2:
+                put(c, cap, "\033[%d;%dm%s ", 90 + rnd() % 8, 40 + rnd() % 8, w);
+                break;
+            default:
+                put(c, cap, "\033[48;5;%d;4m%s\033[24;49m ", rnd() % 256, w);
+                break;
+        }
+        x += strlen(w) + 1;
+    }
+    put(c, cap, "\033[0m\r\n");
+}
+
+static void gen_cjk(Corpus *c, size_t *cap, int cols, int rows) {
+    char s[5];
+    for (int x = 0; x < cols - 2; x++) {
+        unsigned int r = rnd() % 16;
+        unsigned long u;
+        if (r == 0) {
+            put(c, cap, " ");
+            continue;
+        } else if (r < 3) {
+            u = 0x3041 + rnd() % 0x56; /* hiragana */
+        } else if (r == 3) {
+            u = 0x1F600 + rnd() % 0x40; /* emoji, 4 bytes */
+        } else {
+            u = 0x4E00 + rnd() % 0x5200; /* CJK unified ideographs */
+        }
+        if (u < 0x10000) {
+            s[0] = 0xE0 | (u >> 12);
+            s[1] = 0x80 | ((u >> 6) & 0x3F);
+            s[2] = 0x80 | (u & 0x3F);
+            s[3] = '\0';
+        } else {
+            s[0] = 0xF0 | (u >> 18);
+            s[1] = 0x80 | ((u >> 12) & 0x3F);
+            s[2] = 0x80 | ((u >> 6) & 0x3F);
+            s[3] = 0x80 | (u & 0x3F);
+            s[4] = '\0';
+        }
+        put(c, cap, "%s", s);
+    }
+    put(c, cap, "\r\n");
+}
+
+static void syntax_line(Corpus *c, size_t *cap, int cols) {
+    int x = 0;
+    put(c, cap, "\033[33m%4d \033[0m", rnd() % 9999);
+    while (x < cols - 20) {
+        const char *w = word();
+        if (w[0] == '#' || !strcmp(w, "int") || !strcmp(w, "void") || !strcmp(w, "static") || !strcmp(w, "return"))
+            put(c, cap, "\033[32m%s\033[0m ", w);
+        else if (w[0] == '0')
+            put(c, cap, "\033[31m%s\033[0m ", w);
+        else
+            put(c, cap, "%s ", w);
+        x += strlen(w) + 1;
+    }
+    put(c, cap, "\033[K");
+}
+
+static void gen_vim(Corpus *c, size_t *cap, int cols, int rows) {
+    int n = 1 + rnd() % 4;
+
+    put(c, cap, "\033[?25l\033[1;%dr", rows - 1);
+    if (rnd() % 2) {
+        /* scroll forward: new lines enter at the bottom */
+        for (int i = 0; i < n; i++) {
+            put(c, cap, "\033[%d;1H\n\033[%d;1H", rows - 1, rows - 1);
+            syntax_line(c, cap, cols);
+        }
+    } else {
+        /* scroll backward: reverse index at the top */
+        for (int i = 0; i < n; i++) {
+            put(c, cap, "\033[1;1H\033M");
+            syntax_line(c, cap, cols);
+        }
+    }
+    put(c, cap, "\033[r\033[%d;1H\033[7m src/vt100.c [+] %*d,%d  \033[27m\033[K", rows, cols - 30, rnd() % 1300, rnd() % 80);
+    put(c, cap, "\033[%d;%dH\033[?25h", 1 + rnd() % (rows - 1), 6 + rnd() % (cols - 6));
+}
+
+static void gen_htop(Corpus *c, size_t *cap, int cols, int rows) {
+    int bar = cols / 2 - 12;
+
+    put(c, cap, "\033[?25l\033[H");
+    for (int cpu = 0; cpu < 4; cpu++) {
+        int used = rnd() % bar, sys = rnd() % (bar - used + 1);
+        put(c, cap, "\033[%d;1H\033[36m%3d\033[0m\033[1m[\033[32m%.*s\033[31m%.*s\033[0m%*s\033[1m%5.1f%%]\033[0m", cpu + 1, cpu, used,
+            "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||", sys,
+            "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||", bar - used - sys, "", (used + sys) * 100.0 / bar);
+    }
+    put(c, cap, "\033[6;1H\033[30;46m  PID USER      PRI  NI  VIRT   RES S CPU%% MEM%%   TIME+  Command%*s\033[0m", cols - 69, "");
+    for (int y = 7; y <= rows; y++) {
+        if (rnd() % 3) continue; /* only changed rows are repainted */
+        put(c, cap, "\033[%d;1H%5d \033[38;5;%dmroot\033[0m      20   0 %5dM %5dM \033[32mS\033[0m %4.1f %4.1f %2d:%02d.%02d %s\033[K", y, rnd() % 32768, 100 + rnd() % 100,
+            rnd() % 999, rnd() % 999, (rnd() % 1000) / 10.0, (rnd() % 1000) / 10.0, rnd() % 60, rnd() % 60, rnd() % 100, word());
+    }
+}
+
+static void gen_scroll(Corpus *c, size_t *cap, int cols, int rows) {
+    int top = 2 + rnd() % (rows / 4), bot = rows - 1 - rnd() % (rows / 4);
+
+    put(c, cap, "\033[%d;%dr\033[%d;1H", top, bot, bot);
+    for (int i = 0; i < 8; i++) {
+        gen_ascii(c, cap, cols, rows);
+    }
+    put(c, cap, "\033[%dS\033[%dT\033[%d;1H\033[2L\033[M\033D\033M\033[r", 1 + rnd() % 3, 1 + rnd() % 3, top + 1);
+}
+
+static void gen_dense(Corpus *c, size_t *cap, int cols, int rows) {
+    /* full screen repaint, every cell set, attributes change every few cells */
+    for (int y = 1; y <= rows; y++) {
+        put(c, cap, "\033[%d;1H", y);
+        for (int x = 0; x < cols; x++) {
+            if (x % 8 == 0) put(c, cap, "\033[0;%d;%dm", (int[]){1, 4, 7, 22}[rnd() % 4], 30 + rnd() % 8);
+            put(c, cap, "%c", '!' + rnd() % 94);
+        }
+    }
+    put(c, cap, "\033[0m");
+}
+
+static void gen_color256(Corpus *c, size_t *cap, int cols, int rows) {
+    for (int y = 1; y <= rows; y++) {
+        put(c, cap, "\033[%d;1H", y);
+        for (int x = 0; x < cols; x++) put(c, cap, "\033[38;5;%d;48;5;%dm%c", rnd() % 256, rnd() % 256, 'A' + rnd() % 26);
+    }
+    put(c, cap, "\033[0m");
+}
+
+static void gen_typing(Corpus *c, size_t *cap, int cols, int rows) {
+    /* shell line editing as typed on the OSK: one echoed character at a time */
+    const char *w = word();
+
+    put(c, cap, "\033[1;32mroot@handheld\033[0m:\033[1;34m~\033[0m# ");
+    for (int i = 0; i < 3; i++, w = word()) {
+        for (const char *p = w; *p; p++) put(c, cap, "%c", *p);
+        if (rnd() % 3 == 0) put(c, cap, "\b\033[K\b\033[K%.2s", w + (strlen(w) > 2 ? strlen(w) - 2 : 0)); /* backspace, retype */
+        if (rnd() % 4 == 0) put(c, cap, "\b\b\033[1@x\033[C\033[C"); /* insert in the middle */
+        put(c, cap, " ");
+    }
+    put(c, cap, "\r\n");
+    gen_ascii(c, cap, cols, rows);
+}
+
+int corpus_build(Corpus *c, const char *name, size_t size, int cols, int rows) {
+    void (*gen)(Corpus *, size_t *, int, int);
+    size_t cap = size + 4096;
+
+    if (!strcmp(name, "ascii")) {
+        gen = gen_ascii;
+    } else if (!strcmp(name, "sgr")) {
+        gen = gen_sgr;
+    } else if (!strcmp(name, "cjk")) {
+        gen = gen_cjk;
+    } else if (!strcmp(name, "vim")) {
+        gen = gen_vim;
+    } else if (!strcmp(name, "htop")) {
+        gen = gen_htop;
+    } else if (!strcmp(name, "scroll")) {
+        gen = gen_scroll;
+    } else if (!strcmp(name, "dense")) {
+        gen = gen_dense;
+    } else if (!strcmp(name, "color256")) {
+        gen = gen_color256;
+    } else if (!strcmp(name, "typing")) {
+        gen = gen_typing;
+    } else {
+        return 0;
+    }
+
+    c->name = name;
+    c->len = 0;
+    c->data = malloc(cap);
+    if (!c->data) return 0;
+    seed = 2463534242u;
+    if (gen == gen_vim) put(c, &cap, "\033[?1049h\033[H\033[2J");
+    while (c->len < size) gen(c, &cap, cols, rows);
+    if (gen == gen_vim) put(c, &cap, "\033[?1049l");
+
+    return 1;
+}
+
+int corpus_load(Corpus *c, const char *path) {
+    FILE *f = fopen(path, "rb");
+    long n;
+
+    if (!f) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    c->name = path;
+    c->data = malloc(n > 0 ? n : 1);
+    c->len = (c->data && n > 0) ? fread(c->data, 1, n, f) : 0;
+    fclose(f);
+
+    return c->data != NULL;
+}
+
+int corpus_dump(const Corpus *c, const char *dir) {
+    char path[PATH_MAX];
+    FILE *f;
+
+    mkdir(dir, 0755);
+    snprintf(path, sizeof(path), "%s/%s.raw", dir, c->name);
+    if (!(f = fopen(path, "wb"))) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fwrite(c->data, 1, c->len, f);
+    fclose(f);
+
+    return 1;
+}
+
+void corpus_free(Corpus *c) {
+    free(c->data);
+    c->data = NULL;
+    c->len = 0;
+}
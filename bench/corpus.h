@@ -0,0 +1,21 @@
+#ifndef __CORPUS_H__
+#define __CORPUS_H__
+
+#include <stddef.h>
+
+/* Synthetic terminal output used by the benchmarks */
+typedef struct {
+    const char *name;
+    char *data;
+    size_t len;
+} Corpus;
+
+/* Names of the built-in corpora, NULL terminated */
+extern const char *corpus_names[];
+
+int corpus_build(Corpus *corpus, const char *name, size_t size, int cols, int rows);
+int corpus_load(Corpus *corpus, const char *path);
+int corpus_dump(const Corpus *corpus, const char *dir);
+void corpus_free(Corpus *corpus);
+
+#endif
@@ -0,0 +1,78 @@
+#include "alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Prepended to every block, keeps the payload aligned like malloc() does */
+typedef union {
+    struct {
+        size_t len;
+        int tag;
+    } h;
+    max_align_t align;
+} AllocHeader;
+
+const char *alloc_tag_names[ALLOC_TAGS] = {"grid", "scrollback", "font", "surfaces", "osk", "other"};
+AllocStats alloc_stats[ALLOC_TAGS];
+uint64_t alloc_steady_count = 0;
+int alloc_assert = 0;
+
+static int steady = 0;
+
+void alloc_charge(int tag, int64_t bytes, int blocks) {
+    __atomic_fetch_add(&alloc_stats[tag].bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_stats[tag].blocks, blocks, __ATOMIC_RELAXED);
+    if (blocks <= 0) return;
+
+    __atomic_fetch_add(&alloc_stats[tag].total, blocks, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&steady, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&alloc_steady_count, blocks, __ATOMIC_RELAXED);
+        if (alloc_assert) {
+            fprintf(stderr, "allocation of %lld bytes (%s) in the steady state loop\n", (long long)bytes, alloc_tag_names[tag]);
+            abort();
+        }
+    }
+}
+
+static void *track(AllocHeader *h, int tag, size_t len) {
+    if (!h) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    h->h.len = len;
+    h->h.tag = tag;
+    alloc_charge(tag, len, 1);
+    return h + 1;
+}
+
+void *x_malloc(int tag, size_t len) { return track(malloc(sizeof(AllocHeader) + len), tag, len); }
+
+void *x_calloc(int tag, size_t nmemb, size_t size) { return track(calloc(1, sizeof(AllocHeader) + nmemb * size), tag, nmemb * size); }
+
+void *x_realloc(int tag, void *p, size_t len) {
+    AllocHeader *h;
+
+    if (!p) return x_malloc(tag, len);
+    h = (AllocHeader *)p - 1;
+    alloc_charge(h->h.tag, -(int64_t)h->h.len, -1);
+    return track(realloc(h, sizeof(AllocHeader) + len), tag, len);
+}
+
+void x_free(void *p) {
+    AllocHeader *h;
+
+    if (!p) return;
+    h = (AllocHeader *)p - 1;
+    alloc_charge(h->h.tag, -(int64_t)h->h.len, -1);
+    free(h);
+}
+
+int alloc_steady(int on) { return __atomic_exchange_n(&steady, on, __ATOMIC_RELAXED); }
+
+int64_t alloc_live_bytes(void) {
+    int64_t bytes = 0;
+
+    for (int i = 0; i < ALLOC_TAGS; i++) bytes += __atomic_load_n(&alloc_stats[i].bytes, __ATOMIC_RELAXED);
+    return bytes;
+}
@@ -0,0 +1,39 @@
+#ifndef __ALLOC_H__
+#define __ALLOC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocation accounting. Every x_malloc() block, and every surface made by
+ * blit_create_surface(), is charged to a subsystem. Once the main loop is
+ * running (steady state) nothing should allocate any more; allocations
+ * made there are counted, and abort with -allocassert.
+ */
+enum alloc_tag { ALLOC_GRID, ALLOC_SCROLLBACK, ALLOC_FONT, ALLOC_SURFACE, ALLOC_OSK, ALLOC_OTHER, ALLOC_TAGS };
+
+typedef struct {
+    int64_t bytes;  /* live */
+    int64_t blocks; /* live */
+    uint64_t total; /* allocations since start */
+} AllocStats;
+
+extern const char *alloc_tag_names[ALLOC_TAGS];
+extern AllocStats alloc_stats[ALLOC_TAGS];
+extern uint64_t alloc_steady_count; /* allocations made in steady state */
+extern int alloc_assert;
+
+void *x_malloc(int tag, size_t len);
+void *x_calloc(int tag, size_t nmemb, size_t size);
+void *x_realloc(int tag, void *p, size_t len);
+void x_free(void *p);
+
+/* Charge memory allocated elsewhere, negative bytes and blocks to release it */
+void alloc_charge(int tag, int64_t bytes, int blocks);
+
+/* Enter (1) or leave (0) the steady state, returns the previous state */
+int alloc_steady(int on);
+
+int64_t alloc_live_bytes(void);
+
+#endif
@@ -0,0 +1,32 @@
+#include "blit.h"
+
+#include "alloc.h"
+#include "cpu.h"
+
+/*
+ * Rotate src into dst by 90 or 270 degrees (clockwise), dst must be src
+ * with width and height swapped.
+ */
+void blit_rotate(SDL_Surface *src, SDL_Surface *dst, int angle) {
+    SDL_LockSurface(src);
+    SDL_LockSurface(dst);
+    cpu_rotate16(src->pixels, src->pitch / 2, dst->pixels, dst->pitch / 2, src->w, src->h, angle);
+    SDL_UnlockSurface(dst);
+    SDL_UnlockSurface(src);
+}
+
+SDL_Surface *blit_create_surface(int tag, int w, int h) {
+    SDL_Surface *surface = SDL_CreateRGBSurface(0, w, h, 16, 0xF800, 0x7E0, 0x1F, 0);
+
+    if (surface) {
+        surface->userdata = (void *)(intptr_t)tag;  // for blit_free_surface()
+        alloc_charge(tag, (int64_t)surface->pitch * h, 1);
+    }
+    return surface;
+}
+
+void blit_free_surface(SDL_Surface *surface) {
+    if (!surface) return;
+    alloc_charge((intptr_t)surface->userdata, -(int64_t)surface->pitch * surface->h, -1);
+    SDL_FreeSurface(surface);
+}
@@ -0,0 +1,13 @@
+#ifndef __BLIT_H__
+#define __BLIT_H__
+
+#include <SDL2/SDL.h>
+
+/* Compositor kernels on 16-bit (RGB565) surfaces */
+void blit_rotate(SDL_Surface *src, SDL_Surface *dst, int angle);
+
+/* RGB565 surface charged to an alloc_tag, free it with blit_free_surface() */
+SDL_Surface *blit_create_surface(int tag, int w, int h);
+void blit_free_surface(SDL_Surface *surface);
+
+#endif
@@ -0,0 +1,250 @@
+#include "capture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+#define CAPTURE_RING_SIZE (1 << 20) /* bytes, power of 2 */
+#define CAPTURE_OUT_SIZE (64 * 1024)
+#define CAPTURE_FLUSH_MS 100
+
+/* Ring record, followed by len bytes of data */
+typedef struct {
+    uint64_t ts;
+    uint32_t len;
+    uint32_t type; /* 'o' output, 'r' resize */
+} CaptureRecord;
+
+int capture_enabled = 0;
+
+static char ring[CAPTURE_RING_SIZE];
+static uint32_t head; /* written by the tty thread */
+static uint32_t tail; /* written by the writer thread */
+static uint64_t dropped;
+
+static int fd = -1;
+static int format;
+static uint64_t start;
+static char out[CAPTURE_OUT_SIZE];
+static size_t outlen;
+static char carry[4]; /* incomplete utf8 char at the end of the last cast event */
+static int carrylen;
+static pthread_t writer;
+static int writer_should_exit;
+
+extern char termname[];
+
+static void ring_put(uint32_t pos, const void *p, size_t len) {
+    size_t off = pos & (CAPTURE_RING_SIZE - 1), n = CAPTURE_RING_SIZE - off;
+
+    if (n > len) n = len;
+    memcpy(ring + off, p, n);
+    memcpy(ring, (const char *)p + n, len - n);
+}
+
+static void ring_get(uint32_t pos, void *p, size_t len) {
+    size_t off = pos & (CAPTURE_RING_SIZE - 1), n = CAPTURE_RING_SIZE - off;
+
+    if (n > len) n = len;
+    memcpy(p, ring + off, n);
+    memcpy((char *)p + n, ring, len - n);
+}
+
+static void push(int type, const char *buf, size_t len) {
+    CaptureRecord r = {perf_now(), len, type};
+
+    if (CAPTURE_RING_SIZE - (head - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) < sizeof(r) + len) {
+        __atomic_fetch_add(&dropped, len, __ATOMIC_RELAXED);
+        return;
+    }
+    ring_put(head, &r, sizeof(r));
+    ring_put(head + sizeof(r), buf, len);
+    __atomic_store_n(&head, head + sizeof(r) + len, __ATOMIC_RELEASE);
+}
+
+void capture_write(const char *buf, size_t len) {
+    if (capture_enabled && len > 0) push('o', buf, len);
+}
+
+void capture_resize(int cols, int rows) {
+    char s[32];
+
+    if (capture_enabled) push('r', s, snprintf(s, sizeof(s), "%dx%d", cols, rows));
+}
+
+/* Write all of s, retrying short writes and EINTR */
+static void write_all(const char *s, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t r = write(fd, s + done, len - done);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error writing in capture: %s\n", strerror(errno));
+            break;
+        }
+        done += r;
+    }
+}
+
+static void flush(void) {
+    write_all(out, outlen);
+    outlen = 0;
+}
+
+static void emit(const char *s, size_t len) {
+    if (outlen + len > CAPTURE_OUT_SIZE) flush();
+    if (len > CAPTURE_OUT_SIZE) {
+        write_all(s, len);
+        return;
+    }
+    memcpy(out + outlen, s, len);
+    outlen += len;
+}
+
+/* Length of the incomplete utf8 char at the end of s, if any */
+static int utf8_tail(const unsigned char *s, int len) {
+    for (int i = 1; i <= 3 && i <= len; i++) {
+        unsigned char c = s[len - i];
+        if ((c & 0xC0) == 0x80) continue;  /* continuation byte */
+        if (c >= 0xF0) return i < 4 ? i : 0;
+        if (c >= 0xE0) return i < 3 ? i : 0;
+        if (c >= 0xC0) return i < 2 ? i : 0;
+        return 0;
+    }
+    return 0;
+}
+
+/* asciicast v2 event line: [time, "o", "data"] */
+static void emit_cast(uint64_t ts, int type, const char *data, int len) {
+    char s[64], esc[8];
+
+    snprintf(s, sizeof(s), "[%.6f, \"%c\", \"", (ts - start) / 1e9, type);
+    emit(s, strlen(s));
+    for (int i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\', esc[1] = c;
+            emit(esc, 2);
+        } else if (c < 0x20 || c == 0x7F) {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            emit(esc, 6);
+        } else {
+            emit((const char *)&c, 1);
+        }
+    }
+    emit("\"]\n", 3);
+}
+
+static void drain(void) {
+    uint32_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE), t = tail;
+    static char data[BUFSIZ * 4 + 4];
+    CaptureRecord r;
+    uint64_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+
+    if (lost) {
+        if (format == CAPTURE_CAST) {
+            int n = snprintf(data, sizeof(data), "%llu bytes dropped", (unsigned long long)lost);
+            emit_cast(perf_now(), 'm', data, n);
+        } else {
+            fprintf(stderr, "capture: %llu bytes dropped, output is too slow\n", (unsigned long long)lost);
+        }
+    }
+
+    while (t != h) {
+        ring_get(t, &r, sizeof(r));
+        t += sizeof(r);
+        if (format == CAPTURE_RAW) {
+            if (r.type != 'o') { /* raw logs only carry output */
+                t += r.len;
+                r.len = 0;
+            }
+            while (r.len > 0) {
+                size_t n = r.len < sizeof(data) ? r.len : sizeof(data);
+                ring_get(t, data, n);
+                emit(data, n);
+                t += n, r.len -= n;
+            }
+        } else if (r.type != 'o') {
+            size_t len = r.len < sizeof(data) ? r.len : sizeof(data);
+            ring_get(t, data, len);
+            t += r.len;
+            emit_cast(r.ts, r.type, data, len);
+        } else {
+            int n = carrylen, keep;
+            size_t len = r.len < sizeof(data) - 4 ? r.len : sizeof(data) - 4;
+
+            memcpy(data, carry, carrylen);
+            ring_get(t, data + n, len);
+            t += r.len;
+            n += len;
+            keep = utf8_tail((unsigned char *)data, n);
+            memcpy(carry, data + n - keep, keep);
+            carrylen = keep;
+            if (n - keep > 0) emit_cast(r.ts, r.type, data, n - keep);
+        }
+        __atomic_store_n(&tail, t, __ATOMIC_RELEASE);
+    }
+    flush();
+}
+
+static void *capture_writer(void *unused) {
+    struct timespec tv = {0, CAPTURE_FLUSH_MS * 1000000};
+    sigset_t set;
+    (void)unused;
+
+    /* SIGCHLD exits through capture_close(), which joins this thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (!__atomic_load_n(&writer_should_exit, __ATOMIC_ACQUIRE)) {
+        nanosleep(&tv, NULL);
+        drain();
+    }
+    return NULL;
+}
+
+int capture_open(const char *path, int fmt, int cols, int rows) {
+    fd = (!strcmp(path, "-")) ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    format = fmt;
+    start = perf_now();
+    if (format == CAPTURE_CAST) {
+        char header[256];
+        int n = snprintf(header, sizeof(header), "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld, \"env\": {\"TERM\": \"%s\"}}\n", cols, rows,
+                         (long)time(NULL), termname);
+        emit(header, n);
+    }
+
+    if (pthread_create(&writer, NULL, capture_writer, NULL)) {
+        fprintf(stderr, "Unable to create capture writer thread\n");
+        if (fd != STDOUT_FILENO) close(fd);
+        fd = -1;
+        return 0;
+    }
+    capture_enabled = 1;
+    atexit(capture_close);
+    return 1;
+}
+
+void capture_close(void) {
+    if (!capture_enabled) return;
+    capture_enabled = 0;
+    __atomic_store_n(&writer_should_exit, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    drain();
+    if (fd != STDOUT_FILENO) close(fd);
+    fd = -1;
+}
@@ -0,0 +1,20 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+
+/*
+ * Output log (-o file). The tty thread appends raw pty chunks to a ring,
+ * a writer thread flushes them in large writes. When the ring is full
+ * (slow media) chunks are dropped and counted instead of blocking.
+ */
+enum capture_format { CAPTURE_RAW, CAPTURE_CAST };
+
+extern int capture_enabled;
+
+int capture_open(const char *path, int format, int cols, int rows);
+void capture_close(void);
+void capture_write(const char *buf, size_t len);
+void capture_resize(int cols, int rows);
+
+#endif
@@ -4,7 +4,7 @@ static int borderpx = 2;
 char default_shell[] = "/bin/bash";
 
 /* Scrollback configuration */
-int scrollback_lines = 256;  /* Number of lines to keep in scrollback buffer */
+int scrollback_kb = 4096;  /* Compressed scrollback size in KB, the oldest lines are dropped beyond it */
 
 static int initial_width = 320;
 static int initial_height = 240;
@@ -16,6 +16,22 @@ static int opt_fontshade = 0;  // 0=solid, 1=blended, 2=shaded, only used if opt
 static int opt_use_embedded_font_for_keyboard = 0;
 
 static const Uint32 BUTTON_HELD_DELAY = 150;  // milliseconds between button triggers when held
+static const Uint32 LATENCY_INJECT_INTERVAL = 100;  // milliseconds between keystrokes injected by -latencyinject
+
+/* -smoothscroll */
+static const float SCROLL_SPEED = 20;       // rows per second when L2/R2 has just been held, it grows while held
+static const float SCROLL_SPEED_MAX = 600;  // rows per second, also at full stick
+static const int SCROLL_AXIS = 1;           // joystick axis that scrolls (left stick vertical), up scrolls back
+static const int SCROLL_DEADZONE = 8000;
+
+/*
+ * Output triggers, "action:pattern" as for -trigger: action is
+ * highlight[=color], popup or mark, a pattern in slashes is a regex.
+ * Examples: "highlight=9:error:", "popup:/make.*Error [0-9]+/", "mark:FAILED"
+ */
+static const char *triggers[] = {
+    NULL,
+};
 
 /* TERM value */
 char termname[] = "xterm";
@@ -0,0 +1,355 @@
+#include "control.h"
+
+#include <SDL2/SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "cpu.h"
+#include "export.h"
+#include "keyboard.h"
+#include "perf.h"
+#include "vt100.h"
+
+#define CONTROL_CLIENTS 4
+#define CONTROL_LINE_SIZ 1024
+#define CONTROL_SEND_TIMEOUT 100 /* ms a client may take to read a reply */
+#define CONTROL_OUT_SIZ 16384    /* reply buffer, allocated up front so replies don't allocate */
+
+#define CONTROL_HELP                                       \
+    "text <string>   type text, C escapes \\n \\r \\t \\e \\xHH\n" \
+    "key <name>      press a key, SDL key name with optional ctrl+ alt+ shift+\n" \
+    "screen          screen rows as text\n"                 \
+    "cells           set cells as: y x char mode fg bg\n"  \
+    "cursor          cursor position, state and term modes\n" \
+    "perf            performance counters\n"               \
+    "alloc           live bytes and blocks per subsystem\n" \
+    "screenshot      save a screenshot\n"                  \
+    "export [text|ansi|html] <file|\"|command\">\n"        \
+    "                stream history and the screen, in the background\n" \
+    "export          state of the running or last export\n" \
+    "export stop     stop the running export\n"
+
+typedef struct {
+    int fd;
+    char line[CONTROL_LINE_SIZ];
+    int len;
+} ControlClient;
+
+static int listen_fd = -1;
+static char *socket_path;
+static ControlClient clients[CONTROL_CLIENTS];
+static char *out;
+static size_t outlen, outcap;
+
+static void reply(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    for (;;) {
+        va_start(ap, fmt);
+        n = vsnprintf(out + outlen, outcap - outlen, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (outlen + n < outcap) break;
+        outcap = (outlen + n) * 2;
+        out = x_realloc(ALLOC_OTHER, out, outcap);
+    }
+    outlen += n;
+}
+
+/* Never blocks the tty thread for long: a client that does not read its replies is dropped */
+static int client_send(int fd, const char *s, size_t len) {
+    struct pollfd p = {.fd = fd, .events = POLLOUT};
+
+    while (len > 0) {
+        ssize_t n = send(fd, s, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN || poll(&p, 1, CONTROL_SEND_TIMEOUT) <= 0) return 0;
+            continue;
+        }
+        s += n;
+        len -= n;
+    }
+    return 1;
+}
+
+int control_open(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, CONTROL_CLIENTS) < 0) {
+        fprintf(stderr, "Unable to open control socket %s:%s\n", path, strerror(errno));
+        if (listen_fd >= 0) close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    for (int i = 0; i < CONTROL_CLIENTS; i++) clients[i].fd = -1;
+    socket_path = strdup(path);
+    out = x_malloc(ALLOC_OTHER, outcap = CONTROL_OUT_SIZ);
+    atexit(control_close);
+    return 1;
+}
+
+void control_close(void) {
+    if (listen_fd < 0) return;
+    for (int i = 0; i < CONTROL_CLIENTS; i++)
+        if (clients[i].fd >= 0) close(clients[i].fd);
+    x_free(out);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    free(socket_path);
+}
+
+int control_fdset(fd_set *rfd, int maxfd) {
+    if (listen_fd < 0) return maxfd;
+    FD_SET(listen_fd, rfd);
+    maxfd = MAX(maxfd, listen_fd);
+    for (int i = 0; i < CONTROL_CLIENTS; i++) {
+        if (clients[i].fd < 0) continue;
+        FD_SET(clients[i].fd, rfd);
+        maxfd = MAX(maxfd, clients[i].fd);
+    }
+    return maxfd;
+}
+
+/* C escapes to bytes, in place */
+static int unescape(char *s) {
+    char *o = s, *start = s;
+
+    for (; *s; s++) {
+        if (*s != '\\' || !s[1]) {
+            *o++ = *s;
+            continue;
+        }
+        switch (*++s) {
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'e': *o++ = '\033'; break;
+            case 'x':
+                if (s[1] && s[2]) {
+                    *o++ = strtoul((char[3]){s[1], s[2], 0}, NULL, 16);
+                    s += 2;
+                }
+                break;
+            default: *o++ = *s; break;
+        }
+    }
+    return o - start;
+}
+
+/* Same path as typed text: an SDL_TEXTINPUT event handled by text_input() */
+static void cmd_text(char *arg) {
+    int len = unescape(arg);
+    SDL_Event ev = {.text = {.type = SDL_TEXTINPUT}};
+
+    for (int off = 0; off < len; off += sizeof(ev.text.text) - 1) {
+        int n = MIN(len - off, (int)sizeof(ev.text.text) - 1);
+        memcpy(ev.text.text, arg + off, n);
+        ev.text.text[n] = '\0';
+        SDL_PushEvent(&ev);
+    }
+    reply("ok\n");
+}
+
+/* Synthetic like the on-screen keyboard keys, so the OSK passes it to k_press() */
+static void cmd_key(char *arg) {
+    SDL_Event ev = {.key = {.type = SDL_KEYDOWN, .state = SDL_PRESSED}};
+    Uint16 mod = KMOD_SYNTHETIC;
+    char *plus;
+
+    while ((plus = strchr(arg, '+')) && plus != arg) {
+        *plus = '\0';
+        if (!strcasecmp(arg, "ctrl")) {
+            mod |= KMOD_LCTRL;
+        } else if (!strcasecmp(arg, "alt")) {
+            mod |= KMOD_LALT;
+        } else if (!strcasecmp(arg, "shift")) {
+            mod |= KMOD_LSHIFT;
+        } else {
+            reply("error unknown modifier %s\n", arg);
+            return;
+        }
+        arg = plus + 1;
+    }
+    if ((ev.key.keysym.sym = SDL_GetKeyFromName(arg)) == SDLK_UNKNOWN) {
+        reply("error unknown key %s\n", arg);
+        return;
+    }
+    ev.key.keysym.mod = mod;
+    SDL_PushEvent(&ev);
+    ev.key.type = SDL_KEYUP;
+    ev.key.state = SDL_RELEASED;
+    SDL_PushEvent(&ev);
+    reply("ok\n");
+}
+
+static void cmd_screen(int cells) {
+    for (int y = 0; y < term->row; y++) {
+        for (int x = 0; x < term->col; x++) {
+            Glyph *g = &term->line[y][x];
+            if (cells) {
+                if (g->state & GLYPH_SET) reply("%d %d %.*s %d %d %d\n", y, x, utf8_size(g->c), g->c, g->mode, g->fg, g->bg);
+            } else {
+                reply("%.*s", (g->state & GLYPH_SET) ? utf8_size(g->c) : 1, (g->state & GLYPH_SET) ? g->c : " ");
+            }
+        }
+        if (!cells) reply("\n");
+    }
+    reply("ok\n");
+}
+
+static void cmd_cursor(void) {
+    reply("cursor %d %d hidden=%d wrapnext=%d cols=%d rows=%d mode=0x%x altscreen=%d appkeypad=%d scroll_offset=%d\nok\n", term->c.x, term->c.y,
+          !!(term->c.state & CURSOR_HIDE), !!(term->c.state & CURSOR_WRAPNEXT), term->col, term->row, term->mode, !!IS_SET(MODE_ALTSCREEN), !!IS_SET(MODE_APPKEYPAD),
+          term->scroll_offset);
+}
+
+static void cmd_perf(void) {
+    static const char *names[PERF_COUNTERS] = {"pty_bytes", "putc", "frames", "idle_wakeups"};
+
+    for (int i = 0; i < PERF_COUNTERS; i++) reply("%s %llu\n", names[i], (unsigned long long)__atomic_load_n(&perf_counters[i], __ATOMIC_RELAXED));
+    for (int i = 0; i < PERF_STAGES; i++) reply("last_frame_%s_us %.1f\n", perf_stage_names[i], perf_last_frame.stage_ns[i] / 1e3);
+    reply("last_frame_dirty_rows %llu\nlast_frame_x_draws %llu\n", (unsigned long long)perf_last_frame.dirty_rows, (unsigned long long)perf_last_frame.x_draws);
+    reply("cpu_kernels %s\nok\n", cpu_describe());
+}
+
+static void cmd_alloc(void) {
+    for (int i = 0; i < ALLOC_TAGS; i++)
+        reply("%s bytes %lld blocks %lld total %llu\n", alloc_tag_names[i], (long long)__atomic_load_n(&alloc_stats[i].bytes, __ATOMIC_RELAXED),
+              (long long)__atomic_load_n(&alloc_stats[i].blocks, __ATOMIC_RELAXED), (unsigned long long)__atomic_load_n(&alloc_stats[i].total, __ATOMIC_RELAXED));
+    reply("steady_state_allocations %llu\nok\n", (unsigned long long)__atomic_load_n(&alloc_steady_count, __ATOMIC_RELAXED));
+}
+
+static void cmd_export(char *arg) {
+    char msg[256], *dest = arg, *sp;
+    int format = EXPORT_TEXT;
+
+    if (!arg) {
+        export_status(msg, sizeof(msg));
+        reply("%s\nok\n", msg);
+        return;
+    }
+    if (!strcmp(arg, "stop")) {
+        export_stop();
+        reply("ok\n");
+        return;
+    }
+    /* the format is optional, a path may have spaces */
+    if ((sp = strchr(arg, ' '))) {
+        *sp = '\0';
+        if ((format = export_format(arg)) >= 0) {
+            dest = sp + 1;
+        } else {
+            *sp = ' ';
+            format = EXPORT_TEXT;
+        }
+    }
+    if (!export_start(dest, format, 0, INT64_MAX, msg, sizeof(msg))) {
+        reply("error %s\n", msg);
+        return;
+    }
+    reply("%s\nok\n", msg);
+}
+
+static void command(char *line) {
+    char *arg = strchr(line, ' ');
+
+    if (arg) *arg++ = '\0';
+    if (!strcmp(line, "text") && arg) {
+        cmd_text(arg);
+    } else if (!strcmp(line, "key") && arg) {
+        cmd_key(arg);
+    } else if (!strcmp(line, "screen")) {
+        cmd_screen(0);
+    } else if (!strcmp(line, "cells")) {
+        cmd_screen(1);
+    } else if (!strcmp(line, "cursor")) {
+        cmd_cursor();
+    } else if (!strcmp(line, "perf")) {
+        cmd_perf();
+    } else if (!strcmp(line, "alloc")) {
+        cmd_alloc();
+    } else if (!strcmp(line, "export")) {
+        cmd_export(arg);
+    } else if (!strcmp(line, "screenshot")) {
+        SDL_Event ev = {.user = {.type = SDL_USEREVENT, .code = 1}};
+        SDL_PushEvent(&ev);
+        reply("ok\n");
+    } else if (!strcmp(line, "help")) {
+        reply(CONTROL_HELP "ok\n");
+    } else {
+        reply("error unknown command %s, try help\n", line);
+    }
+}
+
+static void client_close(ControlClient *c) {
+    close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+static void client_read(ControlClient *c) {
+    ssize_t n = read(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len);
+    char *nl;
+
+    if (n <= 0) {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        client_close(c);
+        return;
+    }
+    c->len += n;
+    c->line[c->len] = '\0';
+    while ((nl = strchr(c->line, '\n'))) {
+        *nl = '\0';
+        if (nl > c->line && nl[-1] == '\r') nl[-1] = '\0';
+        outlen = 0;
+        command(c->line);
+        if (!client_send(c->fd, out, outlen)) {
+            client_close(c);
+            return;
+        }
+        c->len -= nl + 1 - c->line;
+        memmove(c->line, nl + 1, c->len + 1);
+    }
+    if (c->len == sizeof(c->line) - 1) {
+        send(c->fd, "error line too long\n", 20, MSG_DONTWAIT | MSG_NOSIGNAL);
+        client_close(c);
+    }
+}
+
+void control_handle(fd_set *rfd) {
+    if (listen_fd < 0) return;
+    if (FD_ISSET(listen_fd, rfd)) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC), i;
+        for (i = 0; fd >= 0 && i < CONTROL_CLIENTS && clients[i].fd >= 0; i++)
+            ;
+        if (fd >= 0 && i == CONTROL_CLIENTS) {
+            send(fd, "error too many clients\n", 23, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(fd);
+        } else if (fd >= 0) {
+            clients[i].fd = fd;
+            clients[i].len = 0;
+        }
+    }
+    for (int i = 0; i < CONTROL_CLIENTS; i++)
+        if (clients[i].fd >= 0 && FD_ISSET(clients[i].fd, rfd)) client_read(&clients[i]);
+}
@@ -0,0 +1,16 @@
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <sys/select.h>
+
+/*
+ * Line based control socket (-control /path/sock) for test automation.
+ * Served by the tty thread, which owns the terminal state, from the same
+ * select() as the shell.
+ */
+int control_open(const char *path);
+void control_close(void);
+int control_fdset(fd_set *rfd, int maxfd);
+void control_handle(fd_set *rfd);
+
+#endif
@@ -0,0 +1,305 @@
+#include "cpu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__aarch64__) || defined(__arm__)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMD
+#define HWCAP_ASIMD (1 << 1) /* aarch64 */
+#endif
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12) /* arm */
+#endif
+/* armv7 builds for devices without NEON still carry the NEON kernels, unless soft-float */
+#if defined(__aarch64__) || (defined(__ARM_FP) && __ARM_ARCH >= 7)
+#define CPU_NEON_KERNELS
+#endif
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_X86_KERNELS
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+unsigned int cpu_features = 0;
+
+static void rotate16_scalar(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle);
+static size_t ascii_span_scalar(const char *s, size_t n);
+static size_t find_scalar(const char *s, size_t n, const char *q, size_t m);
+
+void (*cpu_rotate16)(const uint16_t *, int, uint16_t *, int, int, int, int) = rotate16_scalar;
+size_t (*cpu_ascii_span)(const char *, size_t) = ascii_span_scalar;
+size_t (*cpu_find)(const char *, size_t, const char *, size_t) = find_scalar;
+
+/* Rotate the src pixels in [x0, x1) x [y0, y1) */
+static void rotate_rect(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle, int x0, int x1, int y0, int y1) {
+    if (angle == 90) {
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) dst[x * dpitch + sh - 1 - y] = src[y * spitch + x];
+    } else {  // 270 degrees
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) dst[(sw - 1 - x) * dpitch + y] = src[y * spitch + x];
+    }
+}
+
+static void rotate16_scalar(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle) {
+    rotate_rect(src, spitch, dst, dpitch, sw, sh, angle, 0, sw, 0, sh);
+}
+
+/* The SIMD rotations move 8x8 tiles, this does what is left at the right and bottom */
+static void rotate_edges(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle) {
+    int tw = sw & ~7, th = sh & ~7;
+
+    rotate_rect(src, spitch, dst, dpitch, sw, sh, angle, tw, sw, 0, sh);
+    rotate_rect(src, spitch, dst, dpitch, sw, sh, angle, 0, tw, th, sh);
+}
+
+static size_t ascii_span_scalar(const char *s, size_t n) {
+    size_t i = 0;
+
+    while (i < n && (unsigned char)s[i] >= 0x20 && (unsigned char)s[i] < 0x7f) i++;
+    return i;
+}
+
+static inline int fold(int c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; }
+
+/* Whether the m bytes at s match q */
+static inline int match_at(const char *s, const char *q, size_t m) {
+    for (size_t j = 0; j < m; j++) {
+        if (fold((unsigned char)s[j]) != (unsigned char)q[j]) return 0;
+    }
+    return 1;
+}
+
+static size_t find_scalar(const char *s, size_t n, const char *q, size_t m) {
+    for (size_t i = 0; i + m <= n; i++) {
+        if (fold((unsigned char)s[i]) == (unsigned char)q[0] && match_at(s + i, q, m)) return i;
+    }
+    return n;
+}
+
+#ifdef CPU_NEON_KERNELS
+#if defined(__arm__) && !defined(__ARM_NEON)
+#pragma GCC push_options
+#pragma GCC target("fpu=neon")
+#endif
+#include <arm_neon.h>
+
+static inline void transpose8_neon(uint16x8_t r[8]) {
+    uint16x8x2_t p01 = vtrnq_u16(r[0], r[1]), p23 = vtrnq_u16(r[2], r[3]);
+    uint16x8x2_t p45 = vtrnq_u16(r[4], r[5]), p67 = vtrnq_u16(r[6], r[7]);
+    uint32x4x2_t q0 = vtrnq_u32(vreinterpretq_u32_u16(p01.val[0]), vreinterpretq_u32_u16(p23.val[0]));
+    uint32x4x2_t q1 = vtrnq_u32(vreinterpretq_u32_u16(p01.val[1]), vreinterpretq_u32_u16(p23.val[1]));
+    uint32x4x2_t q2 = vtrnq_u32(vreinterpretq_u32_u16(p45.val[0]), vreinterpretq_u32_u16(p67.val[0]));
+    uint32x4x2_t q3 = vtrnq_u32(vreinterpretq_u32_u16(p45.val[1]), vreinterpretq_u32_u16(p67.val[1]));
+
+#define HALVES(a, b, half) vcombine_u16(vget_##half##_u16(vreinterpretq_u16_u32(a)), vget_##half##_u16(vreinterpretq_u16_u32(b)))
+    r[0] = HALVES(q0.val[0], q2.val[0], low);
+    r[1] = HALVES(q1.val[0], q3.val[0], low);
+    r[2] = HALVES(q0.val[1], q2.val[1], low);
+    r[3] = HALVES(q1.val[1], q3.val[1], low);
+    r[4] = HALVES(q0.val[0], q2.val[0], high);
+    r[5] = HALVES(q1.val[0], q3.val[0], high);
+    r[6] = HALVES(q0.val[1], q2.val[1], high);
+    r[7] = HALVES(q1.val[1], q3.val[1], high);
+#undef HALVES
+}
+
+static inline uint16x8_t reverse8_neon(uint16x8_t v) {
+    v = vrev64q_u16(v);
+    return vcombine_u16(vget_high_u16(v), vget_low_u16(v));
+}
+
+static void rotate16_neon(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle) {
+    uint16x8_t r[8];
+
+    for (int y = 0; y + 8 <= sh; y += 8) {
+        for (int x = 0; x + 8 <= sw; x += 8) {
+            for (int i = 0; i < 8; i++) r[i] = vld1q_u16(src + (y + i) * spitch + x);
+            transpose8_neon(r);
+            for (int j = 0; j < 8; j++) {
+                if (angle == 90)
+                    vst1q_u16(dst + (x + j) * dpitch + sh - 8 - y, reverse8_neon(r[j]));
+                else
+                    vst1q_u16(dst + (sw - 1 - x - j) * dpitch + y, r[j]);
+            }
+        }
+    }
+    rotate_edges(src, spitch, dst, dpitch, sw, sh, angle);
+}
+
+static size_t ascii_span_neon(const char *s, size_t n) {
+    const uint8x16_t lo = vdupq_n_u8(0x20), hi = vdupq_n_u8(0x7f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+        uint8x16_t ok = vandq_u8(vcgeq_u8(v, lo), vcltq_u8(v, hi));
+        /* one nibble per byte */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(ok), 4)), 0);
+        if (mask != ~0ull) return i + (__builtin_ctzll(~mask) >> 2);
+    }
+    return i + ascii_span_scalar(s + i, n - i);
+}
+
+/*
+ * Candidates are where both the first and the last byte of q match, with
+ * case folded by setting bit 5 on both sides (which also pairs a few
+ * punctuation bytes, match_at() sorts them out).
+ */
+static size_t find_neon(const char *s, size_t n, const char *q, size_t m) {
+    const uint8x16_t bit5 = vdupq_n_u8(0x20), first = vdupq_n_u8(q[0] | 0x20), last = vdupq_n_u8(q[m - 1] | 0x20);
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        uint8x16_t a = vceqq_u8(vorrq_u8(vld1q_u8((const uint8_t *)s + i), bit5), first);
+        uint8x16_t b = vceqq_u8(vorrq_u8(vld1q_u8((const uint8_t *)s + i + m - 1), bit5), last);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vandq_u8(a, b)), 4)), 0);
+
+        /* a nibble per byte */
+        for (int bit; mask; mask &= ~(0xFull << bit)) {
+            bit = __builtin_ctzll(mask);
+            if (match_at(s + i + (bit >> 2), q, m)) return i + (bit >> 2);
+        }
+    }
+    return i + find_scalar(s + i, n - i, q, m);
+}
+
+#if defined(__arm__) && !defined(__ARM_NEON)
+#pragma GCC pop_options
+#endif
+#endif
+
+#ifdef CPU_X86_KERNELS
+static inline SSE2 void transpose8_sse2(__m128i r[8]) {
+    __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+    __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+    __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+    __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+    r[0] = _mm_unpacklo_epi64(b0, b4);
+    r[1] = _mm_unpackhi_epi64(b0, b4);
+    r[2] = _mm_unpacklo_epi64(b1, b5);
+    r[3] = _mm_unpackhi_epi64(b1, b5);
+    r[4] = _mm_unpacklo_epi64(b2, b6);
+    r[5] = _mm_unpackhi_epi64(b2, b6);
+    r[6] = _mm_unpacklo_epi64(b3, b7);
+    r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static inline SSE2 __m128i reverse8_sse2(__m128i v) {
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+static SSE2 void rotate16_sse2(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle) {
+    __m128i r[8];
+
+    for (int y = 0; y + 8 <= sh; y += 8) {
+        for (int x = 0; x + 8 <= sw; x += 8) {
+            for (int i = 0; i < 8; i++) r[i] = _mm_loadu_si128((const __m128i *)(src + (y + i) * spitch + x));
+            transpose8_sse2(r);
+            for (int j = 0; j < 8; j++) {
+                if (angle == 90)
+                    _mm_storeu_si128((__m128i *)(dst + (x + j) * dpitch + sh - 8 - y), reverse8_sse2(r[j]));
+                else
+                    _mm_storeu_si128((__m128i *)(dst + (sw - 1 - x - j) * dpitch + y), r[j]);
+            }
+        }
+    }
+    rotate_edges(src, spitch, dst, dpitch, sw, sh, angle);
+}
+
+static SSE2 size_t ascii_span_sse2(const char *s, size_t n) {
+    const __m128i lo = _mm_set1_epi8(0x1f), hi = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+
+    /* signed compares: bytes >= 0x80 are negative and fail the first one */
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+        if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+    }
+    return i + ascii_span_scalar(s + i, n - i);
+}
+
+static AVX2 size_t ascii_span_avx2(const char *s, size_t n) {
+    const __m256i lo = _mm256_set1_epi8(0x1f), hi = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v)));
+        if (mask != 0xFFFFFFFFu) return i + __builtin_ctz(~mask);
+    }
+    return i + ascii_span_sse2(s + i, n - i);
+}
+
+/* See find_neon() */
+static SSE2 size_t find_sse2(const char *s, size_t n, const char *q, size_t m) {
+    const __m128i bit5 = _mm_set1_epi8(0x20), first = _mm_set1_epi8(q[0] | 0x20), last = _mm_set1_epi8(q[m - 1] | 0x20);
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i)), bit5), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i + m - 1)), bit5), last);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+
+        for (; mask; mask &= mask - 1) {
+            if (match_at(s + i + __builtin_ctz(mask), q, m)) return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_scalar(s + i, n - i, q, m);
+}
+#endif
+
+void cpu_init(unsigned int mask) {
+    unsigned int features = 0;
+
+#if defined(CPU_NEON_KERNELS) && defined(__aarch64__)
+    if (getauxval(AT_HWCAP) & HWCAP_ASIMD) features |= CPU_NEON;
+#elif defined(CPU_NEON_KERNELS)
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) features |= CPU_NEON;
+#elif defined(CPU_X86_KERNELS)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) features |= CPU_SSE2;
+    if (__builtin_cpu_supports("avx2")) features |= CPU_AVX2;
+#endif
+    cpu_features = features & mask;
+
+    cpu_rotate16 = rotate16_scalar;
+    cpu_ascii_span = ascii_span_scalar;
+    cpu_find = find_scalar;
+#ifdef CPU_NEON_KERNELS
+    if (cpu_features & CPU_NEON) {
+        cpu_rotate16 = rotate16_neon;
+        cpu_ascii_span = ascii_span_neon;
+        cpu_find = find_neon;
+    }
+#endif
+#ifdef CPU_X86_KERNELS
+    if (cpu_features & CPU_SSE2) {
+        cpu_rotate16 = rotate16_sse2;
+        cpu_ascii_span = ascii_span_sse2;
+        cpu_find = find_sse2;
+    }
+    /* the 8x8 rotation tiles gain nothing from 256 bit registers */
+    if (cpu_features & CPU_AVX2) cpu_ascii_span = ascii_span_avx2;
+#endif
+}
+
+const char *cpu_describe(void) {
+    static char s[32];
+
+    s[0] = '\0';
+    if (cpu_features & CPU_NEON) strcat(s, " neon");
+    if (cpu_features & CPU_SSE2) strcat(s, " sse2");
+    if (cpu_features & CPU_AVX2) strcat(s, " avx2");
+    return s[0] ? s + 1 : "scalar";
+}
@@ -0,0 +1,29 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Runtime CPU feature dispatch. cpu_init() detects the SIMD extensions of
+ * the CPU we run on and points the kernels below at the best variant.
+ * Until it is called they point at the portable scalar code.
+ */
+enum cpu_feature { CPU_NEON = 1 << 0, CPU_SSE2 = 1 << 1, CPU_AVX2 = 1 << 2 };
+
+extern unsigned int cpu_features; /* detected and enabled cpu_feature bits */
+
+/* Detect, keep only the features in mask (0 forces scalar), select kernels */
+void cpu_init(unsigned int mask);
+const char *cpu_describe(void);
+
+/* Rotate a sw x sh RGB565 image by 90 or 270 degrees clockwise into dst (sh x sw), pitches in pixels */
+extern void (*cpu_rotate16)(const uint16_t *src, int spitch, uint16_t *dst, int dpitch, int sw, int sh, int angle);
+
+/* Length of the run of printable ASCII (0x20-0x7e) at the start of s */
+extern size_t (*cpu_ascii_span)(const char *s, size_t n);
+
+/* Offset of the first match of q (m >= 1 bytes, ASCII lowercase) in s, ignoring ASCII case, n if none */
+extern size_t (*cpu_find)(const char *s, size_t n, const char *q, size_t m);
+
+#endif
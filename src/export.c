@@ -0,0 +1,286 @@
+#include "export.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+
+#include "scrollback.h"
+
+#define EXPORT_COLS 1024            /* cells written per line, longer lines are cut */
+#define EXPORT_BUF_SIZ (64 * 1024)  /* output buffer, the only one writes go through */
+
+extern unsigned int defaultfg;
+extern unsigned int defaultbg;
+
+static const char *format_names[] = {"text", "ansi", "html"};
+
+static struct {
+    Term *term; /* session exported */
+    FILE *f;
+    int piped, format;
+    int64_t start, end;
+    int64_t line; /* next to write */
+    int64_t lost; /* dropped from history before they were written */
+    int cancel;
+    char dest[256];
+} job;
+
+static pthread_t thread;
+static int running;  /* from export_start() until the thread is done */
+static int joinable; /* a thread was started and not joined */
+static int registered;
+static char result[256];
+static const SDL_Color *palette;
+static int npalette;
+static Glyph linebuf[EXPORT_COLS];
+static char outbuf[EXPORT_BUF_SIZ];
+
+int export_format(const char *name) {
+    for (int i = 0; i < (int)LEN(format_names); i++)
+        if (!strcasecmp(name, format_names[i])) return i;
+    return -1;
+}
+
+void export_palette(const SDL_Color *colors, int n) {
+    palette = colors;
+    npalette = n;
+}
+
+static int attrs_default(const Glyph *g) { return !(g->mode & ~ATTR_WRAP) && g->fg == defaultfg && g->bg == defaultbg; }
+
+/* Colors past the palette are drawn in the default ones, dflt */
+static void html_color(FILE *f, const char *prop, unsigned idx, unsigned dflt) {
+    const SDL_Color *c;
+
+    if (!palette) return;
+    c = &palette[idx < (unsigned)npalette ? idx : dflt];
+    fprintf(f, "%s:#%02x%02x%02x;", prop, c->r, c->g, c->b);
+}
+
+/* Close the span of prev and open one for g, default attributes need none */
+static void html_attrs(FILE *f, const Glyph *g, const Glyph *prev) {
+    unsigned fg = g->fg, bg = g->bg;
+
+    if (!attrs_default(prev)) fputs("</span>", f);
+    if (attrs_default(g)) return;
+    if (g->mode & ATTR_REVERSE) fg = g->bg, bg = g->fg;
+    fputs("<span style=\"", f);
+    if (fg != defaultfg || g->mode & ATTR_REVERSE) html_color(f, "color", fg, defaultfg);
+    if (bg != defaultbg || g->mode & ATTR_REVERSE) html_color(f, "background", bg, defaultbg);
+    if (g->mode & ATTR_BOLD) fputs("font-weight:bold;", f);
+    if (g->mode & ATTR_ITALIC) fputs("font-style:italic;", f);
+    if (g->mode & ATTR_UNDERLINE) fputs("text-decoration:underline;", f);
+    fputs("\">", f);
+}
+
+static void ansi_attrs(FILE *f, const Glyph *g) {
+    fprintf(f, "\033[0");
+    if (g->mode & ATTR_BOLD) fprintf(f, ";1");
+    if (g->mode & ATTR_ITALIC) fprintf(f, ";3");
+    if (g->mode & ATTR_UNDERLINE) fprintf(f, ";4");
+    if (g->mode & ATTR_BLINK) fprintf(f, ";5");
+    if (g->mode & ATTR_REVERSE) fprintf(f, ";7");
+    if (g->fg != defaultfg) fprintf(f, ";38;5;%d", g->fg);
+    if (g->bg != defaultbg) fprintf(f, ";48;5;%d", g->bg);
+    fprintf(f, "m");
+}
+
+void export_row(FILE *f, int format, const Glyph *row, int cells, int wrap, Glyph *prev) {
+    const Glyph none = {{0}, ATTR_NULL, defaultfg, defaultbg, 0};
+    int end = cells, attrs = format != EXPORT_TEXT;
+    Glyph g;
+
+    /* trailing blanks, unless they continue on the next row or show a background */
+    if (!wrap)
+        while (end > 0 && (!(row[end - 1].state & GLYPH_SET) || row[end - 1].c[0] == ' ') && !(attrs && row[end - 1].bg != defaultbg)) end--;
+    for (int x = 0; x < end; x++) {
+        g = row[x];
+        if (!(g.state & GLYPH_SET)) g = (Glyph){{' '}, ATTR_NULL, defaultfg, defaultbg, GLYPH_SET};
+        g.mode &= ~ATTR_WRAP;
+        if (attrs && ATTRCMP(g, *prev)) {
+            if (format == EXPORT_HTML) {
+                html_attrs(f, &g, prev);
+            } else {
+                ansi_attrs(f, &g);
+            }
+            *prev = g;
+        }
+        if (format != EXPORT_HTML || !strchr("<>&", g.c[0])) {
+            fwrite(g.c, 1, utf8_size(g.c), f);
+        } else {
+            fputs(g.c[0] == '<' ? "&lt;" : g.c[0] == '>' ? "&gt;" : "&amp;", f);
+        }
+    }
+    if (wrap) return;
+    if (attrs && ATTRCMP(*prev, none)) {
+        if (format == EXPORT_HTML) {
+            html_attrs(f, &none, prev);
+        } else {
+            fprintf(f, "\033[0m");
+        }
+        *prev = none;
+    }
+    fputc('\n', f);
+}
+
+/* Line of history or a screen row into linebuf, returns its cells or -1 */
+static int read_line(int64_t line, int *wrap) {
+    Scrollback *sb = term->scrollback;
+    int64_t end = sb ? sb_end(sb) : 0;
+    Glyph *g = linebuf;
+    int n;
+
+    if (line < end) return sb_read(sb, line, g, EXPORT_COLS, wrap);
+    if (line - end >= term->row) return -1;
+    n = MIN(term->col, EXPORT_COLS);
+    memcpy(g, term->line[line - end], n * sizeof(Glyph));
+    *wrap = n == term->col && (g[n - 1].state & GLYPH_SET) && (g[n - 1].mode & ATTR_WRAP);
+    return n;
+}
+
+static void *export_run(void *unused) {
+    Glyph prev = {{0}, ATTR_NULL, defaultfg, defaultbg, 0};
+    Scrollback *sb = job.term->scrollback;
+    int64_t line, end, seen = 0;
+    const char *failed = NULL;
+    int n, wrap, status = 0, len;
+    sigset_t set;
+    (void)unused;
+
+    term = job.term;
+    /* SIGCHLD exits through export_stop(), which joins this thread; a closed pipe fails with EPIPE */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (job.format == EXPORT_HTML) {
+        fputs("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>simple-terminal</title></head>\n<body><pre style=\"", job.f);
+        html_color(job.f, "color", defaultfg, defaultfg);
+        html_color(job.f, "background", defaultbg, defaultbg);
+        fputs("\">", job.f);
+    }
+    for (line = job.start; line < job.end && !ferror(job.f); line++) {
+        if (__atomic_load_n(&job.cancel, __ATOMIC_ACQUIRE)) {
+            failed = "canceled";
+            break;
+        }
+        /* line numbers start over when history is cleared */
+        if ((end = sb ? sb_end(sb) : 0) < seen) {
+            failed = "history cleared";
+            break;
+        }
+        seen = end;
+        if ((n = read_line(line, &wrap)) < 0) {
+            /* dropped from the ring as it was read, or a screen row gone with a resize */
+            job.lost++;
+            continue;
+        }
+        export_row(job.f, job.format, linebuf, MIN(n, EXPORT_COLS), wrap && line + 1 < job.end, &prev);
+        __atomic_store_n(&job.line, line + 1, __ATOMIC_RELAXED);
+    }
+    if (job.format == EXPORT_HTML) fputs("</pre></body></html>\n", job.f);
+    if ((fflush(job.f) || ferror(job.f)) && !failed) failed = strerror(errno);
+    if (job.piped) {
+        status = pclose(job.f);
+    } else if (fclose(job.f) && !failed) {
+        failed = strerror(errno);
+    }
+
+    if (failed) {
+        len = snprintf(result, sizeof(result), "Export to %s failed: %s", job.dest, failed);
+    } else {
+        len = snprintf(result, sizeof(result), "Exported %lld lines to %s", (long long)(line - job.start - job.lost), job.dest);
+    }
+    if (len < (int)sizeof(result) && job.lost) len += snprintf(result + len, sizeof(result) - len, ", %lld lost", (long long)job.lost);
+    if (len < (int)sizeof(result) && job.piped && status) snprintf(result + len, sizeof(result) - len, ", exit %d", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    fprintf(stderr, "%s\n", result);
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    SDL_Event ev = {.user = {.type = SDL_USEREVENT, .code = 3}};
+    SDL_PushEvent(&ev);
+    return NULL;
+}
+
+/* Whether a screen row shows anything */
+static int row_used(const Glyph *line) {
+    for (int x = 0; x < term->col; x++)
+        if ((line[x].state & GLYPH_SET) && (line[x].c[0] != ' ' || line[x].bg != defaultbg)) return 1;
+    return 0;
+}
+
+int export_start(const char *dest, int format, int64_t start, int64_t end, char *msg, size_t size) {
+    Scrollback *sb = term->scrollback;
+    int64_t screen = sb ? sb_end(sb) : 0;
+    int y;
+
+    if (__atomic_exchange_n(&running, 1, __ATOMIC_ACQ_REL)) {
+        snprintf(msg, size, "An export to %s is running", job.dest);
+        return 0;
+    }
+    if (joinable) pthread_join(thread, NULL);
+    joinable = 0;
+
+    /* the screen up to the cursor or its last used row */
+    for (y = term->row - 1; y > term->c.y && !row_used(term->line[y]); y--);
+    start = MAX(start, sb ? sb_start(sb) : 0);
+    end = MIN(end, screen + y + 1);
+    if (start >= end) {
+        snprintf(msg, size, "Nothing to export");
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /* started from the main or tty thread, so the command does not inherit the export thread's blocked signals */
+    job.piped = dest[0] == '|';
+    if (!(job.f = job.piped ? popen(dest + 1, "w") : fopen(dest, "w"))) {
+        snprintf(msg, size, "Error opening %s:%s", dest, strerror(errno));
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+    setvbuf(job.f, outbuf, _IOFBF, sizeof(outbuf));
+    snprintf(job.dest, sizeof(job.dest), "%s", dest);
+    job.term = term;
+    job.format = format;
+    job.start = job.line = start;
+    job.end = end;
+    job.lost = 0;
+    job.cancel = 0;
+    if (pthread_create(&thread, NULL, export_run, NULL)) {
+        snprintf(msg, size, "Unable to create export thread");
+        if (job.piped) {
+            pclose(job.f);
+        } else {
+            fclose(job.f);
+        }
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+    joinable = 1;
+    if (!registered) atexit(export_stop);
+    registered = 1;
+    snprintf(msg, size, "Exporting %lld lines to %s", (long long)(end - start), dest);
+    return 1;
+}
+
+int export_status(char *buf, size_t size) {
+    int n;
+
+    if (__atomic_load_n(&running, __ATOMIC_ACQUIRE) && joinable) {
+        n = snprintf(buf, size, "exporting %s %lld/%lld lines to %s", format_names[job.format], (long long)(__atomic_load_n(&job.line, __ATOMIC_RELAXED) - job.start),
+                     (long long)(job.end - job.start), job.dest);
+    } else {
+        n = snprintf(buf, size, "%s", result[0] ? result : "no export");
+    }
+    return MIN(n, (int)size - 1);
+}
+
+Term *export_session(void) { return __atomic_load_n(&running, __ATOMIC_ACQUIRE) && joinable ? job.term : NULL; }
+
+void export_stop(void) {
+    __atomic_store_n(&job.cancel, 1, __ATOMIC_RELEASE);
+    if (joinable) pthread_join(thread, NULL);
+    joinable = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vt100.h"
+
+/*
+ * Scrollback export. A thread streams history and the screen to a file,
+ * or to the stdin of a shell command, a line at a time: history is read
+ * with sb_read(), a block decompressed at once, and written through a
+ * fixed buffer, so memory does not grow with the lines exported and the
+ * main and tty threads go on meanwhile. One export runs at a time; when
+ * it is done an SDL_USEREVENT with code 3 is pushed.
+ */
+enum export_format { EXPORT_TEXT, EXPORT_ANSI, EXPORT_HTML };
+
+/* "text", "ansi" or "html", -1 if unknown */
+int export_format(const char *name);
+
+/* Colors for HTML, n indexes as Glyph fg and bg */
+void export_palette(const SDL_Color *colors, int n);
+
+/*
+ * Export lines [start, end), numbered as sb_end() counts them with the
+ * screen rows following, clipped to what is held and to the last used
+ * screen row. dest is a path, or "|command" to pipe into. Returns 0 with
+ * the reason in msg if it cannot start.
+ */
+int export_start(const char *dest, int format, int64_t start, int64_t end, char *msg, size_t size);
+
+/* State of the running or last export, returns its length */
+int export_status(char *buf, size_t size);
+
+/* Session of the running export, NULL if none */
+Term *export_session(void);
+
+/* Stop a running export, waiting for its thread */
+void export_stop(void);
+
+/*
+ * Write a row of cells (cells from row, at most) in format. A soft
+ * wrapped row is continued by the next one, otherwise the line ends;
+ * *prev carries the attributes written.
+ */
+void export_row(FILE *f, int format, const Glyph *row, int cells, int wrap, Glyph *prev);
+
+#endif
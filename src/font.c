@@ -3,6 +3,8 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "alloc.h"
+
 // clang-format off
 // font from https://github.com/nesbox/TIC-80
 // Format: w-h: 6x6 pixel
@@ -681,6 +683,61 @@ static int ttf_char_width = 6;   // fallback to bitmap size
 static int ttf_char_height = 8;  // fallback to bitmap size
 static int ttf_font_shade = 0;
 
+/*
+ * Glyph cache: TTF_RenderText treats every byte as one latin1 glyph, so the
+ * coverage of all 255 of them is rendered once when the font is loaded and
+ * draw_string_ttf() only blends, without allocating a surface per call.
+ */
+typedef struct {
+    Uint8 *coverage; /* w x h, 0-255 */
+    int w, h;
+} TtfGlyph;
+
+static TtfGlyph ttf_glyphs[256];
+
+static void cache_ttf_glyphs(void) {
+    SDL_Color white = {255, 255, 255, 255}, black = {0, 0, 0, 255};
+
+    for (int c = 1; c < 256; c++) {
+        char text[2] = {c, '\0'};
+        SDL_Surface *s;
+        Uint8 r, g, b, a;
+
+        if (ttf_font_shade == 2) {
+            s = TTF_RenderText_Shaded(ttf_font, text, white, black);
+        } else if (ttf_font_shade == 1) {
+            s = TTF_RenderText_Blended(ttf_font, text, white);
+        } else {
+            s = TTF_RenderText_Solid(ttf_font, text, white);
+        }
+        if (!s) continue;  // no glyph, zero width
+
+        TtfGlyph *glyph = &ttf_glyphs[c];
+        glyph->w = s->w;
+        glyph->h = s->h;
+        glyph->coverage = x_malloc(ALLOC_FONT, s->w * s->h);
+        SDL_LockSurface(s);
+        for (int y = 0; y < s->h; y++) {
+            for (int x = 0; x < s->w; x++) {
+                Uint8 *p = (Uint8 *)s->pixels + y * s->pitch + x * s->format->BytesPerPixel;
+                if (s->format->BytesPerPixel == 1) {
+                    glyph->coverage[y * s->w + x] = s->format->palette->colors[*p].r;  // solid and shaded, white on black
+                } else {
+                    SDL_GetRGBA(*(Uint32 *)p, s->format, &r, &g, &b, &a);
+                    glyph->coverage[y * s->w + x] = a;  // blended
+                }
+            }
+        }
+        SDL_UnlockSurface(s);
+        SDL_FreeSurface(s);
+    }
+}
+
+static void free_ttf_glyphs(void) {
+    for (int c = 0; c < 256; c++) x_free(ttf_glyphs[c].coverage);
+    memset(ttf_glyphs, 0, sizeof(ttf_glyphs));
+}
+
 /* TTF font */
 int init_ttf_font(const char *font_path, int font_size, int shade) {
     if (TTF_Init() == -1) {
@@ -698,6 +755,7 @@ int init_ttf_font(const char *font_path, int font_size, int shade) {
     // Get font metrics
     TTF_SizeText(ttf_font, "M", &ttf_char_width, &ttf_char_height);
     ttf_font_shade = shade;
+    cache_ttf_glyphs();
 
     fprintf(stderr, "TTF font loaded: %s (size: %d, char: %dx%d), shaded: %d\n", font_path, font_size, ttf_char_width, ttf_char_height, ttf_font_shade);
 
@@ -706,6 +764,7 @@ int init_ttf_font(const char *font_path, int font_size, int shade) {
 
 void cleanup_ttf_font(void) {
     if (ttf_font) {
+        free_ttf_glyphs();
         TTF_CloseFont(ttf_font);
         ttf_font = NULL;
         TTF_Quit();
@@ -727,23 +786,29 @@ void draw_string_ttf(SDL_Surface *surface, const char *text, int x, int y, SDL_C
         return;
     }
 
-    SDL_Surface *text_surface;
-    if (ttf_font_shade == 2) {  // highest quality
-        text_surface = TTF_RenderText_Shaded(ttf_font, text, fg, bg);
-    } else if (ttf_font_shade == 1) {  // medium quality
-        text_surface = TTF_RenderText_Blended(ttf_font, text, fg);
-    } else {
-        text_surface = TTF_RenderText_Solid(ttf_font, text, fg);
-    }
-
-    if (!text_surface) {
-        fprintf(stderr, "TTF_RenderText_Shaded %s failed: %s\n", text, TTF_GetError());
-        return;
+    Uint16 *pixels = surface->pixels;
+    int pitch = surface->pitch / 2;
+    Uint16 fg565 = (fg.r >> 3) << 11 | (fg.g >> 2) << 5 | fg.b >> 3;
+
+    for (const unsigned char *c = (const unsigned char *)text; *c; x += ttf_glyphs[*c++].w) {
+        TtfGlyph *glyph = &ttf_glyphs[*c];
+        for (int gy = SDL_max(0, -y); gy < glyph->h && y + gy < surface->h; gy++) {
+            Uint16 *dst = pixels + (y + gy) * pitch + x;
+            const Uint8 *cov = glyph->coverage + gy * glyph->w;
+            for (int gx = SDL_max(0, -x); gx < glyph->w && x + gx < surface->w; gx++) {
+                int a = cov[gx];
+                if (ttf_font_shade == 2) {
+                    /* opaque, same ramp as the TTF_RenderText_Shaded palette */
+                    dst[gx] = (bg.r + (fg.r - bg.r) * a / 255) >> 3 << 11 | (bg.g + (fg.g - bg.g) * a / 255) >> 2 << 5 | (bg.b + (fg.b - bg.b) * a / 255) >> 3;
+                } else if (a == 255 || (a && ttf_font_shade == 0)) {
+                    dst[gx] = fg565;
+                } else if (a) {
+                    int r = (dst[gx] >> 11) << 3, g = ((dst[gx] >> 5) & 0x3F) << 2, b = (dst[gx] & 0x1F) << 3;
+                    dst[gx] = (r + (fg.r - r) * a / 255) >> 3 << 11 | (g + (fg.g - g) * a / 255) >> 2 << 5 | (b + (fg.b - b) * a / 255) >> 3;
+                }
+            }
+        }
     }
-
-    SDL_Rect dest = {x, y, text_surface->w, text_surface->h};
-    SDL_BlitSurface(text_surface, NULL, surface, &dest);
-    SDL_FreeSurface(text_surface);
 }
 
 void draw_string_ttf_with_linebreak(SDL_Surface *surface, const char *text, int x, int y, SDL_Color fg, SDL_Color bg) {
@@ -340,6 +340,9 @@ int compute_new_col(int visual_offset, int old_row, int new_row) {
     return new_col;
 }
 
+#if defined(BR2) && !defined(RPI)
+static int session_mod_held = 0, session_mod_used = 0;  // KEY_SESSIONMOD down, and a session button pressed with it
+#endif
 #if defined(RGB30)
 static int rgb30_first_jbutton10_pressed = 0;  // TODO: temp fix for RGB30, for unknown reason, Joystick jbutton 10 (KEY_QUIT) always triggers at startup, so we must ignore it
 #endif
@@ -379,10 +382,11 @@ int handle_keyboard_event(SDL_Event *event) {
         if (event->key.type == SDL_KEYDOWN) {
             switch (event->key.keysym.sym) {
                 case SDLK_PRINTSCREEN:
-                    printf("Screenshot event requested\n");
+                    // with the OSK shift on, export the scrollback instead
+                    printf("%s event requested\n", shifted ? "Export" : "Screenshot");
                     SDL_Event screenshotEvent;
                     screenshotEvent.type = SDL_USEREVENT;
-                    screenshotEvent.user.code = 1;
+                    screenshotEvent.user.code = shifted ? 2 : 1;
                     SDL_PushEvent(&screenshotEvent);
                     return 1;
                 case KEY_OSKLOCATION:
@@ -399,6 +403,34 @@ int handle_keyboard_event(SDL_Event *event) {
 
     if (!active) {
 #if defined(BR2) && !defined(RPI)
+        // sessions: L1, R1 or START while SELECT is held, SELECT alone is Tab when released
+        if (event->key.keysym.sym == KEY_SESSIONMOD) {
+            if (event->key.type == SDL_KEYDOWN) {
+                session_mod_held = 1;
+                session_mod_used = 0;
+            } else {
+                if (session_mod_held && !session_mod_used) simulate_key(SDLK_TAB, STATE_TYPED);
+                session_mod_held = 0;
+            }
+            return 1;
+        }
+        if (session_mod_held && event->key.type == SDL_KEYDOWN &&
+            (event->key.keysym.sym == JOYBUTTON_L1 || event->key.keysym.sym == JOYBUTTON_R1 || event->key.keysym.sym == JOYBUTTON_START)) {
+            SDL_Event sessionEvent;
+            sessionEvent.type = SDL_USEREVENT;
+            sessionEvent.user.code = event->key.keysym.sym == JOYBUTTON_START ? 4 : event->key.keysym.sym == JOYBUTTON_L1 ? 5 : 6;
+            SDL_PushEvent(&sessionEvent);
+            session_mod_used = 1;
+            return 1;
+        }
+#ifdef KEY_SEARCH_MOD
+        // passed on to k_press() as the key it stands for
+        if (session_mod_held && event->key.type == SDL_KEYDOWN && (event->key.keysym.sym == KEY_SEARCH_MOD || event->key.keysym.sym == KEY_HUD_MOD)) {
+            event->key.keysym.sym = event->key.keysym.sym == KEY_SEARCH_MOD ? KEY_SEARCH : KEY_HUD;
+            session_mod_used = 1;
+            return 0;
+        }
+#endif
         // handle joystick button directly when OSK is inactive
         if (event->key.type == SDL_KEYDOWN && event->key.state == SDL_PRESSED) {
             if (event->key.keysym.sym == JOYBUTTON_UP) {
@@ -416,9 +448,6 @@ int handle_keyboard_event(SDL_Event *event) {
             } else if (event->key.keysym.sym == JOYBUTTON_START || event->key.keysym.sym == JOYBUTTON_A) {
                 simulate_key(SDLK_RETURN, STATE_TYPED);
                 return 1;
-            } else if (event->key.keysym.sym == JOYBUTTON_SELECT) {
-                simulate_key(SDLK_TAB, STATE_TYPED);
-                return 1;
             } else if (event->key.keysym.sym == JOYBUTTON_B) {
                 tty_write("\003", 1);  // Ctrl+C
                 return 1;
@@ -91,6 +91,21 @@
 #define KEY_OSKTOGGLE JOYBUTTON_R1
 #define KEY_SCROLLUP JOYBUTTON_L2
 #define KEY_SCROLLDOWN JOYBUTTON_R2
+#if defined(RG35XXSP)
+// L3 / R3 are the volume keys, search and the HUD take SELECT held with L2 / R2
+#define KEY_HUD -104  // synthetic, sent for KEY_HUD_MOD
+#define KEY_SEARCH -105  // synthetic, sent for KEY_SEARCH_MOD
+#define KEY_HUD_MOD JOYBUTTON_R2  // OSK hidden, with KEY_SESSIONMOD
+#define KEY_SEARCH_MOD JOYBUTTON_L2  // OSK hidden, with KEY_SESSIONMOD
+#else
+#define KEY_HUD JOYBUTTON_R3  // OSK hidden
+#define KEY_SEARCH JOYBUTTON_L3  // OSK hidden
+#endif
+#define KEY_PREVCMD JOYBUTTON_L1  // OSK hidden
+#define KEY_NEXTCMD JOYBUTTON_R1  // OSK hidden
+#define KEY_SELECTCMD JOYBUTTON_Y  // OSK hidden
+#define KEY_CMD_MOD 0
+#define KEY_SESSIONMOD JOYBUTTON_SELECT  // OSK hidden, held: L1 / R1 previous / next session, START a new one, alone: Tab
 #define KEY_QUIT JOYBUTTON_MENU
 #define KEY_TAB JOYBUTTON_SELECT
 #define KEY_RETURN JOYBUTTON_START
@@ -113,6 +128,16 @@
 #define KEY_OSKTOGGLE SDLK_F9
 #define KEY_SCROLLUP SDLK_F8
 #define KEY_SCROLLDOWN SDLK_F7
+#define KEY_HUD SDLK_F6
+#define KEY_SEARCH SDLK_F5
+#define KEY_PREVCMD SDLK_F8    // with shift
+#define KEY_NEXTCMD SDLK_F7    // with shift
+#define KEY_SELECTCMD SDLK_F5  // with shift
+#define KEY_CMD_MOD KMOD_SHIFT
+#define KEY_EXPORT SDLK_F6     // with shift, Shift+PrS on the OSK everywhere
+#define KEY_PREVSESSION SDLK_F1  // with shift
+#define KEY_NEXTSESSION SDLK_F2  // with shift
+#define KEY_NEWSESSION SDLK_F3   // with shift
 #define KEY_QUIT SDLK_UNKNOWN  // not used
 #define KEY_TAB SDLK_TAB
 #define KEY_RETURN SDLK_RETURN
@@ -0,0 +1,96 @@
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "perf.h"
+
+#define LAT_SAMPLES 4096       /* percentiles over the last samples */
+#define LAT_BUCKETS 14         /* log2 buckets, 0.125 ms to 512 ms */
+#define LAT_STALE_NS 100000000  /* an input not written to the tty by then was not for the shell */
+#define LAT_TIMEOUT_NS 1000000000 /* no visible output for it, give up */
+
+/* Reported segments, between two points */
+enum { SEG_DISPATCH, SEG_PTY, SEG_PARSE, SEG_RENDER, SEG_TOTAL, SEGS };
+
+static const char *seg_names[SEGS] = {"dispatch", "pty", "parse", "render", "total"};
+static const int seg_from[SEGS] = {LAT_INPUT, LAT_WRITE, LAT_READ, LAT_PARSED, LAT_INPUT};
+static const int seg_to[SEGS] = {LAT_WRITE, LAT_READ, LAT_PARSED, LAT_PRESENT, LAT_PRESENT};
+
+int latency_enabled = 0;
+
+static int state;                /* next expected point */
+static uint64_t stamp[LAT_POINTS];
+static double samples[SEGS][LAT_SAMPLES]; /* ms */
+static unsigned int histogram[SEGS][LAT_BUCKETS];
+static int count;
+
+void latency_init(void) {
+    latency_enabled = 1;
+    atexit(latency_report);
+}
+
+/* Advance the probe if point is the next one, called from both threads */
+void latency_point(int point, uint64_t age) {
+    uint64_t now = perf_now() - age;
+    int s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+
+    if (point == LAT_INPUT) {
+        if (s != LAT_INPUT && now - stamp[LAT_INPUT] < (s == LAT_WRITE ? LAT_STALE_NS : LAT_TIMEOUT_NS)) return;
+    } else if (s != point) {
+        return;
+    }
+    stamp[point] = now;
+    if (point != LAT_PRESENT) {
+        __atomic_store_n(&state, point + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    for (int i = 0; i < SEGS; i++) {
+        double ms = (stamp[seg_to[i]] - stamp[seg_from[i]]) / 1e6;
+        int b = 0;
+        while (b < LAT_BUCKETS - 1 && ms >= 0.125 * (1 << b)) b++;
+        histogram[i][b]++;
+        samples[i][count % LAT_SAMPLES] = ms;
+    }
+    count++;
+    __atomic_store_n(&state, LAT_INPUT, __ATOMIC_RELEASE);
+}
+
+int latency_idle(void) { return __atomic_load_n(&state, __ATOMIC_ACQUIRE) == LAT_INPUT; }
+
+int latency_samples(void) { return count; }
+
+static int cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void latency_report(void) {
+    int n = count < LAT_SAMPLES ? count : LAT_SAMPLES;
+    double sorted[LAT_SAMPLES];
+
+    if (!latency_enabled) return;
+    latency_enabled = 0;
+    printf("latency: %d samples (ms)\n", count);
+    if (!count) return;
+
+    printf("%-10s %8s %8s %8s %8s\n", "segment", "p50", "p90", "p99", "max");
+    for (int i = 0; i < SEGS; i++) {
+        for (int j = 0; j < n; j++) sorted[j] = samples[i][j];
+        qsort(sorted, n, sizeof(*sorted), cmp);
+        printf("%-10s %8.2f %8.2f %8.2f %8.2f\n", seg_names[i], sorted[n / 2], sorted[n * 9 / 10], sorted[n * 99 / 100], sorted[n - 1]);
+    }
+
+    printf("\n%-10s", "bucket");
+    for (int i = 0; i < SEGS; i++) printf(" %8s", seg_names[i]);
+    printf("\n");
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        if (b < LAT_BUCKETS - 1)
+            printf("<%-9g", 0.125 * (1 << b));
+        else
+            printf(">=%-8g", 0.125 * (1 << (b - 1)));
+        for (int i = 0; i < SEGS; i++) printf(" %8u", histogram[i][b]);
+        printf("\n");
+    }
+}
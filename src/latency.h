@@ -0,0 +1,30 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+
+/*
+ * Keystroke to pixel latency meter (-latency). One input is followed at a
+ * time through the points below; inputs arriving while one is in flight
+ * are not measured.
+ */
+enum latency_point { LAT_INPUT, LAT_WRITE, LAT_READ, LAT_PARSED, LAT_DRAWN, LAT_PRESENT, LAT_POINTS };
+
+extern int latency_enabled;
+
+void latency_init(void);
+void latency_point(int point, uint64_t age);
+int latency_idle(void);
+int latency_samples(void);
+void latency_report(void);
+
+static inline void latency_mark(int point) {
+    if (latency_enabled) latency_point(point, 0);
+}
+
+/* Start a probe for an input that was queued age ns ago */
+static inline void latency_mark_input(uint64_t age) {
+    if (latency_enabled) latency_point(LAT_INPUT, age);
+}
+
+#endif
@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/stat.h>
@@ -24,23 +25,46 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "alloc.h"
+#include "blit.h"
 #include "config.h"
 #include "font.h"
 #include "keyboard.h"
+#include "capture.h"
+#include "control.h"
+#include "cpu.h"
+#include "export.h"
+#include "latency.h"
+#include "marks.h"
+#include "perf.h"
+#include "record.h"
+#include "replay.h"
+#include "search.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "trigger.h"
 #include "vt100.h"
 
-#define USAGE "Simple Terminal\nusage: simple-terminal [-h] [-scale 2.0] [-font font.ttf] [-fontsize 14] [-fontshade 0|1|2] [-rotate 0|90|180|270] [-o file] [-q] [-r command ...]\n"
+#ifdef BENCH
+#include "corpus.h"
+#endif
+
+#define USAGE "Simple Terminal\nusage: simple-terminal [-h] [-scale 2.0] [-font font.ttf] [-fontsize 14] [-fontshade 0|1|2] [-rotate 0|90|180|270] [-hud] [-smoothscroll] [-trace file.json] [-latency] [-latencyinject N] [-o file] [-ofmt raw|cast] [-replay file] [-replaypace realtime|speed=N|max] [-replayexit] [-record file] [-play file] [-seek seconds] [-control sock] [-batch text|ansi|bmp] [-batchout file] [-batchsize 80x24] [-nosimd] [-allocassert] [-spill MB] [-spillkeep] [-trigger action:pattern] [-snapshot file] [-q] [-r command ...]\n"
 
 /* Arbitrary sizes */
 #define DRAW_BUF_SIZ 20 * 1024
 
 #define REDRAW_TIMEOUT (80 * 1000) /* 80 ms */
+#define REPLAY_FRAME_NS 33000000   /* redraw at most every 33 ms while replaying */
+#define SESSION_BACKGROUND_ROUNDS 8 /* sessions in the background are read one round in 8 while the shown one has output */
 
 /* macros */
 #define TIMEDIFF(t1, t2) ((t1.tv_sec - t2.tv_sec) * 1000 + (t1.tv_usec - t2.tv_usec) / 1000)
 
 enum WindowState { WIN_VISIBLE = 1, WIN_REDRAW = 2, WIN_FOCUSED = 4 };
 
+enum BatchFormat { BATCH_OFF, BATCH_TEXT, BATCH_ANSI, BATCH_BMP };
+
 /* Purely graphic info */
 typedef struct {
     // Colormap cmap;
@@ -115,14 +139,18 @@ SDL_Surface *rotated_screen;   // final frame matching window size
 static void draw(void);
 static void draw_region(int, int, int, int);
 static void draw_scrollbar(void);
+static void draw_hud(void);
 static void main_loop(void);
 int tty_thread(void *unused);
+int replay_thread(void *unused);
+int play_thread(void *unused);
 
 static void x_draws(char *, Glyph, int, int, int, int);
 static void x_clear(int, int, int, int);
 static void x_draw_cursor(void);
+static void x_shift_view(void);
 static void sdl_init(void);
-static void create_tty_thread();
+static void create_tty_thread(int (*fn)(void *));
 static void init_color_map(void);
 static void sdl_term_clear(int, int, int, int);
 static void x_resize(int, int);
@@ -134,6 +162,10 @@ static void window_event_handler(SDL_Event *);
 
 static void update_render(void);
 static Uint32 clear_popup_timer(Uint32 interval, void *param);
+static void export_history(void);
+static void session_new(void);
+static void session_step(int dir);
+static void session_reap(void);
 
 static void (*event_handler[SDL_LASTEVENT])(SDL_Event *) = {[SDL_KEYDOWN] = k_press, [SDL_TEXTINPUT] = text_input, [SDL_WINDOWEVENT] = window_event_handler};
 
@@ -147,42 +179,34 @@ SDL_Thread *thread = NULL;
 char **opt_cmd = NULL;
 int opt_cmd_size = 0;
 char *opt_io = NULL;
+int opt_io_format = CAPTURE_RAW;
+static char *opt_trace = NULL;
+static int opt_latency_inject = 0;  // keystrokes left to inject
+int opt_batch = BATCH_OFF;
+static char *opt_batch_out = NULL;  // stdout for text and ansi
+static int opt_batch_cols = 80, opt_batch_rows = 24;
+static char *opt_replay = NULL;
+static int opt_replay_exit = 0;
+static char *opt_record = NULL;
+static char *opt_control = NULL;
+static char *opt_play = NULL;
+static int opt_nosimd = 0;
+static int opt_smooth_scroll = 0;  // scroll history at a speed while L2/R2 or the stick is held
+int opt_spill = 0;       // MB of scrollback spilled to disk, 0 for none
+int opt_spill_keep = 0;  // leave the spill file behind on exit
+static char *opt_snapshot = NULL;
+static double opt_seek = 0;            // seconds, start of -play
+static long long play_seek_by = 0;     // ns, requested by k_press while playing
 
 static int embedded_font_name = 1;  // 1 or 2
 static volatile int thread_should_exit = 0;
+static int tty_epoll = -1;  // the pty of every session, read by tty_thread()
+static SDL_Surface *session_surface[SESSION_MAX];  // last frame of each session, main_window.surface is the shown one's
+static int session_cursor[SESSION_MAX][2];         // where x_draw_cursor() left the cursor on it
 static int shutdown_called = 0;
 
 char popup_message[256];
 
-size_t x_write(int fd, char *s, size_t len) {
-    size_t aux = len;
-
-    while (len > 0) {
-        ssize_t r = write(fd, s, len);
-        if (r < 0) return r;
-        len -= r;
-        s += r;
-    }
-    return aux;
-}
-
-void *x_malloc(size_t len) {
-    void *p = malloc(len);
-    if (!p) die("Out of memory\n");
-    return p;
-}
-
-void *x_realloc(void *p, size_t len) {
-    if ((p = realloc(p, len)) == NULL) die("Out of memory\n");
-    return p;
-}
-
-void *x_calloc(size_t nmemb, size_t size) {
-    void *p = calloc(nmemb, size);
-    if (!p) die("Out of memory\n");
-    return p;
-}
-
 void sdl_load_fonts() {
     // Try to load TTF font if opt_font is set
     if (opt_font && init_ttf_font(opt_font, opt_fontsize, opt_fontshade)) {
@@ -199,6 +223,7 @@ void sdl_load_fonts() {
 void sdl_shutdown(void) {
     if (SDL_WasInit(SDL_INIT_EVERYTHING) != 0 && !shutdown_called) {
         shutdown_called = 1;
+        term = term_shown;  // whichever thread exits, the session on screen is written to and saved
         fprintf(stderr, "SDL shutting down\n");
         if (thread) {
             printf("Signaling ttythread to exit...\n");
@@ -211,13 +236,17 @@ void sdl_shutdown(void) {
             // SDL_KillThread(thread);
             thread = NULL;
         }
+        // MENU and SIGTERM (SDL turns it into SDL_QUIT) both end up here
+        if (opt_snapshot) snapshot_save(opt_snapshot, (size_t)scrollback_kb << 10);
 
         // Cleanup TTF font
         cleanup_ttf_font();
 
-        if (main_window.surface) SDL_FreeSurface(main_window.surface);
-        if (osk_screen) SDL_FreeSurface(osk_screen);
-        if (rotated_screen) SDL_FreeSurface(rotated_screen);
+        for (int i = 0; i < SESSION_MAX; i++)
+            if (session_surface[i] && session_surface[i] != main_window.surface) blit_free_surface(session_surface[i]);
+        if (main_window.surface) blit_free_surface(main_window.surface);
+        if (osk_screen) blit_free_surface(osk_screen);
+        if (rotated_screen) blit_free_surface(rotated_screen);
         main_window.surface = NULL;
         SDL_JoystickClose(joystick);
         SDL_Quit();
@@ -239,6 +268,7 @@ void window_event_handler(SDL_Event *event) {
 
 void scale_to_size(int width, int height) {
     if (width <= 0 || height <= 0 || width > 8192 || height > 8192) return;
+    int steady = alloc_steady(0);  // resizing reallocates everything
     main_window.width = width;
     main_window.height = height;
     printf("Set scale to size: %dx%d (x%.1f)\n", main_window.width, main_window.height, opt_scale);
@@ -253,19 +283,24 @@ void scale_to_size(int width, int height) {
         exit(EXIT_FAILURE);
     }
 
-    // Recreate surfaces
-    if (main_window.surface) SDL_FreeSurface(main_window.surface);
+    // Recreate surfaces, those of the sessions in the background when they are shown
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (session_surface[i] && session_surface[i] != main_window.surface) blit_free_surface(session_surface[i]);
+        session_surface[i] = NULL;
+    }
+    if (main_window.surface) blit_free_surface(main_window.surface);
     int compose_w = (opt_rotate == 90 || opt_rotate == 270) ? main_window.height : main_window.width;
     int compose_h = (opt_rotate == 90 || opt_rotate == 270) ? main_window.width : main_window.height;
-    main_window.surface = SDL_CreateRGBSurface(0, compose_w, compose_h, 16, 0xF800, 0x7E0, 0x1F, 0);  // compose buffer
-    if (osk_screen) SDL_FreeSurface(osk_screen);
-    osk_screen = SDL_CreateRGBSurface(0, compose_w, compose_h, 16, 0xF800, 0x7E0, 0x1F, 0);          // compose + keyboard
-    if (rotated_screen) SDL_FreeSurface(rotated_screen);
-    rotated_screen = SDL_CreateRGBSurface(0, main_window.width, main_window.height, 16, 0xF800, 0x7E0, 0x1F, 0);      // final frame
+    main_window.surface = blit_create_surface(ALLOC_SURFACE, compose_w, compose_h);  // compose buffer
+    session_surface[term->id] = main_window.surface;
+    if (osk_screen) blit_free_surface(osk_screen);
+    osk_screen = blit_create_surface(ALLOC_OSK, compose_w, compose_h);  // compose + keyboard
+    if (rotated_screen) blit_free_surface(rotated_screen);
+    rotated_screen = blit_create_surface(ALLOC_SURFACE, main_window.width, main_window.height);  // final frame
 
     // Recreate screen surface for compatibility
-    if (screen) SDL_FreeSurface(screen);
-    screen = SDL_CreateRGBSurface(0, 640, 480, 16, 0xF800, 0x7E0, 0x1F, 0);
+    if (screen) blit_free_surface(screen);
+    screen = blit_create_surface(ALLOC_SURFACE, 640, 480);
 
     // resize terminal to fit content buffer (which may be swapped for 90/270)
     int col, row;
@@ -273,9 +308,17 @@ void scale_to_size(int width, int height) {
     int content_h = main_window.surface ? main_window.surface->h : main_window.height;
     col = (content_w - 2 * borderpx) / main_window.char_width;
     row = (content_h - 2 * borderpx) / main_window.char_height;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (!sessions[i].line || &sessions[i] == term_shown) continue;
+        term = &sessions[i];
+        t_resize(col, row);
+        tty_resize();
+    }
+    term = term_shown;
     t_resize(col, row);
     x_resize(col, row);
     tty_resize();
+    alloc_steady(steady);
 }
 
 void sdl_init(void) {
@@ -296,6 +339,7 @@ void sdl_init(void) {
 
     /* colors */
     init_color_map();
+    export_palette(drawing_ctx.colors, LEN(drawing_ctx.colors));
 
     int display_index = 0;  // usually 0 unless you have multiple screens
     SDL_DisplayMode mode;
@@ -338,21 +382,21 @@ void sdl_init(void) {
     }
     int compose_w = (opt_rotate == 90 || opt_rotate == 270) ? main_window.height : main_window.width;
     int compose_h = (opt_rotate == 90 || opt_rotate == 270) ? main_window.width : main_window.height;
-    main_window.surface = SDL_CreateRGBSurface(0, compose_w, compose_h, 16, 0xF800, 0x7E0, 0x1F, 0);  // console screen
-    osk_screen = SDL_CreateRGBSurface(0, compose_w, compose_h, 16, 0xF800, 0x7E0, 0x1F, 0);           // for keyboard mix
-    rotated_screen = SDL_CreateRGBSurface(0, main_window.width, main_window.height, 16, 0xF800, 0x7E0, 0x1F, 0);        // final frame after rotation
+    main_window.surface = blit_create_surface(ALLOC_SURFACE, compose_w, compose_h);  // console screen
+    osk_screen = blit_create_surface(ALLOC_OSK, compose_w, compose_h);  // for keyboard mix
+    rotated_screen = blit_create_surface(ALLOC_SURFACE, main_window.width, main_window.height);  // final frame after rotation
 
     // Create a temporary surface for the screen to maintain compatibility
-    screen = SDL_CreateRGBSurface(0, main_window.width, main_window.height, 16, 0xF800, 0x7E0, 0x1F, 0);
+    screen = blit_create_surface(ALLOC_SURFACE, main_window.width, main_window.height);
 
     main_window.state |= WIN_VISIBLE | WIN_REDRAW;
 
     joystick = SDL_JoystickOpen(0);
 }
 
-void create_tty_thread() {
+void create_tty_thread(int (*fn)(void *)) {
     // TODO: might need to use system threads
-    if (!(thread = SDL_CreateThread(tty_thread, "ttythread", NULL))) {
+    if (!(thread = SDL_CreateThread(fn, "ttythread", NULL))) {
         fprintf(stderr, "Unable to create thread: %s\n", SDL_GetError());
         exit(EXIT_FAILURE);
     }
@@ -361,6 +405,7 @@ void create_tty_thread() {
 void update_render(void) {
     if (main_window.surface == NULL) return;
     // printf("Updating render\n");
+    uint64_t t = perf_now(), trace;
 
     memcpy(osk_screen->pixels, main_window.surface->pixels, main_window.surface->w * main_window.surface->h * 2);
     if (popup_message[0] != '\0') {
@@ -370,57 +415,49 @@ void update_render(void) {
         SDL_FillRect(osk_screen, &rect, SDL_MapRGB(osk_screen->format, popup_box_bg.r, popup_box_bg.g, popup_box_bg.b));
         draw_string(osk_screen, popup_message, rect.x + 2, rect.y + 4, SDL_MapRGB(osk_screen->format, popup_box_str.r, popup_box_str.g, popup_box_str.b), embedded_font_name);
     }
+    if (perf_hud) draw_hud();
+    trace = trace_begin();
     draw_keyboard(osk_screen);  // osk_screen(SW) = console + keyboard
+    trace_end("draw_keyboard", trace);
+    perf_lap(PERF_COMPOSITE, &t);
     // Update texture with screen pixels and render
     SDL_RenderClear(main_window.renderer);
+    perf_lap(PERF_PRESENT, &t);
     if (opt_rotate == 90 || opt_rotate == 270) {
         // Ensure rotated_screen matches window size
         if (!rotated_screen || rotated_screen->w != main_window.width || rotated_screen->h != main_window.height) {
-            if (rotated_screen) SDL_FreeSurface(rotated_screen);
-            rotated_screen = SDL_CreateRGBSurface(0, main_window.width, main_window.height, 16, 0xF800, 0x7E0, 0x1F, 0);
+            if (rotated_screen) blit_free_surface(rotated_screen);
+            rotated_screen = blit_create_surface(ALLOC_SURFACE, main_window.width, main_window.height);
         }
 
         // Rotate osk_screen into rotated_screen
-        SDL_LockSurface(osk_screen);
-        SDL_LockSurface(rotated_screen);
-        int sw = osk_screen->w, sh = osk_screen->h;
-        int dpw = rotated_screen->w, dph = rotated_screen->h; // dpw=window width, dph=window height
-        Uint16 *sdata = (Uint16 *)osk_screen->pixels;
-        Uint16 *ddata = (Uint16 *)rotated_screen->pixels;
-        int spitch = osk_screen->pitch / 2;
-        int dpitch = rotated_screen->pitch / 2;
-        if (opt_rotate == 90) {
-            // source (sw=H, sh=W) -> dest (dpw=W, dph=H)
-            for (int y = 0; y < sh; y++) {
-                for (int x = 0; x < sw; x++) {
-                    int dx = dpw - 1 - y;
-                    int dy = x;
-                    ddata[dy * dpitch + dx] = sdata[y * spitch + x];
-                }
-            }
-        } else { // 270 degrees
-            for (int y = 0; y < sh; y++) {
-                for (int x = 0; x < sw; x++) {
-                    int dx = y;
-                    int dy = dph - 1 - x;
-                    ddata[dy * dpitch + dx] = sdata[y * spitch + x];
-                }
-            }
-        }
-        SDL_UnlockSurface(rotated_screen);
-        SDL_UnlockSurface(osk_screen);
+        trace = trace_begin();
+        blit_rotate(osk_screen, rotated_screen, opt_rotate);
+        trace_end("rotate", trace);
+        perf_lap(PERF_ROTATE, &t);
+        trace = trace_begin();
         SDL_UpdateTexture(main_window.texture, NULL, rotated_screen->pixels, rotated_screen->pitch);
+        trace_end("SDL_UpdateTexture", trace);
+        perf_lap(PERF_UPLOAD, &t);
         SDL_RenderCopy(main_window.renderer, main_window.texture, NULL, NULL);
     } else {
         // 0 or 180 degrees: upload and render; 180 uses renderer rotation for speed
+        trace = trace_begin();
         SDL_UpdateTexture(main_window.texture, NULL, osk_screen->pixels, osk_screen->pitch);
+        trace_end("SDL_UpdateTexture", trace);
+        perf_lap(PERF_UPLOAD, &t);
         if (opt_rotate == 0) {
             SDL_RenderCopy(main_window.renderer, main_window.texture, NULL, NULL);
         } else { // 180
             SDL_RenderCopyEx(main_window.renderer, main_window.texture, NULL, NULL, 180.0, NULL, SDL_FLIP_NONE);
         }
     }
+    trace = trace_begin();
     SDL_RenderPresent(main_window.renderer);
+    trace_end("SDL_RenderPresent", trace);
+    latency_mark(LAT_PRESENT);
+    perf_lap(PERF_PRESENT, &t);
+    perf_frame_end();
 }
 
 void die(const char *errstr, ...) {
@@ -434,6 +471,7 @@ void die(const char *errstr, ...) {
 void x_resize(int col, int row) {
     main_window.tty_width = MAX(1, 2 * borderpx + col * main_window.char_width);
     main_window.tty_height = MAX(1, 2 * borderpx + row * main_window.char_height);
+    record_size(col, row);
 }
 
 void init_color_map(void) {
@@ -480,6 +518,8 @@ void x_clear(int x1, int y1, int x2, int y2) {
 }
 
 void x_draws(char *s, Glyph base, int x, int y, int charlen, int bytelen) {
+    uint64_t trace = trace_begin();
+    perf_frame.x_draws++;
     int winx = borderpx + x * main_window.char_width, winy = borderpx + y * main_window.char_height, width = charlen * main_window.char_width;
     // TTF_Font *font = drawing_ctx.font;
     SDL_Color *fg, *bg, *temp, revfg, revbg;
@@ -548,13 +588,13 @@ void x_draws(char *s, Glyph base, int x, int y, int charlen, int bytelen) {
 
     /* Intelligent cleaning up of the borders. */
     if (x == 0) {
-        x_clear(0, (y == 0) ? 0 : winy, borderpx, winy + main_window.char_height + (y == term.row - 1) ? main_window.height : 0);
+        x_clear(0, (y == 0) ? 0 : winy, borderpx, winy + main_window.char_height + (y == term->row - 1) ? main_window.height : 0);
     }
-    if (x + charlen >= term.col - 1) {
-        x_clear(winx + width, (y == 0) ? 0 : winy, main_window.width, (y == term.row - 1) ? main_window.height : (winy + main_window.char_height));
+    if (x + charlen >= term->col - 1) {
+        x_clear(winx + width, (y == 0) ? 0 : winy, main_window.width, (y == term->row - 1) ? main_window.height : (winy + main_window.char_height));
     }
     if (y == 0) x_clear(winx, 0, winx + width, borderpx);
-    if (y == term.row - 1) x_clear(winx, winy + main_window.char_height, winx + width, main_window.height);
+    if (y == term->row - 1) x_clear(winx, winy + main_window.char_height, winx + width, main_window.height);
 
     // SDL_Surface *text_surface;
     SDL_Rect r = {winx, winy, width, main_window.char_height};
@@ -578,38 +618,40 @@ void x_draws(char *s, Glyph base, int x, int y, int charlen, int bytelen) {
         r.h = 1;
         if (main_window.surface != NULL) SDL_FillRect(main_window.surface, &r, SDL_MapRGB(main_window.surface->format, fg->r, fg->g, fg->b));
     }
+    trace_end_n("x_draws", trace, charlen);
 }
 
+static int oldx = 0, oldy = 0; /* where x_draw_cursor() drew the cursor */
+
 void x_draw_cursor(void) {
-    static int oldx = 0, oldy = 0;
     int sl;
     Glyph g = {{' '}, ATTR_NULL, defaultbg, defaultcs, 0};
     
     /* Don't draw cursor when scrolled */
     if (t_get_scroll_offset() > 0) return;
 
-    LIMIT(oldx, 0, term.col - 1);
-    LIMIT(oldy, 0, term.row - 1);
+    LIMIT(oldx, 0, term->col - 1);
+    LIMIT(oldy, 0, term->row - 1);
 
-    if (term.line[term.c.y][term.c.x].state & GLYPH_SET) memcpy(g.c, term.line[term.c.y][term.c.x].c, UTF_SIZ);
+    if (term->line[term->c.y][term->c.x].state & GLYPH_SET) memcpy(g.c, term->line[term->c.y][term->c.x].c, UTF_SIZ);
 
     /* remove the old cursor */
-    if (term.line[oldy][oldx].state & GLYPH_SET) {
-        sl = utf8_size(term.line[oldy][oldx].c);
-        x_draws(term.line[oldy][oldx].c, term.line[oldy][oldx], oldx, oldy, 1, sl);
+    if (term->line[oldy][oldx].state & GLYPH_SET) {
+        sl = utf8_size(term->line[oldy][oldx].c);
+        x_draws(term->line[oldy][oldx].c, term->line[oldy][oldx], oldx, oldy, 1, sl);
     } else {
         sdl_term_clear(oldx, oldy, oldx, oldy);
     }
 
     /* draw the new one */
-    if (!(term.c.state & CURSOR_HIDE)) {
+    if (!(term->c.state & CURSOR_HIDE)) {
         if (!(main_window.state & WIN_FOCUSED)) g.bg = defaultucs;
 
         if (IS_SET(MODE_REVERSE)) g.mode |= ATTR_REVERSE, g.fg = defaultcs, g.bg = defaultfg;
 
         sl = utf8_size(g.c);
-        x_draws(g.c, g, term.c.x, term.c.y, 1, sl);
-        oldx = term.c.x, oldy = term.c.y;
+        x_draws(g.c, g, term->c.x, term->c.y, 1, sl);
+        oldx = term->c.x, oldy = term->c.y;
     }
 }
 
@@ -617,23 +659,53 @@ void redraw(void) {
     struct timespec tv = {0, REDRAW_TIMEOUT * 1000};
 
     t_full_dirt();
+    if (term != term_shown) return;  // drawn when it is switched to
     draw();
     nanosleep(&tv, NULL);
 }
 
+/* Move the rows already drawn with the view, t_scroll_view_to() left only the rows exposed dirty */
+void x_shift_view(void) {
+    int n = term->view_shift, h = main_window.char_height, pitch;
+    Uint8 *top;
+
+    term->view_shift = 0;
+    if (!n || main_window.surface == NULL || n >= term->row || -n >= term->row) return;
+    pitch = main_window.surface->pitch;
+    top = (Uint8 *)main_window.surface->pixels + borderpx * pitch;
+    if (n > 0) {
+        memmove(top + (size_t)n * h * pitch, top, (size_t)(term->row - n) * h * pitch);
+    } else {
+        memmove(top, top + (size_t)-n * h * pitch, (size_t)(term->row + n) * h * pitch);
+    }
+    /* the scroll indicator (rows 0 and 1) and the cursor moved with the pixels */
+    t_set_dirt(n, n + 1);
+    t_set_dirt(oldy + n, oldy + n);
+}
+
 void draw(void) {
-    draw_region(0, 0, term.col, term.row);
+    uint64_t t = perf_now(), trace = trace_begin();
+
+    x_shift_view();
+    record_frame();  // before draw_region() clears the damage
+    draw_region(0, 0, term->col, term->row);
+    trace_end("draw_region", trace);
+    latency_mark(LAT_DRAWN);
     draw_scrollbar();
+    perf_lap(PERF_RASTERIZE, &t);
     update_render();
 }
 
 void draw_scrollbar(void) {
     int scroll_offset = t_get_scroll_offset();
-    if (scroll_offset == 0 || main_window.surface == NULL) return;
+    if (main_window.surface == NULL) return;
     
-    /* Draw scroll indicator in top-right corner */
-    char scroll_text[64];
-    snprintf(scroll_text, sizeof(scroll_text), "[%d]^", scroll_offset);
+    /* Draw scroll indicator in top-right corner, after the query when searching and the selected output */
+    char scroll_text[128] = "", mark[48];
+    int n = search_active() ? search_status(scroll_text, sizeof(scroll_text)) : 0;
+    if (mark_status(mark, sizeof(mark))) n += snprintf(scroll_text + n, sizeof(scroll_text) - n, "%s%s", n ? " " : "", mark);
+    if (scroll_offset) snprintf(scroll_text + n, sizeof(scroll_text) - n, "%s[%d]^", n ? " " : "", scroll_offset);
+    if (!scroll_text[0]) return;
     
     int text_x = main_window.surface->w - (strlen(scroll_text) * main_window.char_width) - borderpx - 2;
     int text_y = borderpx;
@@ -658,6 +730,45 @@ void draw_scrollbar(void) {
     }
 }
 
+/* Performance counters overlay, top-left of the composed screen */
+void draw_hud(void) {
+    char hud[384];
+    int w = get_embedded_font_char_width(embedded_font_name), h = get_embedded_font_char_height(embedded_font_name);
+    int lines = 1, cols = 0, n = 0;
+
+    snprintf(hud, sizeof(hud),
+             "pty  %8.1f KB/s\n"
+             "putc %8.0f /s\n"
+             "rows %8.1f /frame\n"
+             "draws%8.1f /frame\n"
+             "rast %8.2f ms\n"
+             "comp %8.2f ms\n"
+             "rot  %8.2f ms\n"
+             "upld %8.2f ms\n"
+             "pres %8.2f ms\n"
+             "fps  %8.1f\n"
+             "idle %8.1f /s\n"
+             "heap %8.0f KB\n"
+             "allc %8llu steady",
+             perf_rates.counter[PERF_PTY_BYTES] / 1024, perf_rates.counter[PERF_PUTC], perf_rates.dirty_rows, perf_rates.x_draws, perf_rates.stage_ms[PERF_RASTERIZE],
+             perf_rates.stage_ms[PERF_COMPOSITE], perf_rates.stage_ms[PERF_ROTATE], perf_rates.stage_ms[PERF_UPLOAD], perf_rates.stage_ms[PERF_PRESENT],
+             perf_rates.counter[PERF_FRAMES], perf_rates.counter[PERF_IDLE_WAKEUPS], alloc_live_bytes() / 1024.0,
+             (unsigned long long)__atomic_load_n(&alloc_steady_count, __ATOMIC_RELAXED));
+    for (char *c = hud; *c; c++, n++) {
+        if (*c != '\n') continue;
+        cols = MAX(cols, n);
+        n = -1;
+        lines++;
+    }
+    cols = MAX(cols, n);
+
+    SDL_Rect rect = {borderpx, borderpx, cols * w + 4, lines * h + 4};
+    SDL_Color hud_bg = drawing_ctx.colors[8];
+    SDL_Color hud_str = drawing_ctx.colors[10];
+    SDL_FillRect(osk_screen, &rect, SDL_MapRGB(osk_screen->format, hud_bg.r, hud_bg.g, hud_bg.b));
+    draw_string(osk_screen, hud, rect.x + 2, rect.y + 2, SDL_MapRGB(osk_screen->format, hud_str.r, hud_str.g, hud_str.b), embedded_font_name);
+}
+
 void draw_region(int x1, int y1, int x2, int y2) {
     int ic, ib, x, y, ox, sl;
     Glyph base, new;
@@ -668,31 +779,33 @@ void draw_region(int x1, int y1, int x2, int y2) {
     if (!(main_window.state & WIN_VISIBLE)) return;
 
     for (y = y1; y < y2; y++) {
-        if (!term.dirty[y]) continue;
+        if (!term->dirty[y]) continue;
 
         /* Determine which line to draw (from scrollback or current screen) */
         if (scroll_offset > 0 && y < scroll_offset) {
-            /* Draw from scrollback buffer (circular buffer) */
-            int sb_idx = (term.scrollback_pos - scroll_offset + y + term.scrollback_size) % term.scrollback_size;
-            if (sb_idx >= 0 && sb_idx < term.scrollback_count) {
-                line_to_draw = term.scrollback[sb_idx];
-            } else {
-                line_to_draw = term.line[y];
+            /* Draw from scrollback buffer, decoded into a scratch line */
+            if (!(line_to_draw = t_scrollback_line(scroll_offset - y))) {
+                sdl_term_clear(0, y, term->col, y);
+                term->dirty[y] = 0;
+                continue;
             }
+            search_mark(line_to_draw, term->col, scroll_offset - y);
+            line_to_draw = mark_row(line_to_draw, term->col, scroll_offset - y);
         } else {
             /* Draw from current screen, offset by scroll amount */
             int screen_y = y - scroll_offset;
-            if (screen_y >= 0 && screen_y < term.row) {
-                line_to_draw = term.line[screen_y];
+            if (screen_y >= 0 && screen_y < term->row) {
+                line_to_draw = mark_row(term->line[screen_y], term->col, -screen_y);
             } else {
-                sdl_term_clear(0, y, term.col, y);
-                term.dirty[y] = 0;
+                sdl_term_clear(0, y, term->col, y);
+                term->dirty[y] = 0;
                 continue;
             }
         }
 
-        sdl_term_clear(0, y, term.col, y);
-        term.dirty[y] = 0;
+        sdl_term_clear(0, y, term->col, y);
+        term->dirty[y] = 0;
+        perf_frame.dirty_rows++;
         base = line_to_draw[0];
         ic = ib = ox = 0;
         for (x = x1; x < x2; x++) {
@@ -758,6 +871,13 @@ void k_press(SDL_Event *ev) {
 
     if (IS_SET(MODE_KBDLOCK)) return;
 
+    /* seek while playing a cell recording, nothing goes to the tty */
+    if (opt_play) {
+        long long by = ksym == SDLK_LEFT ? -10 : ksym == SDLK_RIGHT ? 10 : ksym == SDLK_DOWN ? -60 : ksym == SDLK_UP ? 60 : 0;
+        __atomic_fetch_add(&play_seek_by, by * 1000000000ll, __ATOMIC_RELAXED);
+        return;
+    }
+
     meta = e->keysym.mod & KMOD_ALT;
     shift = e->keysym.mod & KMOD_SHIFT;
     ctrl = e->keysym.mod & KMOD_CTRL;
@@ -765,7 +885,58 @@ void k_press(SDL_Event *ev) {
 
     // printf("kpress: keysym=%d scancode=%d mod=%d\n", ksym, e->keysym.scancode, e->keysym.mod);
 
-    /* Handle scroll up/down for scrollback */
+    /* jump between and select the commands the shell marked (OSC 133) */
+    if (!KEY_CMD_MOD || e->keysym.mod & KEY_CMD_MOD) {
+        if (ksym == KEY_PREVCMD || ksym == KEY_NEXTCMD) {
+            mark_jump(ksym == KEY_PREVCMD);
+            draw();
+            return;
+        } else if (ksym == KEY_SELECTCMD) {
+            mark_select();
+            draw();
+            return;
+#ifdef KEY_EXPORT
+        } else if (ksym == KEY_EXPORT) {
+            export_history();
+            return;
+#endif
+#ifdef KEY_NEWSESSION
+        } else if (ksym == KEY_NEWSESSION) {
+            session_new();
+            return;
+        } else if (ksym == KEY_PREVSESSION || ksym == KEY_NEXTSESSION) {
+            session_step(ksym == KEY_NEXTSESSION ? 1 : -1);
+            return;
+#endif
+        }
+    }
+
+    /* search mode takes the keys, typed text comes through text_input() */
+    if (ksym == KEY_SEARCH) {
+        if (search_active()) {
+            search_stop();
+        } else {
+            search_start();
+        }
+        draw();
+        return;
+    }
+    if (search_active()) {
+        if (ksym == KEY_SCROLLUP || ksym == SDLK_UP || ksym == SDLK_RETURN) {
+            search_next(1);
+        } else if (ksym == KEY_SCROLLDOWN || ksym == SDLK_DOWN) {
+            search_next(0);
+        } else if (ksym == SDLK_BACKSPACE) {
+            search_erase();
+        } else if (ksym == SDLK_ESCAPE) {
+            search_stop();
+        }
+        draw();
+        return;
+    }
+
+    /* Handle scroll up/down for scrollback, held keys scroll from main_loop() with -smoothscroll */
+    if ((ksym == KEY_SCROLLUP || ksym == KEY_SCROLLDOWN) && opt_smooth_scroll && e->repeat) return;
     if (ksym == KEY_SCROLLUP) {
         t_scroll_view_up(3);
         draw();  // Force immediate redraw
@@ -774,11 +945,18 @@ void k_press(SDL_Event *ev) {
         t_scroll_view_down(3);
         draw();  // Force immediate redraw
         return;
+    } else if (ksym == KEY_HUD) {
+        perf_hud = !perf_hud;
+        perf_sample();  // start a fresh sampling period
+        return;
     }
     
-    /* Reset scroll on any other key press */
-    if (t_get_scroll_offset() > 0) {
-        t_scroll_view_reset();
+    /* Reset scroll and the selection on any other key press, not on a modifier held for the next one */
+    if (ksym < SDLK_LCTRL || ksym > SDLK_RGUI) {
+        if (t_get_scroll_offset() > 0) {
+            t_scroll_view_reset();
+        }
+        mark_unselect();
     }
 
     if ((non_printing_key = k_map(ksym, e->keysym.mod))) { /* 1. non printing keys from vt100.h */
@@ -894,37 +1072,70 @@ void k_press(SDL_Event *ev) {
 
 void text_input(SDL_Event *ev) {
     SDL_TextInputEvent *e = &ev->text;
+
+    if (search_active()) {
+        search_input(e->text);
+        draw();
+        return;
+    }
     tty_write(e->text, strlen(e->text));
 }
 
+/* Have tty_thread() read the pty of t */
+static void tty_watch(Term *t) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = t};
+
+    if (epoll_ctl(tty_epoll, EPOLL_CTL_ADD, t->cmdfd, &ev) < 0) die("epoll_ctl failed: %s\n", strerror(errno));
+}
+
 int tty_thread(void *unused) {
-    int i;
+    struct epoll_event ready[SESSION_MAX];
+    int i, k, n, maxfd, busy, stale = 0;
     fd_set rfd;
     struct timeval drawtimeout, *tv = NULL;
-    SDL_Event event;
+    SDL_Event event, gone = {.user = {.type = SDL_USEREVENT, .code = 7}};
+    Term *shown;
     (void)unused;
 
     event.type = SDL_USEREVENT;
     event.user.code = 0;
     event.user.data1 = NULL;
     event.user.data2 = NULL;
+    trace_thread("tty_thread");
 
     for (i = 0;; i++) {
         if (thread_should_exit) break;
         FD_ZERO(&rfd);
-        FD_SET(cmdfd, &rfd);
-        if (select(cmdfd + 1, &rfd, NULL, NULL, tv) < 0) {
+        FD_SET(tty_epoll, &rfd);
+        maxfd = control_fdset(&rfd, tty_epoll);
+        if (select(maxfd + 1, &rfd, NULL, NULL, tv) < 0) {
             if (errno == EINTR) continue;
             die("select failed: %s\n", strerror(errno));
         }
+        /* control commands act on the session on screen */
+        term = shown = __atomic_load_n(&term_shown, __ATOMIC_ACQUIRE);
+        control_handle(&rfd);
+
+        n = FD_ISSET(tty_epoll, &rfd) ? epoll_wait(tty_epoll, ready, LEN(ready), 0) : 0;
+        busy = 0;
+        for (k = 0; k < n; k++) busy |= ready[k].data.ptr == shown;
+        for (k = 0; k < n; k++) {
+            term = ready[k].data.ptr;
+            /* sessions in the background are not drawn, and only read every few rounds while the one shown has output */
+            if (term != shown && busy && i % SESSION_BACKGROUND_ROUNDS) continue;
+            if (tty_read() < 0) {
+                epoll_ctl(tty_epoll, EPOLL_CTL_DEL, term->cmdfd, NULL);
+                __atomic_store_n(&term->exited, 1, __ATOMIC_RELEASE);
+                SDL_PushEvent(&gone);
+            }
+        }
+        stale |= busy || !n;
 
         /*
          * Stop after a certain number of reads so the user does not
          * feel like the system is stuttering.
          */
-        if (i < 1000 && FD_ISSET(cmdfd, &rfd)) {
-            tty_read();
-
+        if (i < 1000 && busy) {
             /*
              * Just wait a bit so it isn't disturbing the
              * user and the system is able to write something.
@@ -937,12 +1148,157 @@ int tty_thread(void *unused) {
         i = 0;
         tv = NULL;
 
-        SDL_PushEvent(&event);
+        if (stale) SDL_PushEvent(&event);
+        stale = 0;
     }
 
     return 0;
 }
 
+/* Feeds a recorded session instead of reading the shell, see tty_thread() */
+int replay_thread(void *unused) {
+    SDL_Event event = {.user = {.type = SDL_USEREVENT, .code = 0}};
+    const char *data;
+    size_t len, n, bytes = 0;
+    uint64_t due, start = perf_now(), last_redraw = 0, frames = perf_counters[PERF_FRAMES];
+    int events = 0, pending = 0;
+    double seconds;
+    (void)unused;
+
+    trace_thread("replay_thread");
+    while (!thread_should_exit && replay_next(&data, &len, &due)) {
+        /* show what was fed so far, then wait for the event to be due */
+        if (due > perf_now() - start && pending) {
+            SDL_PushEvent(&event);
+            last_redraw = perf_now() - start;
+            pending = 0;
+        }
+        while (!thread_should_exit && due > perf_now() - start) SDL_Delay(MIN(50, (due - (perf_now() - start)) / 1000000 + 1));
+
+        for (; len > 0 && !thread_should_exit; data += n, len -= n) {
+            n = MIN(len, BUFSIZ);
+            tty_feed(data, n);
+            bytes += n;
+            pending = 1;
+            if (perf_now() - start - last_redraw >= REPLAY_FRAME_NS) {
+                SDL_PushEvent(&event);
+                last_redraw = perf_now() - start;
+                pending = 0;
+            }
+        }
+        events++;
+    }
+    SDL_PushEvent(&event);
+    replay_close();
+    if (thread_should_exit) return 0;
+
+    seconds = (perf_now() - start) / 1e9;
+    printf("replay: %zu bytes, %d events in %.3f s (%.2f MB/s), %llu frames presented\n", bytes, events, seconds, bytes / seconds / (1024 * 1024),
+           (unsigned long long)(perf_counters[PERF_FRAMES] - frames));
+    if (opt_replay_exit) {
+        SDL_Event quit = {.type = SDL_QUIT};
+        SDL_PushEvent(&quit);
+    }
+    while (!thread_should_exit) SDL_Delay(50);
+    return 0;
+}
+
+/* Plays a cell recording in real time, seeking on request from k_press() */
+int play_thread(void *unused) {
+    SDL_Event event = {.user = {.type = SDL_USEREVENT, .code = 0}};
+    uint64_t pos = opt_seek * 1e9, ts, start;
+    long long seek;
+    (void)unused;
+
+    play_seek(pos);
+    start = perf_now() - pos;
+    SDL_PushEvent(&event);
+    while (!thread_should_exit) {
+        if ((seek = __atomic_exchange_n(&play_seek_by, 0, __ATOMIC_RELAXED))) {
+            pos = perf_now() - start;
+            pos = (seek < 0 && (uint64_t)-seek > pos) ? 0 : MIN(pos + seek, play_duration());
+            play_seek(pos);
+            start = perf_now() - pos;
+            snprintf(popup_message, sizeof(popup_message), "%d:%02d / %d:%02d", (int)(pos / 60000000000ull), (int)(pos / 1000000000ull % 60),
+                     (int)(play_duration() / 60000000000ull), (int)(play_duration() / 1000000000ull % 60));
+            SDL_AddTimer(1000, clear_popup_timer, NULL);
+            SDL_PushEvent(&event);
+            continue;
+        }
+        if (!play_peek(&ts)) {
+            SDL_Delay(50);  // at the end, still seekable
+            continue;
+        }
+        if (ts > perf_now() - start) {
+            SDL_Delay(MIN(50, (ts - (perf_now() - start)) / 1000000 + 1));
+            continue;
+        }
+        play_next(&ts);
+        SDL_PushEvent(&event);
+    }
+    play_close();
+    return 0;
+}
+
+/* Final grid as text, or ANSI with SGR for the attributes and colors */
+static void batch_dump(FILE *f, int ansi) {
+    Glyph prev = {{0}, ATTR_NULL, defaultfg, defaultbg, 0};
+
+    for (int y = 0; y < term->row; y++) export_row(f, ansi ? EXPORT_ANSI : EXPORT_TEXT, term->line[y], term->col, 0, &prev);
+}
+
+/* Render the grid with the configured font into an offscreen surface, no window */
+static int batch_bmp(const char *path) {
+    int ret;
+
+    sdl_load_fonts();
+    init_color_map();
+    main_window.width = term->col * main_window.char_width + 2 * borderpx;
+    main_window.height = term->row * main_window.char_height + 2 * borderpx;
+    main_window.surface = blit_create_surface(ALLOC_SURFACE, main_window.width, main_window.height);
+    if (!main_window.surface) {
+        fprintf(stderr, "Unable to create surface: %s\n", SDL_GetError());
+        return 0;
+    }
+    main_window.state |= WIN_VISIBLE;
+    sdl_term_clear(0, 0, term->col - 1, term->row - 1);
+    t_full_dirt();
+    draw_region(0, 0, term->col, term->row);
+    if ((ret = SDL_SaveBMP(main_window.surface, path)) != 0) fprintf(stderr, "Unable to save %s: %s\n", path, SDL_GetError());
+    blit_free_surface(main_window.surface);
+    main_window.surface = NULL;
+    cleanup_ttf_font();
+    return ret == 0;
+}
+
+/* Headless: run the -r commands on a pty, parse until the pty closes, dump the final screen */
+static int batch_run(void) {
+    char buf[BUFSIZ];
+    ssize_t n;
+    FILE *f = stdout;
+    int status;
+
+    show_help = 0;
+    t_new(opt_batch_cols, opt_batch_rows);
+    tty_new();
+    for (;;) {
+        if ((n = read(term->cmdfd, buf, sizeof(buf))) < 0 && errno == EINTR) continue;
+        if (n <= 0) break;  // EIO once every process holding the pty is gone
+        capture_write(buf, n);
+        tty_feed(buf, n);
+    }
+    status = tty_wait();
+
+    if (opt_batch == BATCH_BMP) {
+        if (!batch_bmp(opt_batch_out ? opt_batch_out : "screen.bmp")) return EXIT_FAILURE;
+        return status;
+    }
+    if (opt_batch_out && !(f = fopen(opt_batch_out, "w"))) die("Error opening %s:%s\n", opt_batch_out, strerror(errno));
+    batch_dump(f, opt_batch == BATCH_ANSI);
+    if (f != stdout) fclose(f);
+    return status;
+}
+
 static Uint32 clear_popup_timer(Uint32 interval, void *param) {
     popup_message[0] = '\0';
     return 0;  // one-shot timer
@@ -973,15 +1329,406 @@ void take_screenshot() {
     SDL_AddTimer(3000, clear_popup_timer, NULL);
 }
 
+/* History and the screen, or the selected command output, to a text file in $HOME */
+static void export_history(void) {
+    char name[64], path[256];
+    int64_t start = 0, end = INT64_MAX;
+    time_t now = time(NULL);
+    const char *home_dir = getenv("HOME");
+
+    strftime(name, sizeof(name), "st-%y%m%d_%H%M%S.txt", localtime(&now));
+    snprintf(path, sizeof(path), "%s/%s", home_dir ? home_dir : ".", name);
+    mark_selection(&start, &end);
+    export_start(path, EXPORT_TEXT, start, end, popup_message, sizeof(popup_message));
+    SDL_AddTimer(3000, clear_popup_timer, NULL);
+}
+
+/*
+ * Show session t. Its last frame is put back as it was, so only the rows
+ * its output changed while in the background are drawn again.
+ */
+static void session_show(Term *t) {
+    int steady;
+
+    if (t == term) return;
+    if (search_active()) search_stop();
+    mark_unselect();
+    session_cursor[term->id][0] = oldx;
+    session_cursor[term->id][1] = oldy;
+
+    term = t;
+    if (!session_surface[t->id]) {
+        /* new, or the window was resized since it was shown */
+        steady = alloc_steady(0);
+        session_surface[t->id] = blit_create_surface(ALLOC_SURFACE, main_window.surface->w, main_window.surface->h);
+        alloc_steady(steady);
+        session_cursor[t->id][0] = session_cursor[t->id][1] = 0;
+        t_full_dirt();
+    }
+    if (opt_record) t_full_dirt();  // the recording holds the rows of the session left
+    __atomic_store_n(&term_shown, t, __ATOMIC_RELEASE);
+    main_window.surface = session_surface[t->id];
+    oldx = session_cursor[t->id][0];
+    oldy = session_cursor[t->id][1];
+    snprintf(popup_message, sizeof(popup_message), "Session %d", t->id + 1);
+    SDL_AddTimer(1000, clear_popup_timer, NULL);
+    draw();
+}
+
+static int session_live(const Term *t) { return t->line && !__atomic_load_n(&t->exited, __ATOMIC_ACQUIRE); }
+
+/* Open a shell in a new session and show it */
+static void session_new(void) {
+    int steady;
+    Term *t;
+
+    if (tty_epoll < 0) return;  // playing or replaying, no shell
+    steady = alloc_steady(0);  // its grid and scrollback
+    t = session_open(term->col, term->row);
+    alloc_steady(steady);
+    if (!t) {
+        snprintf(popup_message, sizeof(popup_message), "%d sessions are open already", SESSION_MAX);
+        SDL_AddTimer(3000, clear_popup_timer, NULL);
+        return;
+    }
+    tty_watch(t);
+    session_show(t);
+}
+
+/* Show the next (dir 1) or previous (-1) session */
+static void session_step(int dir) {
+    for (int i = 1; i < SESSION_MAX; i++) {
+        Term *t = &sessions[(term->id + dir * i + SESSION_MAX) % SESSION_MAX];
+
+        if (session_live(t)) {
+            session_show(t);
+            return;
+        }
+    }
+}
+
+/* Free the sessions whose shell is gone, the last one stays until sig_chld() exits */
+static void session_reap(void) {
+    for (int i = 0; i < SESSION_MAX; i++) {
+        Term *t = &sessions[i];
+
+        if (!t->line || session_live(t)) continue;
+        if (t == term) session_step(1);
+        if (t == term) return;
+        if (export_session() == t) export_stop();
+        if (session_surface[i]) blit_free_surface(session_surface[i]);
+        session_surface[i] = NULL;
+        session_free(t);
+    }
+}
+
+#ifdef BENCH
+/*
+ * Render benchmark (make bench-render): replays the built-in corpora through
+ * t_write() -> draw() -> update_render() without a shell, one tty_read()
+ * sized chunk per frame, and writes per-stage frame times to a JSON file.
+ * The last scenario browses the history the dense corpus leaves, a scroll
+ * key press per frame.
+ */
+static char *opt_bench = NULL;
+static int opt_bench_size = 2048;  // KiB per scenario
+
+static const char *bench_scenarios[] = {"dense", "scroll", "cjk", "color256", "vim", "htop", NULL};
+
+enum { BENCH_PARSE = PERF_STAGES, BENCH_TOTAL, BENCH_COLUMNS };
+
+static int bench_cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_write_stats(FILE *f, const char *name, double *v, int n, int last) {
+    double sum = 0;
+
+    qsort(v, n, sizeof(*v), bench_cmp);
+    for (int i = 0; i < n; i++) sum += v[i];
+    fprintf(f, "        \"%s\": {\"p50_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f, \"mean_us\": %.2f}%s\n", name, v[n / 2], v[(int)((n - 1) * 0.99 + 0.5)], v[n - 1], sum / n,
+            last ? "" : ",");
+}
+
+static void bench_write_scenario(FILE *f, const char *name, size_t bytes, int frames, double seconds, double *samples) {
+    fprintf(stderr, "bench %-10s %4d frames %8.2f MB/s %7.1f fps\n", name, frames, bytes / seconds / (1024 * 1024), frames / seconds);
+    fprintf(f, "    {\n      \"name\": \"%s\",\n      \"bytes\": %zu,\n      \"frames\": %d,\n      \"seconds\": %.6f,\n", name, bytes, frames, seconds);
+    fprintf(f, "      \"bytes_per_sec\": %.0f,\n      \"frames_per_sec\": %.2f,\n      \"stages\": {\n", bytes / seconds, frames / seconds);
+    for (int st = 0; st < PERF_STAGES; st++) bench_write_stats(f, perf_stage_names[st], samples + st * frames, frames, 0);
+    bench_write_stats(f, "parse", samples + BENCH_PARSE * frames, frames, 0);
+    bench_write_stats(f, "total", samples + BENCH_TOTAL * frames, frames, 1);
+    fprintf(f, "      }\n    }");
+}
+
+void bench_render(const char *path) {
+    FILE *f;
+    Corpus c;
+    char buf[BUFSIZ];
+    const char *sep = "";
+
+    if (!(f = fopen(path, "w"))) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return;
+    }
+    fprintf(f, "{\n  \"video_driver\": \"%s\",\n", SDL_GetCurrentVideoDriver());
+    fprintf(f, "  \"config\": {\"rotate\": %d, \"font\": \"%s\", \"embedded_font\": %d, \"width\": %d, \"height\": %d, \"cols\": %d, \"rows\": %d},\n", opt_rotate,
+            is_ttf_loaded() ? opt_font : "embedded", embedded_font_name, main_window.width, main_window.height, term->col, term->row);
+    fprintf(f, "  \"scenarios\": [\n");
+
+    for (int s = 0; bench_scenarios[s]; s++) {
+        if (!corpus_build(&c, bench_scenarios[s], (size_t)opt_bench_size * 1024, term->col, term->row)) continue;
+
+        int frames = (c.len + LEN(buf) - 1) / LEN(buf);
+        double *samples = x_calloc(ALLOC_OTHER, frames * BENCH_COLUMNS, sizeof(double));
+        size_t pos = 0;
+        int buflen = 0, written;
+
+        /* start every scenario from a clean, fully drawn screen */
+        t_reset();
+        draw();
+
+        uint64_t start = perf_now();
+        for (int i = 0; i < frames; i++) {
+            uint64_t t = perf_now();
+            int n = MIN(LEN(buf) - buflen, c.len - pos);
+            memcpy(buf + buflen, c.data + pos, n);
+            pos += n;
+            buflen += n;
+            written = t_write(buf, buflen);
+            buflen -= written;
+            memmove(buf, buf + written, buflen);
+            samples[BENCH_PARSE * frames + i] = (perf_now() - t) / 1000.0;
+
+            draw();
+            for (int st = 0; st < PERF_STAGES; st++) {
+                samples[st * frames + i] = perf_last_frame.stage_ns[st] / 1000.0;
+                samples[BENCH_TOTAL * frames + i] += samples[st * frames + i];
+            }
+            samples[BENCH_TOTAL * frames + i] += samples[BENCH_PARSE * frames + i];
+        }
+        fputs(sep, f);
+        bench_write_scenario(f, c.name, c.len, frames, (perf_now() - start) / 1e9, samples);
+        sep = ",\n";
+
+        x_free(samples);
+        corpus_free(&c);
+    }
+
+    /* history: up through it and back down, 3 rows a frame as KEY_SCROLLUP/DOWN do */
+    if (corpus_build(&c, "dense", (size_t)opt_bench_size * 1024, term->col, term->row)) {
+        t_reset();
+        for (size_t pos = 0; pos < c.len;) {
+            int n = MIN(LEN(buf), c.len - pos);
+            memcpy(buf, c.data + pos, n);
+            pos += MAX(t_write(buf, n), 1);
+        }
+        draw();
+
+        int frames = 2 * MAX(MIN(t_scrollback_count() / 3, 1000), 1);
+        double *samples = x_calloc(ALLOC_OTHER, frames * BENCH_COLUMNS, sizeof(double));
+        uint64_t start = perf_now();
+        for (int i = 0; i < frames; i++) {
+            if (i < frames / 2) {
+                t_scroll_view_up(3);
+            } else {
+                t_scroll_view_down(3);
+            }
+            draw();
+            for (int st = 0; st < PERF_STAGES; st++) {
+                samples[st * frames + i] = perf_last_frame.stage_ns[st] / 1000.0;
+                samples[BENCH_TOTAL * frames + i] += samples[st * frames + i];
+            }
+        }
+        fputs(sep, f);
+        bench_write_scenario(f, "history", 0, frames, (perf_now() - start) / 1e9, samples);
+        x_free(samples);
+        corpus_free(&c);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    fclose(f);
+    fprintf(stderr, "bench results written to %s\n", path);
+}
+
+/*
+ * Golden image check (make bench-golden): renders fixed escape sequence
+ * scenarios for every embedded font and rotation, and compares the frame
+ * update_render() uploads pixel for pixel with <dir>/<scenario>-font<N>-rot<R>.bmp.
+ * A mismatch is saved next to it as .actual.bmp, a frame without a golden
+ * is skipped, but a run that compares none fails. -goldenupdate rewrites
+ * the goldens instead. 180 is rotated by the SDL renderer, so the frame checked
+ * for it is the unrotated composite, as for 0.
+ */
+static char *opt_golden = NULL;
+static char *opt_golden_cost = NULL;
+static int opt_golden_update = 0;
+
+#define GOLDEN_REPS 15  // full redraws timed per scenario
+
+typedef struct {
+    const char *name;
+    const char *seq;
+    int history;  // numbered lines printed first, to fill the scrollback
+    int view;     // lines the view is scrolled up
+    int osk;      // show the on screen keyboard
+} GoldenScenario;
+
+static const GoldenScenario golden_scenarios[] = {
+    {"attrs",
+     "plain \033[1mbold\033[22m \033[7mreverse\033[27m \033[4munderline\033[24m \033[1;4;7mall\033[0m\r\n"
+     "\033[31mred \033[32mgreen \033[33myellow \033[34mblue\033[0m \033[1;35mbright\033[0m \033[41;37mbg\033[0m\r\n"
+     "\033[38;5;208m208 \033[48;5;24m24\033[0m \033[7;32mreverse color\033[0m\r\n"
+     "drwxr-xr-x  2 root root 4096 Jan  1 00:00 a line long enough to wrap at the right margin\r\n"
+     "a\tb\tc\r\n$ ",
+     0, 0, 0},
+    {"gfx",
+     "\033(0lqqqqwqqqqk\r\nx    x    x\r\ntqqqqnqqqqu\r\nmqqqqvqqqqj\r\n`afgjklmnopqrstuvwxyz{|}~\033(B ascii\r\n$ ", 0, 0, 0},
+    {"scrollback", "$ ", 100, 10, 0},
+    {"osk", "$ echo hello\r\nhello\r\n$ ", 0, 0, 1},
+};
+
+static long golden_compare(SDL_Surface *frame, const char *path) {
+    SDL_Surface *bmp = SDL_LoadBMP(path), *golden;
+    long diff = 0;
+
+    if (!bmp) return -1;
+    golden = SDL_ConvertSurfaceFormat(bmp, SDL_PIXELFORMAT_RGB565, 0);
+    SDL_FreeSurface(bmp);
+    if (!golden) return -1;
+    if (golden->w != frame->w || golden->h != frame->h) {
+        diff = (long)frame->w * frame->h;
+    } else {
+        for (int y = 0; y < frame->h; y++) {
+            Uint16 *a = (Uint16 *)((Uint8 *)frame->pixels + y * frame->pitch);
+            Uint16 *b = (Uint16 *)((Uint8 *)golden->pixels + y * golden->pitch);
+            for (int x = 0; x < frame->w; x++) diff += a[x] != b[x];
+        }
+    }
+    SDL_FreeSurface(golden);
+    return diff;
+}
+
+static void golden_render(const GoldenScenario *s) {
+    char line[32];
+
+    t_reset();
+    t_scrollback_clear();
+    for (int i = 1; i <= s->history; i++) {
+        snprintf(line, sizeof(line), "history line %d\r\n", i);
+        tty_feed(line, strlen(line));
+    }
+    tty_feed(s->seq, strlen(s->seq));
+    if (s->view) t_scroll_view_up(s->view);
+    active = s->osk;
+    t_full_dirt();
+    draw();
+}
+
+int bench_golden(const char *dir) {
+    static const int rotations[] = {0, 90, 180, 270};
+    char path[PATH_MAX];
+    FILE *f = NULL;
+    double cost[GOLDEN_REPS];
+    int failed = 0, skipped = 0, total;
+
+    if (opt_golden_update) mkdir(dir, 0755);
+    if (opt_golden_cost && !(f = fopen(opt_golden_cost, "w"))) fprintf(stderr, "Error opening %s:%s\n", opt_golden_cost, strerror(errno));
+    if (f) fprintf(f, "{\n  \"video_driver\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n  \"scenarios\": [\n", SDL_GetCurrentVideoDriver(), initial_width, initial_height);
+
+    for (int font = 1; font <= 5; font++) {
+        main_window.char_width = get_embedded_font_char_width(font);
+        main_window.char_height = get_embedded_font_char_height(font);
+        init_keyboard(font, 1);
+        for (int r = 0; r < LEN(rotations); r++) {
+            opt_rotate = rotations[r];
+            scale_to_size(initial_width, initial_height);
+            for (int s = 0; s < LEN(golden_scenarios); s++) {
+                const GoldenScenario *gs = &golden_scenarios[s];
+                SDL_Surface *frame;
+                long diff;
+
+                golden_render(gs);
+                frame = (opt_rotate == 90 || opt_rotate == 270) ? rotated_screen : osk_screen;
+                snprintf(path, sizeof(path), "%s/%s-font%d-rot%d.bmp", dir, gs->name, font, opt_rotate);
+                if (opt_golden_update) {
+                    if (SDL_SaveBMP(frame, path) != 0) {
+                        fprintf(stderr, "golden %s: %s\n", path, SDL_GetError());
+                        failed++;
+                    }
+                } else if (access(path, F_OK) != 0) {
+                    skipped++;
+                } else if ((diff = golden_compare(frame, path)) != 0) {
+                    if (diff < 0) {
+                        fprintf(stderr, "golden %s: unreadable (%s)\n", path, SDL_GetError());
+                    } else {
+                        fprintf(stderr, "golden %s: %ld pixels differ\n", path, diff);
+                    }
+                    snprintf(path, sizeof(path), "%s/%s-font%d-rot%d.actual.bmp", dir, gs->name, font, opt_rotate);
+                    SDL_SaveBMP(frame, path);
+                    failed++;
+                }
+
+                /* frame cost: a full redraw of the same screen, best and median of GOLDEN_REPS */
+                for (int i = 0; i < GOLDEN_REPS; i++) {
+                    t_full_dirt();
+                    draw();
+                    cost[i] = 0;
+                    for (int st = 0; st < PERF_STAGES; st++) cost[i] += perf_last_frame.stage_ns[st] / 1000.0;
+                }
+                qsort(cost, GOLDEN_REPS, sizeof(*cost), bench_cmp);
+                printf("golden %-10s font %d rot %3d  min %8.1f us  median %8.1f us\n", gs->name, font, opt_rotate, cost[0], cost[GOLDEN_REPS / 2]);
+                if (f)
+                    fprintf(f, "    {\"name\": \"%s\", \"font\": %d, \"rotate\": %d, \"cols\": %d, \"rows\": %d, \"min_us\": %.2f, \"p50_us\": %.2f}%s\n", gs->name, font, opt_rotate, term->col,
+                            term->row, cost[0], cost[GOLDEN_REPS / 2], (font == 5 && r == LEN(rotations) - 1 && s == LEN(golden_scenarios) - 1) ? "" : ",");
+            }
+        }
+    }
+    active = 0;
+
+    if (f) {
+        fprintf(f, "  ]\n}\n");
+        fclose(f);
+    }
+    total = 5 * (int)LEN(rotations) * (int)LEN(golden_scenarios);
+    fprintf(stderr, "golden: %d of %d frames %s\n", failed, total, opt_golden_update ? "failed to write" : "differ");
+    if (skipped) fprintf(stderr, "golden: %d frames skipped, no golden in %s (run with -goldenupdate)\n", skipped, dir);
+    if (!opt_golden_update && skipped == total) {
+        fprintf(stderr, "golden: nothing compared\n");
+        return 1;
+    }
+    return failed;
+}
+#endif
+
+/* Typometer style probe: type a character, wait until it is on screen, erase it */
+static void latency_inject(Uint32 now) {
+    static Uint32 last_inject = 0;
+    static int typed = 0;
+    SDL_Event ev = {.text = {.type = SDL_TEXTINPUT}};
+
+    if (!latency_idle() || now - last_inject < LATENCY_INJECT_INTERVAL) return;
+    if (latency_samples() >= opt_latency_inject) exit(0);  // report is printed at exit
+
+    strcpy(ev.text.text, typed ? "\177" : "x");
+    typed = !typed;
+    SDL_PushEvent(&ev);
+    last_inject = now;
+}
+
 void main_loop(void) {
     SDL_Event ev;
     int running = 1;
     int should_rerender = 0;
+    Uint32 last_hud_sample = 0;
     int button_up_held = 0, button_down_held = 0, button_left_held = 0, button_right_held = 0;
     Uint32 last_button_held_time = 0;
+    int scroll_held = 0, scroll_axis = 0;  // -smoothscroll: 1 up, -1 down; stick position
+    Uint32 scroll_held_since = 0, last_scroll = 0;
+    float scroll_rows = 0, scroll_speed;  // rows not scrolled yet; rows per second, positive up
 #if defined(RG35XXSP)
     Uint8 joy0_hat0_last_state = 0;
 #endif
+    alloc_steady(1);  // grid, surfaces and glyphs are all allocated by now
     while (running) {
         while (SDL_PollEvent(&ev))
         // while (SDL_WaitEvent(&ev))
@@ -1004,6 +1751,10 @@ void main_loop(void) {
                 continue;  // skip other window events for now
             }
 
+            if (ev.type == SDL_KEYDOWN || ev.type == SDL_JOYBUTTONDOWN || ev.type == SDL_TEXTINPUT) {
+                latency_mark_input((SDL_GetTicks() - ev.common.timestamp) * 1000000ull);  // include the time spent queued
+            }
+
             if (ev.type == SDL_KEYDOWN || ev.type == SDL_KEYUP) {
                 // printf("Keyboard event received - key: %d (%s), state: %s\n", ev.key.keysym.sym, SDL_GetKeyName(ev.key.keysym.sym), (ev.type == SDL_KEYDOWN) ? "DOWN" : "UP");
                 int keyboard_event = handle_keyboard_event(&ev);
@@ -1028,6 +1779,16 @@ void main_loop(void) {
                     case KEY_DOWN:
                         button_down_held = held;
                         break;
+                    case KEY_SCROLLUP:
+                    case KEY_SCROLLDOWN:
+                        /* not when the key went to the OSK, the search or the command marks */
+                        if (!held) {
+                            scroll_held = 0;
+                        } else if (opt_smooth_scroll && keyboard_event != 1 && !search_active() && !(ev.key.keysym.mod & KEY_CMD_MOD) && !ev.key.repeat) {
+                            scroll_held = ev.key.keysym.sym == KEY_SCROLLUP ? 1 : -1;
+                            scroll_held_since = SDL_GetTicks();
+                        }
+                        break;
                     default:
                         break;
                 }
@@ -1042,6 +1803,8 @@ void main_loop(void) {
                                                }}};
 
                 SDL_PushEvent(&sdl_event);
+            } else if (ev.type == SDL_JOYAXISMOTION) {
+                if (opt_smooth_scroll && ev.jaxis.axis == SCROLL_AXIS) scroll_axis = ev.jaxis.value;
 #if defined(RG35XXSP)
             } else if (ev.type == SDL_JOYHATMOTION && ev.jhat.which == 0 &&
                        ev.jhat.hat == 0) {
@@ -1088,6 +1851,17 @@ void main_loop(void) {
                         draw();
                     } else if (ev.user.code == 1) {  // Take a screenshot
                         take_screenshot();
+                    } else if (ev.user.code == 2) {  // Export the scrollback
+                        export_history();
+                    } else if (ev.user.code == 3) {  // Export done
+                        export_status(popup_message, sizeof(popup_message));
+                        SDL_AddTimer(3000, clear_popup_timer, NULL);
+                    } else if (ev.user.code == 4) {  // New session
+                        session_new();
+                    } else if (ev.user.code == 5 || ev.user.code == 6) {  // Previous or next session
+                        session_step(ev.user.code == 6 ? 1 : -1);
+                    } else if (ev.user.code == 7) {  // The shell of a session is gone
+                        session_reap();
                     }
             }
             should_rerender = 1;
@@ -1110,13 +1884,51 @@ void main_loop(void) {
             should_rerender = 1;
         }
 
+        /* -smoothscroll: the stick sets the speed, a held L2/R2 speeds up the longer it is held */
+        scroll_speed = 0;
+        if (scroll_held && now - scroll_held_since > BUTTON_HELD_DELAY) {
+            scroll_speed = scroll_held * MIN(SCROLL_SPEED * (1 + (now - scroll_held_since) / 250.0f), SCROLL_SPEED_MAX);
+        } else if (abs(scroll_axis) > SCROLL_DEADZONE) {
+            scroll_speed = -scroll_axis * SCROLL_SPEED_MAX / 32768.0f;
+        }
+        if (scroll_speed) {
+            int n;
+            scroll_rows += scroll_speed * (now - last_scroll) / 1000;
+            n = (int)scroll_rows;
+            scroll_rows -= n;
+            if (n > 0) t_scroll_view_up(n);
+            if (n < 0) t_scroll_view_down(-n);
+            if (n) draw();
+        } else {
+            scroll_rows = 0;
+        }
+        last_scroll = now;
+
+        if (opt_latency_inject) latency_inject(now);
+
+        if (search_poll()) draw();
+
+        if (trigger_popup(popup_message, sizeof(popup_message))) {
+            SDL_AddTimer(3000, clear_popup_timer, NULL);
+            should_rerender = 1;
+        }
+
+        if (perf_hud && now - last_hud_sample >= 1000) {
+            perf_sample();
+            last_hud_sample = now;
+            should_rerender = 1;
+        }
+
         if (should_rerender) {
             update_render();  // redraw the screen
             should_rerender = 0;
+        } else {
+            perf_count(PERF_IDLE_WAKEUPS, 1);
         }
-        SDL_Delay(33);    // ~30 FPS
+        SDL_Delay(scroll_speed ? 16 : 33);    // ~30 FPS, ~60 while scrolling
     }
 
+    alloc_steady(0);
     sdl_shutdown();
 }
 
@@ -1124,6 +1936,7 @@ int main(int argc, char *argv[]) {
     setenv("SDL_NOMOUSE", "1", 1);
     int is_scale_set_by_user = 0;
 
+    for (int i = 0; triggers[i]; i++) trigger_add(triggers[i]);
     for (int i = 1; i < argc; i++) {
         // Handle multi-character options first
         if (strcmp(argv[i], "-scale") == 0) {
@@ -1211,6 +2024,234 @@ int main(int argc, char *argv[]) {
             }
             continue;
         }
+#ifdef BENCH
+        if (strcmp(argv[i], "-bench") == 0) {
+            if (++i < argc) {
+                opt_bench = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -bench\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-benchsize") == 0) {
+            if (++i < argc) {
+                opt_bench_size = MAX(1, atoi(argv[i]));
+            } else {
+                fprintf(stderr, "Missing argument for -benchsize\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-golden") == 0) {
+            if (++i < argc) {
+                opt_golden = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -golden\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-goldencost") == 0) {
+            if (++i < argc) {
+                opt_golden_cost = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -goldencost\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-goldenupdate") == 0) {
+            opt_golden_update = 1;
+            continue;
+        }
+#endif
+        if (strcmp(argv[i], "-trace") == 0) {
+            if (++i < argc) {
+                opt_trace = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -trace\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-latency") == 0) {
+            latency_init();
+            continue;
+        }
+        if (strcmp(argv[i], "-latencyinject") == 0) {
+            if (++i < argc) {
+                opt_latency_inject = MAX(1, atoi(argv[i]));
+                if (!latency_enabled) latency_init();
+            } else {
+                fprintf(stderr, "Missing argument for -latencyinject\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-ofmt") == 0) {
+            if (++i < argc) {
+                if (strcmp(argv[i], "raw") == 0) {
+                    opt_io_format = CAPTURE_RAW;
+                } else if (strcmp(argv[i], "cast") == 0) {
+                    opt_io_format = CAPTURE_CAST;
+                } else {
+                    fprintf(stderr, "Invalid output format: %s (must be raw or cast)\n", argv[i]);
+                    die(USAGE);
+                }
+            } else {
+                fprintf(stderr, "Missing argument for -ofmt\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-replay") == 0) {
+            if (++i < argc) {
+                opt_replay = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -replay\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-replaypace") == 0) {
+            if (++i < argc) {
+                if (!replay_set_pace(argv[i])) {
+                    fprintf(stderr, "Invalid replay pace: %s (must be realtime, speed=N or max)\n", argv[i]);
+                    die(USAGE);
+                }
+            } else {
+                fprintf(stderr, "Missing argument for -replaypace\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-replayexit") == 0) {
+            opt_replay_exit = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-batch") == 0) {
+            if (++i < argc) {
+                if (strcmp(argv[i], "text") == 0) {
+                    opt_batch = BATCH_TEXT;
+                } else if (strcmp(argv[i], "ansi") == 0) {
+                    opt_batch = BATCH_ANSI;
+                } else if (strcmp(argv[i], "bmp") == 0) {
+                    opt_batch = BATCH_BMP;
+                } else {
+                    fprintf(stderr, "Invalid batch format: %s (must be text, ansi or bmp)\n", argv[i]);
+                    die(USAGE);
+                }
+            } else {
+                fprintf(stderr, "Missing argument for -batch\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-batchout") == 0) {
+            if (++i < argc) {
+                opt_batch_out = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -batchout\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-batchsize") == 0) {
+            if (++i < argc) {
+                if (sscanf(argv[i], "%dx%d", &opt_batch_cols, &opt_batch_rows) != 2 || opt_batch_cols < 1 || opt_batch_rows < 1) {
+                    fprintf(stderr, "Invalid batch size: %s (must be COLSxROWS)\n", argv[i]);
+                    die(USAGE);
+                }
+            } else {
+                fprintf(stderr, "Missing argument for -batchsize\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-control") == 0) {
+            if (++i < argc) {
+                opt_control = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -control\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-record") == 0) {
+            if (++i < argc) {
+                opt_record = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -record\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-play") == 0) {
+            if (++i < argc) {
+                opt_play = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -play\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-seek") == 0) {
+            if (++i < argc) {
+                opt_seek = MAX(0, atof(argv[i]));
+            } else {
+                fprintf(stderr, "Missing argument for -seek\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-hud") == 0) {
+            perf_hud = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-allocassert") == 0) {
+            alloc_assert = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-spill") == 0) {
+            if (++i < argc) {
+                opt_spill = MAX(0, atoi(argv[i]));
+            } else {
+                fprintf(stderr, "Missing argument for -spill\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-spillkeep") == 0) {
+            opt_spill_keep = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-trigger") == 0) {
+            if (++i < argc) {
+                trigger_add(argv[i]);  // an invalid one is reported and ignored
+            } else {
+                fprintf(stderr, "Missing argument for -trigger\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-snapshot") == 0) {
+            if (++i < argc) {
+                opt_snapshot = argv[i];
+            } else {
+                fprintf(stderr, "Missing argument for -snapshot\n");
+                die(USAGE);
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "-nosimd") == 0) {
+            opt_nosimd = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "-smoothscroll") == 0) {
+            opt_smooth_scroll = 1;
+            continue;
+        }
         if (strcmp(argv[i], "-useEmbeddedFontForKeyboard") == 0) {
             if (++i < argc) {
                 opt_use_embedded_font_for_keyboard = atoi(argv[i]);
@@ -1227,7 +2268,7 @@ int main(int argc, char *argv[]) {
                     opt_cmd = &argv[i];
                     opt_cmd_size = argc - i;
                     for (int j = 0; j < opt_cmd_size; j++) {
-                        printf("Command to execute: %s\n", opt_cmd[j]);
+                        if (!opt_batch) printf("Command to execute: %s\n", opt_cmd[j]);  // batch output may be stdout
                     }
                     show_help = 0;
                 }
@@ -1246,6 +2287,13 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    cpu_init(opt_nosimd ? 0 : ~0u);
+
+    /* registers trace_close before sdl_shutdown, so it runs after the tty thread is gone */
+    if (opt_trace) trace_open(opt_trace);
+
+    if (opt_batch) return batch_run();
+
     if (atexit(sdl_shutdown)) {
         fprintf(stderr, "Unable to register SDL_Quit atexit\n");
     }
@@ -1256,8 +2304,42 @@ int main(int argc, char *argv[]) {
         int content_h = main_window.surface ? main_window.surface->h : main_window.height;
         t_new((content_w - borderpx) / main_window.char_width, (content_h - borderpx) / main_window.char_height);
     }
-    tty_new();
-    create_tty_thread();
+#ifdef BENCH
+    if (opt_bench) {
+        /* no shell: replies to terminal queries go nowhere */
+        term->cmdfd = open("/dev/null", O_WRONLY);
+        show_help = 0;
+        scale_to_size((int)(main_window.width / opt_scale), (int)(main_window.height / opt_scale));
+        init_keyboard(embedded_font_name, opt_use_embedded_font_for_keyboard);
+        bench_render(opt_bench);
+        return 0;
+    }
+    if (opt_golden) {
+        term->cmdfd = open("/dev/null", O_WRONLY);
+        show_help = 0;
+        return bench_golden(opt_golden) ? 1 : 0;
+    }
+#endif
+    if (opt_snapshot) snapshot_load(opt_snapshot);  // history shows before the shell prints
+    if (opt_record) record_open(opt_record);
+    if (opt_control) control_open(opt_control);
+    if (opt_play) {
+        if (!play_open(opt_play)) die("Unable to load recording %s\n", opt_play);
+        term->cmdfd = open("/dev/null", O_WRONLY);
+        active = show_help = 0;
+        create_tty_thread(play_thread);
+    } else if (opt_replay) {
+        /* no shell: the recording is fed to the parser, replies go nowhere */
+        if (!replay_open(opt_replay)) die("Unable to load replay %s\n", opt_replay);
+        term->cmdfd = open("/dev/null", O_WRONLY);
+        show_help = 0;
+        create_tty_thread(replay_thread);
+    } else {
+        tty_new();
+        if ((tty_epoll = epoll_create1(EPOLL_CLOEXEC)) < 0) die("epoll_create1 failed: %s\n", strerror(errno));
+        tty_watch(term);
+        create_tty_thread(tty_thread);
+    }
     scale_to_size((int)(main_window.width / opt_scale), (int)(main_window.height / opt_scale));
     init_keyboard(embedded_font_name, opt_use_embedded_font_for_keyboard);
     main_loop();
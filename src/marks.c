@@ -0,0 +1,261 @@
+#include "marks.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "scrollback.h"
+
+#define MARK_COLS 1024 /* widest screen row mark_row() copies */
+
+extern unsigned int defaultfg;
+extern unsigned int defaultbg;
+
+typedef struct {
+    int64_t prompt; /* line of the prompt (A), or of the output when there was no A */
+    int64_t output; /* first output line (C), -1 if the shell sent none */
+    int64_t end;    /* line after the output (D or the next A), -1 while running */
+    int status;     /* exit status from D, -1 if not given */
+} Command;
+
+/* Marks of a session's history */
+typedef struct {
+    Command cmds[MARK_COMMANDS];
+    unsigned ncmds; /* added since mark_clear(), the last MARK_COMMANDS are kept */
+    int64_t lines[MARK_LINES];
+    unsigned nlines; /* same for lines marked by triggers */
+    struct {
+        int active;
+        unsigned id;    /* of the command */
+        int64_t end_at; /* sb_end() when the rows were counted */
+        int cols;
+        int top, bot; /* rows of the output, bot excluded */
+    } sel;
+} Marks;
+
+static Marks marks[SESSION_MAX]; /* indexed by Term id, the calling thread's session is used */
+
+static Glyph scratch[MARK_COLS];
+
+static unsigned first(unsigned n, unsigned cap) { return n > cap ? n - cap : 0; }
+
+static int64_t prompt_at(unsigned i) { return marks[term->id].cmds[i % MARK_COMMANDS].prompt; }
+
+static int64_t line_at(unsigned i) { return marks[term->id].lines[i % MARK_LINES]; }
+
+void mark_add(char kind, int64_t line, int cell, int status) {
+    Marks *m = &marks[term->id];
+    Command *c = m->ncmds ? &m->cmds[(m->ncmds - 1) % MARK_COMMANDS] : NULL;
+
+    switch (kind) {
+        case 'A':
+            /* the shell redrawing its prompt */
+            if (c && c->prompt == line && c->output < 0 && c->end < 0) return;
+            if (c && c->end < 0) c->end = MAX(line + (cell > 0), c->output);
+            m->cmds[m->ncmds % MARK_COMMANDS] = (Command){line, -1, -1, -1};
+            m->ncmds++;
+            break;
+        case 'C':
+            if (!c || c->end >= 0 || c->output >= 0) {
+                m->cmds[m->ncmds % MARK_COMMANDS] = (Command){line, line, -1, -1};
+                m->ncmds++;
+            } else {
+                c->output = line;
+            }
+            break;
+        case 'D':
+            if (c && c->end < 0) {
+                c->end = MAX(line + (cell > 0), c->output);
+                c->status = status;
+            }
+            break;
+    }
+}
+
+void mark_line(int64_t line) {
+    Marks *m = &marks[term->id];
+
+    if (m->nlines > first(m->nlines, MARK_LINES) && line_at(m->nlines - 1) >= line) return;
+    m->lines[m->nlines % MARK_LINES] = line;
+    m->nlines++;
+}
+
+void mark_clear(void) {
+    Marks *m = &marks[term->id];
+
+    m->ncmds = 0;
+    m->nlines = 0;
+    m->sel.active = 0;
+}
+
+void mark_drop(int64_t line) {
+    Marks *m = &marks[term->id];
+    Command *c;
+
+    while (m->ncmds > first(m->ncmds, MARK_COMMANDS) && m->cmds[(m->ncmds - 1) % MARK_COMMANDS].prompt >= line) m->ncmds--;
+    while (m->nlines > first(m->nlines, MARK_LINES) && line_at(m->nlines - 1) >= line) m->nlines--;
+    if (m->sel.id >= m->ncmds) m->sel.active = 0;
+    if (m->ncmds == first(m->ncmds, MARK_COMMANDS)) return;
+    c = &m->cmds[(m->ncmds - 1) % MARK_COMMANDS];
+    if (c->output > line) c->output = line;
+    if (c->end > line) c->end = line;
+    m->sel.cols = 0;
+}
+
+/* Row of line as the view counts them: history rows from 1 up, screen rows from 0 down. INT_MAX if gone */
+static int row_of(int64_t line) {
+    int64_t end = sb_end(term->scrollback);
+    int x, n;
+
+    if (line >= end) return -(int)MIN(line - end, term->row - 1);
+    n = sb_row_of(term->scrollback, line, 0, term->col, &x);
+    return n ? n : INT_MAX;
+}
+
+/* The marks from lo on with their line (at(i)) above row min come first, returns the first that is not */
+static unsigned above(int64_t (*at)(unsigned), unsigned lo, unsigned hi, int min) {
+    unsigned mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (row_of(at(mid)) > min) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Row of the nearest mark above (older) or below the view at offset, -1 if there is none */
+static int nearest(int64_t (*at)(unsigned), unsigned lo, unsigned n, int offset, int older) {
+    unsigned i;
+    int row;
+
+    if (older) {
+        if ((i = above(at, lo, n, offset)) == lo || (row = row_of(at(i - 1))) == INT_MAX) return -1;
+        return row;
+    }
+    i = above(at, lo, n, offset - 1);
+    return i < n ? MAX(row_of(at(i)), 0) : -1;
+}
+
+void mark_jump(int older) {
+    Marks *m = &marks[term->id];
+    int offset = t_get_scroll_offset(), cmd, line;
+
+    if (!term->scrollback) return;
+    cmd = nearest(prompt_at, first(m->ncmds, MARK_COMMANDS), m->ncmds, offset, older);
+    line = nearest(line_at, first(m->nlines, MARK_LINES), m->nlines, offset, older);
+    if (older) {
+        if (cmd >= 0 || line >= 0) t_scroll_view_to(cmd < 0 ? line : line < 0 ? cmd : MIN(cmd, line));
+    } else if (m->ncmds || m->nlines) {
+        /* past the newest mark is the bottom */
+        t_scroll_view_to(MAX(MAX(cmd, line), 0));
+    }
+}
+
+/* Lines of the output of c, end is -1 for the command still running */
+static int output_of(const Command *c, int64_t *start, int64_t *end) {
+    *start = c->output >= 0 ? c->output : c->prompt + 1;
+    *end = c->end;
+    return c->output >= 0 || c->end >= 0;
+}
+
+void mark_select(void) {
+    Marks *m = &marks[term->id];
+    unsigned n = m->ncmds, lo = first(n, MARK_COMMANDS), i;
+    int offset = t_get_scroll_offset();
+    int64_t start, end;
+
+    if (!term->scrollback || n == lo) return;
+    if (offset) {
+        /* the command at the top of the view */
+        i = above(prompt_at, lo, n, offset - 1);
+        i = i > lo ? i - 1 : lo;
+    } else {
+        /* the last one that ran */
+        for (i = n - 1; i > lo && !output_of(&m->cmds[i % MARK_COMMANDS], &start, &end); i--);
+    }
+    if (m->sel.active && m->sel.id == i) {
+        mark_unselect();
+    } else if (output_of(&m->cmds[i % MARK_COMMANDS], &start, &end)) {
+        m->sel.active = 1;
+        m->sel.id = i;
+        m->sel.cols = 0;
+        t_full_dirt();
+    }
+}
+
+void mark_unselect(void) {
+    Marks *m = &marks[term->id];
+
+    if (!m->sel.active) return;
+    m->sel.active = 0;
+    t_full_dirt();
+}
+
+int mark_selection(int64_t *start, int64_t *end) {
+    Marks *m = &marks[term->id];
+
+    if (!m->sel.active || m->sel.id < first(m->ncmds, MARK_COMMANDS) || m->sel.id >= m->ncmds) return 0;
+    output_of(&m->cmds[m->sel.id % MARK_COMMANDS], start, end);
+    if (*end < 0) *end = sb_end(term->scrollback) + term->c.y + 1;
+    return 1;
+}
+
+/* Count the rows of the selection again when history or the width changed */
+static int sel_place(void) {
+    Marks *m = &marks[term->id];
+    int64_t start, end;
+
+    if (!mark_selection(&start, &end)) return 0;
+    if (m->sel.end_at != sb_end(term->scrollback) || m->sel.cols != term->col) {
+        m->sel.top = row_of(start);
+        m->sel.bot = m->cmds[m->sel.id % MARK_COMMANDS].end < 0 ? 0 : row_of(end);
+        m->sel.end_at = sb_end(term->scrollback);
+        m->sel.cols = term->col;
+    }
+    /* a running command goes on to the cursor */
+    if (m->cmds[m->sel.id % MARK_COMMANDS].end < 0) m->sel.bot = -term->c.y - 1;
+    return 1;
+}
+
+Line mark_row(Line row, int cols, int n) {
+    Marks *m = &marks[term->id];
+
+    if (!m->sel.active || !sel_place() || n <= m->sel.bot || n > m->sel.top) return row;
+    if (n <= 0) {
+        if (cols > MARK_COLS) return row;
+        memcpy(scratch, row, cols * sizeof(Glyph));
+        row = scratch;
+    }
+    for (int x = 0; x < cols; x++) {
+        if (!(row[x].state & GLYPH_SET)) {
+            memset(&row[x], 0, sizeof(row[x]));
+            row[x].c[0] = ' ';
+            row[x].fg = defaultfg;
+            row[x].bg = defaultbg;
+            row[x].state = GLYPH_SET;
+        }
+        row[x].mode ^= ATTR_REVERSE;
+    }
+    return row;
+}
+
+int mark_status(char *buf, size_t size) {
+    Marks *m = &marks[term->id];
+    int64_t start, end;
+    int status, n;
+
+    if (!mark_selection(&start, &end)) return 0;
+    status = m->cmds[m->sel.id % MARK_COMMANDS].status;
+    if (m->cmds[m->sel.id % MARK_COMMANDS].end < 0) {
+        n = snprintf(buf, size, "[%lld lines, running]", (long long)(end - start));
+    } else if (status >= 0) {
+        n = snprintf(buf, size, "[%lld lines, exit %d]", (long long)(end - start), status);
+    } else {
+        n = snprintf(buf, size, "[%lld lines]", (long long)(end - start));
+    }
+    return MIN(n, (int)size - 1);
+}
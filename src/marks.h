@@ -0,0 +1,48 @@
+#ifndef __MARKS_H__
+#define __MARKS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vt100.h"
+
+/*
+ * Command marks from shell integration (OSC 133 A prompt, B command,
+ * C output, D;status finished). Each command keeps the history line
+ * numbers of its prompt and output (see sb_end()) in a ring of the last
+ * MARK_COMMANDS, so jumping to one costs a binary search, not a scroll.
+ *
+ * mark_add() is called by the tty thread as the marks arrive, the rest by
+ * the main thread. Each session has its own marks, those of the calling
+ * thread's term are used.
+ */
+#define MARK_COMMANDS 1024
+#define MARK_LINES 256 /* lines marked by output triggers, see trigger.h */
+
+void mark_add(char kind, int64_t line, int cell, int status);
+/* A line to jump to like a prompt, from the tty thread */
+void mark_line(int64_t line);
+void mark_clear(void);
+/* Forget the marks at or after line, their rows were reflowed */
+void mark_drop(int64_t line);
+
+/* Scroll the previous (older) or next prompt or marked line to the top of the view */
+void mark_jump(int older);
+
+/* Select the output of the command in view, or unselect it if it already is */
+void mark_select(void);
+void mark_unselect(void);
+/* Lines [*start, *end) of the selected output. Returns 0 if nothing is selected */
+int mark_selection(int64_t *start, int64_t *end);
+
+/*
+ * Highlight row if it is part of the selection. n counts rows as
+ * t_scrollback_line() does for history and -y for screen row y; screen
+ * rows are copied, the row to draw is returned.
+ */
+Line mark_row(Line row, int cols, int n);
+
+/* Selection for the scroll indicator, returns its length */
+int mark_status(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,55 @@
+#include "perf.h"
+
+#include <string.h>
+#include <time.h>
+
+const char *perf_stage_names[PERF_STAGES] = {"rasterize", "composite", "rotate", "upload", "present"};
+
+PerfFrame perf_frame;
+PerfFrame perf_last_frame;
+uint64_t perf_counters[PERF_COUNTERS];
+PerfRates perf_rates;
+int perf_hud = 0;
+
+static PerfFrame perf_total; /* sum of all presented frames */
+
+uint64_t perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void perf_frame_end(void) {
+    for (int i = 0; i < PERF_STAGES; i++) perf_total.stage_ns[i] += perf_frame.stage_ns[i];
+    perf_total.dirty_rows += perf_frame.dirty_rows;
+    perf_total.x_draws += perf_frame.x_draws;
+    perf_count(PERF_FRAMES, 1);
+
+    perf_last_frame = perf_frame;
+    memset(&perf_frame, 0, sizeof(perf_frame));
+}
+
+/* Turn the counters into rates since the previous call (main thread only) */
+void perf_sample(void) {
+    static uint64_t last_time, last_counters[PERF_COUNTERS];
+    static PerfFrame last_total;
+    uint64_t now = perf_now();
+    double seconds = (now - last_time) / 1e9;
+    double frames;
+
+    if (last_time == 0) seconds = 0;
+    last_time = now;
+
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        uint64_t c = __atomic_load_n(&perf_counters[i], __ATOMIC_RELAXED);
+        perf_rates.counter[i] = seconds > 0 ? (c - last_counters[i]) / seconds : 0;
+        last_counters[i] = c;
+    }
+
+    frames = perf_rates.counter[PERF_FRAMES] * seconds;
+    if (frames < 1) frames = 1;
+    for (int i = 0; i < PERF_STAGES; i++) perf_rates.stage_ms[i] = (perf_total.stage_ns[i] - last_total.stage_ns[i]) / frames / 1e6;
+    perf_rates.dirty_rows = (perf_total.dirty_rows - last_total.dirty_rows) / frames;
+    perf_rates.x_draws = (perf_total.x_draws - last_total.x_draws) / frames;
+    last_total = perf_total;
+}
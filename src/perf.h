@@ -0,0 +1,46 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include <stdint.h>
+
+/* Render pipeline stages, timed for every presented frame */
+enum perf_stage { PERF_RASTERIZE, PERF_COMPOSITE, PERF_ROTATE, PERF_UPLOAD, PERF_PRESENT, PERF_STAGES };
+
+/* Running counters, shared by the tty and main threads */
+enum perf_counter { PERF_PTY_BYTES, PERF_PUTC, PERF_FRAMES, PERF_IDLE_WAKEUPS, PERF_COUNTERS };
+
+typedef struct {
+    uint64_t stage_ns[PERF_STAGES];
+    uint64_t dirty_rows; /* rows rasterized by draw_region */
+    uint64_t x_draws;    /* x_draws calls */
+} PerfFrame;
+
+/* Rates over the last sampling period, see perf_sample() */
+typedef struct {
+    double counter[PERF_COUNTERS]; /* per second */
+    double stage_ms[PERF_STAGES];  /* per frame */
+    double dirty_rows;             /* per frame */
+    double x_draws;                /* per frame */
+} PerfRates;
+
+extern const char *perf_stage_names[PERF_STAGES];
+extern PerfFrame perf_frame;      /* frame being composed */
+extern PerfFrame perf_last_frame; /* last presented frame */
+extern uint64_t perf_counters[PERF_COUNTERS];
+extern PerfRates perf_rates;
+extern int perf_hud;
+
+uint64_t perf_now(void);
+void perf_frame_end(void);
+void perf_sample(void);
+
+/* Charge the time since *t to stage and restart the lap */
+static inline void perf_lap(int stage, uint64_t *t) {
+    uint64_t now = perf_now();
+    perf_frame.stage_ns[stage] += now - *t;
+    *t = now;
+}
+
+static inline void perf_count(int counter, uint64_t n) { __atomic_fetch_add(&perf_counters[counter], n, __ATOMIC_RELAXED); }
+
+#endif
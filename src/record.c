@@ -0,0 +1,355 @@
+#include "record.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "perf.h"
+#include "vt100.h"
+
+extern unsigned int defaultfg;
+extern unsigned int defaultbg;
+
+#define RECORD_MAGIC "STREC001"
+#define RECORD_KEYFRAME_NS 5000000000ull /* keyframe every 5 s */
+#define RECORD_RUN_MAX 255
+
+/*
+ * File: magic, then frames of FrameHeader + payload.
+ * Keyframe payload: u16 cols, u16 rows, cursor, then every row.
+ * Delta payload: cursor, u16 count, then count times u16 y and the row.
+ * Cursor: u16 x, u16 y, u8 state, u32 term mode.
+ * Row: runs of identical cells, u8 run, u8 utf8 length (0 = unset cell),
+ * the utf8 bytes, u8 mode, u16 fg, u16 bg.
+ */
+typedef struct {
+    uint8_t type; /* 'K' keyframe, 'D' delta */
+    uint8_t pad[3];
+    uint32_t len;
+    uint64_t ts; /* ns since the start of the recording */
+} FrameHeader;
+
+int record_enabled = 0;
+
+static FILE *record_file;
+static uint64_t record_start, last_keyframe;
+static int record_cols, record_rows;
+static uint8_t *frame_buf;
+static size_t frame_cap;
+
+static uint8_t *play_data;
+static size_t play_size, play_pos;
+static size_t *keyframes; /* offsets of the keyframes */
+static uint64_t *keyframe_ts;
+static int keyframe_count;
+static uint64_t duration;
+
+static uint8_t *put(uint8_t *p, const void *v, size_t n) {
+    memcpy(p, v, n);
+    return p + n;
+}
+
+/* Read n bytes of a frame ending at end, NULL once a read would go past it */
+static const uint8_t *get(const uint8_t *p, const uint8_t *end, void *v, size_t n) {
+    if (!p || (size_t)(end - p) < n) return NULL;
+    memcpy(v, p, n);
+    return p + n;
+}
+
+static int cell_eq(Glyph *a, Glyph *b) {
+    if ((a->state & GLYPH_SET) != (b->state & GLYPH_SET)) return 0;
+    if (!(a->state & GLYPH_SET)) return 1;
+    return !ATTRCMP(*a, *b) && !memcmp(a->c, b->c, utf8_size(a->c));
+}
+
+static uint8_t *pack_row(uint8_t *p, Line line, int cols) {
+    for (int x = 0; x < cols;) {
+        Glyph *g = &line[x];
+        uint8_t run = 1, len = (g->state & GLYPH_SET) ? utf8_size(g->c) : 0;
+
+        while (x + run < cols && run < RECORD_RUN_MAX && cell_eq(g, &line[x + run])) run++;
+        p = put(p, &run, 1);
+        p = put(p, &len, 1);
+        if (len) {
+            p = put(p, g->c, len);
+            p = put(p, &g->mode, 1);
+            p = put(p, &g->fg, 2);
+            p = put(p, &g->bg, 2);
+        }
+        x += run;
+    }
+    return p;
+}
+
+/* NULL if the row does not fit before end or holds a char longer than UTF_SIZ */
+static const uint8_t *unpack_row(const uint8_t *p, const uint8_t *end, Line line, int cols, int rec_cols) {
+    for (int x = 0; x < rec_cols;) {
+        Glyph g = {{0}, ATTR_NULL, defaultfg, defaultbg, 0};
+        uint8_t run, len;
+
+        p = get(p, end, &run, 1);
+        p = get(p, end, &len, 1);
+        if (!p || len > UTF_SIZ) return NULL;
+        if (len) {
+            p = get(p, end, g.c, len);
+            p = get(p, end, &g.mode, 1);
+            p = get(p, end, &g.fg, 2);
+            p = get(p, end, &g.bg, 2);
+            if (!p) return NULL;
+            g.state = GLYPH_SET;
+        }
+        for (int i = 0; i < run && x < rec_cols; i++, x++)
+            if (line && x < cols) line[x] = g;
+    }
+    return p;
+}
+
+static uint8_t *put_cursor(uint8_t *p) {
+    uint16_t x = term->c.x, y = term->c.y;
+    uint8_t state = term->c.state;
+    uint32_t mode = term->mode;
+
+    p = put(p, &x, 2);
+    p = put(p, &y, 2);
+    p = put(p, &state, 1);
+    return put(p, &mode, 4);
+}
+
+static const uint8_t *get_cursor(const uint8_t *p, const uint8_t *end) {
+    uint16_t x, y;
+    uint8_t state;
+    uint32_t mode;
+
+    p = get(p, end, &x, 2);
+    p = get(p, end, &y, 2);
+    p = get(p, end, &state, 1);
+    p = get(p, end, &mode, 4);
+    if (!p) return NULL;
+    term->c.x = MIN(x, term->col - 1);
+    term->c.y = MIN(y, term->row - 1);
+    term->c.state = state;
+    term->mode = mode;
+    return p;
+}
+
+int record_open(const char *path) {
+    if (!(record_file = fopen(path, "wb"))) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fwrite(RECORD_MAGIC, 1, 8, record_file);
+    record_start = perf_now();
+    last_keyframe = 0;
+    record_cols = record_rows = 0;
+    record_enabled = 1;
+    record_size(term->col, term->row);
+    atexit(record_close);
+    return 1;
+}
+
+/* Grow the frame buffer to the worst case frame of a col x row grid, outside of draw() */
+void record_size(int col, int row) {
+    size_t worst = 32 + (size_t)row * (2 + col * (2 + UTF_SIZ + 5));
+
+    if (!record_enabled || frame_cap >= worst) return;
+    frame_buf = x_realloc(ALLOC_OTHER, frame_buf, worst);
+    frame_cap = worst;
+}
+
+/* Append the rows damaged since the last frame, before draw_region() clears term->dirty */
+void record_frame(void) {
+    FrameHeader h = {'D', {0}, 0, perf_now() - record_start};
+    uint8_t *p;
+    uint16_t n = 0, y;
+
+    if (!record_enabled) return;
+    record_size(term->col, term->row); /* no-op unless a resize was missed */
+
+    if (term->col != record_cols || term->row != record_rows || h.ts - last_keyframe >= RECORD_KEYFRAME_NS || h.ts == 0) {
+        uint16_t cols = term->col, rows = term->row;
+
+        h.type = 'K';
+        p = put(frame_buf, &cols, 2);
+        p = put(p, &rows, 2);
+        p = put_cursor(p);
+        for (y = 0; y < term->row; y++) p = pack_row(p, term->line[y], term->col);
+        record_cols = term->col, record_rows = term->row;
+        last_keyframe = h.ts;
+    } else {
+        uint8_t *count;
+
+        p = put_cursor(frame_buf);
+        count = p;
+        p += 2;
+        for (y = 0; y < term->row; y++) {
+            if (!term->dirty[y]) continue;
+            p = put(p, &y, 2);
+            p = pack_row(p, term->line[y], term->col);
+            n++;
+        }
+        put(count, &n, 2);
+    }
+
+    h.len = p - frame_buf;
+    fwrite(&h, sizeof(h), 1, record_file);
+    fwrite(frame_buf, 1, h.len, record_file);
+}
+
+void record_close(void) {
+    if (!record_enabled) return;
+    record_enabled = 0;
+    fclose(record_file);
+    record_file = NULL;
+    x_free(frame_buf);
+    frame_buf = NULL;
+    frame_cap = 0;
+}
+
+int play_open(const char *path) {
+    FILE *f = fopen(path, "rb");
+    FrameHeader h;
+    size_t pos;
+    long size;
+
+    if (!f) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 8) {
+        fprintf(stderr, "%s is not a cell recording\n", path);
+        fclose(f);
+        return 0;
+    }
+    play_data = x_malloc(ALLOC_OTHER, size);
+    play_size = fread(play_data, 1, size, f);
+    fclose(f);
+    if (play_size < 8 || memcmp(play_data, RECORD_MAGIC, 8)) {
+        fprintf(stderr, "%s is not a cell recording\n", path);
+        play_close();
+        return 0;
+    }
+
+    /* index the keyframes, only frame headers are read */
+    for (pos = 8; pos + sizeof(h) <= play_size; pos += sizeof(h) + h.len) {
+        memcpy(&h, play_data + pos, sizeof(h));
+        if (pos + sizeof(h) + h.len > play_size) break; /* truncated last frame */
+        duration = h.ts;
+        if (h.type != 'K') continue;
+        if (!(keyframe_count & 255)) {
+            keyframes = x_realloc(ALLOC_OTHER, keyframes, (keyframe_count + 256) * sizeof(*keyframes));
+            keyframe_ts = x_realloc(ALLOC_OTHER, keyframe_ts, (keyframe_count + 256) * sizeof(*keyframe_ts));
+        }
+        keyframes[keyframe_count] = pos;
+        keyframe_ts[keyframe_count++] = h.ts;
+    }
+    play_size = pos;
+    if (!keyframe_count) {
+        fprintf(stderr, "%s has no keyframe\n", path);
+        play_close();
+        return 0;
+    }
+    play_pos = keyframes[0];
+    return 1;
+}
+
+uint64_t play_duration(void) { return duration; }
+
+/*
+ * Rows outside of the current grid (recorded on a bigger screen) are
+ * skipped. Returns 0 if the frame is corrupt, what it applied until then
+ * stays on screen.
+ */
+static int apply(const FrameHeader *h, const uint8_t *p) {
+    static int rec_cols, rec_rows;
+    const uint8_t *end = p + h->len;
+    uint16_t cols, rows, n, y;
+    Line line;
+
+    if (h->type == 'K') {
+        p = get(p, end, &cols, 2);
+        p = get(p, end, &rows, 2);
+        if (!p) return 0;
+        rec_cols = cols, rec_rows = rows;
+        p = get_cursor(p, end);
+        for (y = 0; y < term->row; y++) memset(term->line[y], 0, term->col * sizeof(Glyph));
+        for (y = 0; y < rec_rows && p; y++) p = unpack_row(p, end, y < term->row ? term->line[y] : NULL, term->col, rec_cols);
+        t_full_dirt();
+        return p != NULL;
+    }
+
+    p = get_cursor(p, end);
+    p = get(p, end, &n, 2);
+    while (p && n--) {
+        p = get(p, end, &y, 2);
+        if (!p) break;
+        line = y < term->row ? term->line[y] : NULL;
+        if (line) {
+            memset(line, 0, term->col * sizeof(Glyph));
+            term->dirty[y] = 1;
+        }
+        p = unpack_row(p, end, line, term->col, rec_cols);
+    }
+    return p != NULL;
+}
+
+/* Time of the next frame, without applying it */
+int play_peek(uint64_t *ts) {
+    FrameHeader h;
+
+    if (play_pos + sizeof(h) > play_size) return 0;
+    memcpy(&h, play_data + play_pos, sizeof(h));
+    *ts = h.ts;
+    return 1;
+}
+
+/* Apply the next frame, its time is returned in ts */
+int play_next(uint64_t *ts) {
+    FrameHeader h;
+
+    if (play_pos + sizeof(h) > play_size) return 0;
+    memcpy(&h, play_data + play_pos, sizeof(h));
+    if (!apply(&h, play_data + play_pos + sizeof(h))) {
+        /* playback ends before the corrupt frame, seeks stay before it */
+        fprintf(stderr, "corrupt frame at offset %zu, playback stops there\n", play_pos);
+        play_size = play_pos;
+        while (keyframe_count > 0 && keyframes[keyframe_count - 1] >= play_pos) keyframe_count--;
+        return 0;
+    }
+    play_pos += sizeof(h) + h.len;
+    *ts = h.ts;
+    return 1;
+}
+
+/* Rebuild the grid at ts: the last keyframe at or before it, then the deltas up to it */
+int play_seek(uint64_t ts) {
+    int lo = 0, hi = keyframe_count - 1;
+    uint64_t t;
+
+    if (!keyframe_count) return 0;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (keyframe_ts[mid] <= ts)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    play_pos = keyframes[lo];
+    play_next(&t);
+    while (play_peek(&t) && t <= ts) play_next(&t);
+    return 1;
+}
+
+void play_close(void) {
+    x_free(keyframes);
+    x_free(keyframe_ts);
+    x_free(play_data);
+    keyframes = NULL;
+    keyframe_ts = NULL;
+    play_data = NULL;
+    keyframe_count = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <stdint.h>
+
+/*
+ * Cell level session recording (-record file): the grid, cursor and modes
+ * as periodic keyframes plus per frame deltas of the damaged rows. The
+ * player (-play file) seeks by decoding the last keyframe before the
+ * target and the deltas after it.
+ */
+
+extern int record_enabled;
+
+int record_open(const char *path);
+void record_size(int col, int row);
+void record_frame(void);
+void record_close(void);
+
+int play_open(const char *path);
+uint64_t play_duration(void);
+int play_seek(uint64_t ts);
+int play_peek(uint64_t *ts);
+int play_next(uint64_t *ts);
+void play_close(void);
+
+#endif
@@ -0,0 +1,188 @@
+#include "replay.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+
+/*
+ * Sessions are raw byte captures (-o file) or asciicast v2 (-ofmt cast).
+ * Only output events are replayed; a raw capture is a single event at 0s.
+ */
+
+typedef struct {
+    double time; /* seconds since the start of the recording */
+    size_t off;  /* data in replay_data */
+    size_t len;
+} ReplayEvent;
+
+static char *replay_data;
+static ReplayEvent *events;
+static int event_count, event_next;
+static double speed = 1; /* 0 plays as fast as possible */
+
+static void utf8_put(char **o, unsigned long u) {
+    char *p = *o;
+
+    if (u < 0x80) {
+        *p++ = u;
+    } else if (u < 0x800) {
+        *p++ = 0xC0 | (u >> 6);
+        *p++ = 0x80 | (u & 0x3F);
+    } else if (u < 0x10000) {
+        *p++ = 0xE0 | (u >> 12);
+        *p++ = 0x80 | ((u >> 6) & 0x3F);
+        *p++ = 0x80 | (u & 0x3F);
+    } else {
+        *p++ = 0xF0 | (u >> 18);
+        *p++ = 0x80 | ((u >> 12) & 0x3F);
+        *p++ = 0x80 | ((u >> 6) & 0x3F);
+        *p++ = 0x80 | (u & 0x3F);
+    }
+    *o = p;
+}
+
+/* The 4 hex digits at s, -1 if there are not 4 (the string may end before) */
+static long hex4(const char *s) {
+    long u = 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (!isxdigit((unsigned char)s[i])) return -1;
+        u = u << 4 | (isdigit((unsigned char)s[i]) ? s[i] - '0' : (tolower((unsigned char)s[i]) - 'a' + 10));
+    }
+    return u;
+}
+
+/* Unescape the JSON string starting after the quote at s, in place; returns the end quote, NULL if it is cut */
+static char *json_string(char *s, char **out) {
+    char *o = *out;
+    long u, lo;
+
+    while (*s && *s != '"') {
+        if (*s != '\\') {
+            *o++ = *s++;
+            continue;
+        }
+        switch (*++s) {
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'u':
+                if ((u = hex4(s + 1)) < 0) return NULL;
+                s += 4;
+                if (u >= 0xD800 && u < 0xDC00) { /* a surrogate pair, U+FFFD without its low half */
+                    if (s[1] == '\\' && s[2] == 'u' && (lo = hex4(s + 3)) >= 0xDC00 && lo < 0xE000) {
+                        u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+                        s += 6;
+                    } else {
+                        u = 0xFFFD;
+                    }
+                } else if (u >= 0xDC00 && u < 0xE000) {
+                    u = 0xFFFD;
+                }
+                utf8_put(&o, u);
+                break;
+            case '\0': return NULL;
+            default: *o++ = *s; break; /* \" \\ \/ */
+        }
+        s++;
+    }
+    *out = o;
+    return *s ? s : NULL;
+}
+
+/* Parse asciicast lines like [0.123, "o", "data"] into events, data is unescaped in place */
+static void parse_cast(void) {
+    char *line = strchr(replay_data, '\n'), *next, *o = replay_data, *s;
+    int cap = 0;
+
+    for (; line && *++line; line = next) {
+        double t;
+        char type;
+
+        if ((next = strchr(line, '\n'))) *next = '\0';
+        if (sscanf(line, " [ %lf , \"%c\" ,", &t, &type) != 2 || type != 'o' || !(s = strchr(line, ','))) goto skip;
+        if (!(s = strchr(s + 1, ',')) || !(s = strchr(s, '"'))) goto skip;
+        if (event_count == cap) {
+            cap = cap ? cap * 2 : 1024;
+            events = x_realloc(ALLOC_OTHER, events, cap * sizeof(*events));
+        }
+        events[event_count].time = t;
+        events[event_count].off = o - replay_data;
+        if (!json_string(s + 1, &o)) goto skip;
+        events[event_count].len = o - replay_data - events[event_count].off;
+        event_count++;
+    skip:
+        if (!next) break;
+    }
+}
+
+int replay_open(const char *path) {
+    FILE *f = fopen(path, "rb");
+    long size;
+
+    if (!f) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < 0) {
+        fclose(f);
+        return 0;
+    }
+    replay_data = x_malloc(ALLOC_OTHER, size + 1);
+    size = fread(replay_data, 1, size, f);
+    replay_data[size] = '\0';
+    fclose(f);
+
+    if (size > 0 && replay_data[0] == '{' && strstr(replay_data, "\"version\"") && strchr(replay_data, '\n')) {
+        parse_cast();
+    } else {
+        events = x_malloc(ALLOC_OTHER, sizeof(*events));
+        events[0] = (ReplayEvent){0, 0, size};
+        event_count = 1;
+    }
+    event_next = 0;
+    return 1;
+}
+
+/* realtime, speed=N or max */
+int replay_set_pace(const char *pace) {
+    if (!strcmp(pace, "realtime")) {
+        speed = 1;
+    } else if (!strcmp(pace, "max")) {
+        speed = 0;
+    } else if (!strncmp(pace, "speed=", 6) && atof(pace + 6) > 0) {
+        speed = atof(pace + 6);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Next output event and when it is due, in ns after the start of the replay */
+int replay_next(const char **data, size_t *len, uint64_t *due) {
+    ReplayEvent *e;
+
+    if (event_next >= event_count) return 0;
+    e = &events[event_next++];
+    *data = replay_data + e->off;
+    *len = e->len;
+    *due = speed > 0 ? (uint64_t)(e->time / speed * 1e9) : 0;
+    return 1;
+}
+
+void replay_close(void) {
+    x_free(events);
+    x_free(replay_data);
+    events = NULL;
+    replay_data = NULL;
+    event_count = event_next = 0;
+}
@@ -0,0 +1,13 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Recorded session played back instead of a shell (-replay file) */
+int replay_open(const char *path);
+int replay_set_pace(const char *pace);
+int replay_next(const char **data, size_t *len, uint64_t *due);
+void replay_close(void);
+
+#endif
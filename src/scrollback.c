@@ -0,0 +1,1121 @@
+#include "scrollback.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "cpu.h"
+
+#define SB_LINE_MAX (SB_BLOCK_SIZ / 4) /* encoded line */
+#define SB_CELL_MAX 12                 /* encoded cell: run header and a 4 byte character */
+#define SB_PACK_SIZ (SB_BLOCK_SIZ + SB_BLOCK_SIZ / 255 + 16)
+#define SB_ROWS_MAX 2048 /* rows of a block rewrapped to another width, the rest is cut */
+#define SB_BLOOM_SIZ 512 /* trigram bloom filter stored before each block */
+#define SB_BLOOM_LOG 12  /* log2 of its bits */
+#define SB_TEXT_SIZ (2 * SB_BLOCK_SIZ)
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define SPILL_CHUNK (4 << 20) /* mapped at once, blocks do not straddle chunks */
+#define SPILL_MAPPED 4         /* chunks mapped at a time */
+#define SPILL_BLOCKS_MAX (1 << 20)
+
+typedef struct {
+    int64_t first; /* number of its first line */
+    uint64_t off;  /* in the ring or the spill file */
+    uint32_t len;  /* stored bytes: the bloom filter, then the lines */
+    uint32_t raw;  /* decompressed bytes, len == SB_BLOOM_SIZ + raw when stored uncompressed */
+    int nlines;
+    uint16_t maxcells;  /* of the longest line */
+    int16_t wrapcols;   /* width soft wrapped lines were cut at, 0 for none, -1 if several */
+    uint16_t rows_cols; /* width rows was counted for, main thread only */
+    uint32_t rows;
+} SbBlock;
+
+/* Where the last row_back() lookup ended: block i, after above newer rows */
+typedef struct {
+    int64_t pushed;
+    int cols, nblocks, i, above;
+} SbWalk;
+
+/* Rows of a block rewrapped to cols: where each starts in its logical line */
+typedef struct {
+    int64_t first;
+    int nlines, cols, nrows;
+    struct {
+        uint16_t line; /* first line of the logical line */
+        uint32_t off;  /* in cells */
+    } row[SB_ROWS_MAX];
+} SbLayout;
+
+typedef struct {
+    int64_t first; /* block held, -1 for none */
+    uint8_t *raw;
+    uint32_t len;
+    int nlines;
+    uint16_t off[SB_BLOCK_LINES]; /* of each line in raw */
+    unsigned stamp;               /* last use, for LRU */
+    SbLayout view;                /* main thread only */
+} SbCache;
+
+/* Blocks dropped from the ring, appended to a file and mapped back when read */
+typedef struct {
+    int fd;
+    char path[PATH_MAX];
+    uint64_t size, limit;
+    SbBlock *blocks; /* reserved address space, touched as it fills */
+    int bcap, nblocks;
+    uint8_t **map;            /* per chunk, main thread only */
+    int mapped[SPILL_MAPPED]; /* chunks mapped, unmapped round robin */
+    int next;
+} SbSpill;
+
+struct Scrollback {
+    uint8_t *ring;
+    size_t size, head;
+    SbBlock *blocks; /* circular, oldest at bfirst */
+    int bcap, bfirst, nblocks;
+    SbCache hot;               /* block being filled, tty thread only */
+    uint8_t *hot_bloom;        /* its bloom filter, hot.raw follows it */
+    uint32_t hot_win;          /* last bytes of a soft wrapped line, for trigrams over the wrap */
+    uint16_t hot_maxcells;     /* SbBlock stats of the hot block */
+    int16_t hot_wrapcols;
+    int hot_wrapped;           /* its last line continues in the next one */
+    int cols;                  /* width all lines were pushed at, 0 for none yet, -1 if several */
+    SbWalk walk;               /* main thread only */
+    SbCache cache[SB_CACHE];   /* main thread only */
+    SbCache reader;            /* sb_read() thread only */
+    uint8_t *reader_pack;      /* stored bytes of a spilled block it reads */
+    SbSpill *spill;            /* NULL unless sb_spill() */
+    struct {
+        SbBlock *blocks; /* in a mapped snapshot, see sb_restore() */
+        const uint8_t *data;
+        int nblocks;
+    } saved;
+    unsigned clock;
+    int64_t pushed;            /* lines pushed since sb_clear() */
+    uint8_t pack[SB_PACK_SIZ]; /* compressor output */
+    uint16_t lz_table[1 << LZ_HASH_BITS];
+    char text[SB_TEXT_SIZ];    /* of the block searched, main thread only */
+    uint32_t text_line[SB_BLOCK_LINES + 1];
+};
+
+#define BLOCK(sb, i) (&(sb)->blocks[((sb)->bfirst + (i)) % (sb)->bcap])
+
+static void put16(uint8_t *p, unsigned v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static unsigned get16(const uint8_t *p) { return p[0] | p[1] << 8; }
+
+static uint32_t get32(const uint8_t *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/*
+ * LZ77 in the LZ4 block layout: a token with the literal count in the high
+ * and the match length - 4 in the low nibble (15 continues in 255 bytes),
+ * the literals, a 16 bit offset. The last sequence has no match. Blocks are
+ * at most 32K so offsets and hash table positions fit 16 bits.
+ */
+static uint8_t *lz_put_len(uint8_t *op, size_t n) {
+    for (n -= 15; n >= 255; n -= 255) *op++ = 255;
+    *op++ = n;
+    return op;
+}
+
+static size_t lz_compress(uint16_t *table, const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src + 1, *anchor = src, *end = src + n;
+    uint8_t *op = dst, *oend = dst + cap, *token;
+    size_t lit, mlen;
+
+    memset(table, 0, sizeof(uint16_t) << LZ_HASH_BITS);
+    while (ip + LZ_MIN_MATCH <= end) {
+        uint32_t seq = get32(ip), h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const uint8_t *ref = src + table[h], *p, *q;
+
+        table[h] = ip - src;
+        if (get32(ref) != seq || ref >= ip) {
+            ip += 1 + ((ip - anchor) >> 5); /* skip faster through incompressible data */
+            continue;
+        }
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) ip--, ref--;
+        for (p = ip + LZ_MIN_MATCH, q = ref + LZ_MIN_MATCH; p < end && *p == *q; p++, q++);
+
+        lit = ip - anchor;
+        mlen = p - ip - LZ_MIN_MATCH;
+        if (op + lit + lit / 255 + mlen / 255 + 5 > oend) return 0;
+        token = op++;
+        *token = (lit < 15 ? lit : 15) << 4 | (mlen < 15 ? mlen : 15);
+        if (lit >= 15) op = lz_put_len(op, lit);
+        memcpy(op, anchor, lit);
+        op += lit;
+        put16(op, ip - ref);
+        op += 2;
+        if (mlen >= 15) op = lz_put_len(op, mlen);
+        ip = anchor = p;
+    }
+
+    lit = end - anchor;
+    if (op + lit + lit / 255 + 2 > oend) return 0;
+    *op++ = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15) op = lz_put_len(op, lit);
+    memcpy(op, anchor, lit);
+    return op + lit - dst;
+}
+
+/* Returns the decompressed size, 0 on corrupt input */
+static size_t lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    const uint8_t *ip = src, *iend = src + n, *ref;
+    uint8_t *op = dst, *oend = dst + cap;
+    size_t lit, mlen, off;
+    unsigned b;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        if ((lit = token >> 4) == 15) {
+            do {
+                if (ip >= iend) return 0;
+                lit += b = *ip++;
+            } while (b == 255);
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return 0;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break; /* last sequence */
+
+        if (iend - ip < 2) return 0;
+        off = get16(ip);
+        ip += 2;
+        if ((mlen = token & 15) == 15) {
+            do {
+                if (ip >= iend) return 0;
+                mlen += b = *ip++;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (!off || off > (size_t)(op - dst) || mlen > (size_t)(oend - op)) return 0;
+        ref = op - off;
+        if (off >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *ref++; /* overlapping, repeats the last off bytes */
+        }
+    }
+    return op - dst;
+}
+
+/*
+ * Encoded line: <u16 length> and runs of <u16 cells> <mode> <u16 fg>
+ * <u16 bg> <set>, followed by the UTF-8 of every cell if set. Unset cells
+ * are not drawn, so their attributes and characters are dropped.
+ */
+static size_t line_encode(const Glyph *line, int cols, uint8_t *out, int *cells, int *wrap) {
+    uint8_t *p = out + 2, *run;
+    const Glyph *g, *c;
+    int x = 0, start, end = MIN(cols, (SB_LINE_MAX - 2) / SB_CELL_MAX);
+
+    while (end > 0 && !(line[end - 1].state & GLYPH_SET)) end--;
+    *cells = end;
+    *wrap = end > 0 && (line[end - 1].mode & ATTR_WRAP);
+    while (x < end) {
+        g = &line[x];
+        run = p;
+        p += 8;
+        start = x;
+        if (!(g->state & GLYPH_SET)) {
+            while (x < end && !(line[x].state & GLYPH_SET)) x++;
+            memset(run + 2, 0, 6);
+        } else {
+            for (c = g; x < end && (c->state & GLYPH_SET) && !ATTRCMP(*c, *g); c = &line[++x]) {
+                if (!(c->c[0] & 0x80)) {
+                    *p++ = c->c[0];
+                } else {
+                    int l = utf8_size((char *)c->c);
+                    memcpy(p, c->c, l);
+                    p += l;
+                }
+            }
+            run[2] = g->mode;
+            put16(run + 3, g->fg);
+            put16(run + 5, g->bg);
+            run[7] = 1;
+        }
+        put16(run, x - start);
+    }
+    put16(out, p - out - 2);
+    return p - out;
+}
+
+/*
+ * Walk an encoded line: copy its cells [skip, skip + n) to dst if not NULL
+ * and return its cell count. *wrap tells if it is soft wrapped.
+ */
+static int line_walk(const uint8_t *p, const uint8_t *limit, int skip, Glyph *dst, int n, int *wrap) {
+    const uint8_t *end = p + 2 + get16(p);
+    Glyph g;
+    int x = 0, cells, l, in;
+
+    *wrap = 0;
+    if (end > limit) end = p;
+    for (p += 2; p + 8 <= end;) {
+        cells = get16(p);
+        memset(&g, 0, sizeof(g));
+        g.mode = p[2];
+        g.fg = get16(p + 3);
+        g.bg = get16(p + 5);
+        g.state = p[7];
+        p += 8;
+        *wrap = g.state && (g.mode & ATTR_WRAP);
+        for (; cells > 0; cells--, x++) {
+            in = dst && x >= skip && x - skip < n;
+            if (g.state) {
+                l = utf8_size((char *)p);
+                if (p + l > end) return x;
+                if (in) {
+                    memset(g.c, 0, UTF_SIZ);
+                    memcpy(g.c, p, l);
+                }
+                p += l;
+            }
+            if (in) dst[x - skip] = g;
+        }
+    }
+    return x;
+}
+
+static inline int fold(int c) { return c >= 'A' && c <= 'Z' ? c + 32 : c; }
+
+static inline unsigned bloom_bit(uint32_t tri) { return (tri * 2654435761u) >> (32 - SB_BLOOM_LOG); }
+
+/*
+ * Add the trigrams of a line's text to bloom: its cells as UTF-8, unset
+ * ones as spaces, ASCII case folded. *win holds the last bytes seen.
+ */
+static void bloom_add(uint8_t *bloom, uint32_t *win, const Glyph *line, int cells) {
+    uint32_t w = *win;
+    unsigned bit;
+    int l, i;
+
+    for (const Glyph *g = line; g < line + cells; g++) {
+        l = g->state & GLYPH_SET && g->c[0] & 0x80 ? utf8_size((char *)g->c) : 1;
+        for (i = 0; i < l; i++) {
+            w = w << 8 | (g->state & GLYPH_SET ? fold((uint8_t)g->c[i]) : ' ');
+            bit = bloom_bit(w & 0xFFFFFF);
+            bloom[bit >> 3] |= 1 << (bit & 7);
+        }
+    }
+    *win = w;
+}
+
+/* Whether q (m bytes, folded) may be in the block with this bloom filter */
+static int bloom_may(const uint8_t *bloom, const char *q, size_t m) {
+    unsigned bit;
+
+    for (size_t i = 2; i < m; i++) {
+        bit = bloom_bit((uint8_t)q[i - 2] << 16 | (uint8_t)q[i - 1] << 8 | (uint8_t)q[i]);
+        if (!(bloom[bit >> 3] & 1 << (bit & 7))) return 0;
+    }
+    return 1;
+}
+
+/*
+ * The text of c as bloom_add() sees it, soft wrapped lines joined and a
+ * newline after each logical line, into sb->text; sb->text_line[i] is
+ * where line i starts. Lines past SB_TEXT_SIZ are left out.
+ */
+static size_t block_text(Scrollback *sb, const SbCache *c) {
+    const uint8_t *limit = c->raw + SB_BLOCK_SIZ, *p, *end;
+    char *t = sb->text, *tend = sb->text + SB_TEXT_SIZ - 1;
+    int i, cells, l, set, wrap;
+
+    for (i = 0; i < c->nlines; i++) {
+        sb->text_line[i] = t - sb->text;
+        p = c->raw + c->off[i];
+        end = p + 2 + get16(p);
+        if (end > limit) end = p;
+        for (p += 2, wrap = 0; p + 8 <= end;) {
+            cells = get16(p);
+            set = p[7];
+            wrap = set && (p[2] & ATTR_WRAP);
+            p += 8;
+            if (!set) {
+                if (cells > tend - t) break;
+                memset(t, ' ', cells);
+                t += cells;
+                continue;
+            }
+            for (; cells > 0 && p < end; cells--, p += l) {
+                l = *p & 0x80 ? utf8_size((char *)p) : 1;
+                if (p + l > end || t + l > tend) break;
+                memcpy(t, p, l);
+                t += l;
+            }
+        }
+        if (!wrap || i + 1 == c->nlines) *t++ = '\n';
+        if (t >= tend) break;
+    }
+    for (; i <= c->nlines; i++) sb->text_line[i] = t - sb->text;
+    return t - sb->text;
+}
+
+static void spill_reset(SbSpill *s) {
+    s->nblocks = 0;
+    s->size = 0;
+}
+
+/* Append a block dropped from the ring. When full, the spill starts over: returns 1 if older blocks were lost */
+static int spill_put(SbSpill *s, const SbBlock *b, const uint8_t *data) {
+    uint64_t off = s->size;
+    SbBlock *d;
+    int lost = 0;
+
+    if (off % SPILL_CHUNK + b->len > SPILL_CHUNK) off += SPILL_CHUNK - off % SPILL_CHUNK;
+    if (off + b->len > s->limit || s->nblocks == s->bcap) {
+        spill_reset(s);
+        off = 0;
+        lost = 1;
+    }
+    /* blocks of a previous run stay in the file, so it never shrinks under a mapping */
+    if (pwrite(s->fd, data, b->len, off) != (ssize_t)b->len) {
+        fprintf(stderr, "Error writing %s:%s\n", s->path, strerror(errno));
+        spill_reset(s);
+        return 1;
+    }
+    d = &s->blocks[s->nblocks];
+    *d = *b;
+    d->off = off;
+    s->size = off + b->len;
+    __atomic_store_n(&s->nblocks, s->nblocks + 1, __ATOMIC_RELEASE);
+    return lost;
+}
+
+/* Map the chunk holding b, NULL on failure */
+static const uint8_t *spill_data(SbSpill *s, const SbBlock *b) {
+    int chunk = b->off / SPILL_CHUNK, old;
+
+    if (chunk >= s->limit / SPILL_CHUNK + 1) return NULL;
+    if (!s->map[chunk]) {
+        if ((old = s->mapped[s->next]) >= 0) {
+            munmap(s->map[old], SPILL_CHUNK);
+            s->map[old] = NULL;
+        }
+        s->map[chunk] = mmap(NULL, SPILL_CHUNK, PROT_READ, MAP_SHARED, s->fd, (off_t)chunk * SPILL_CHUNK);
+        if (s->map[chunk] == MAP_FAILED) {
+            s->map[chunk] = NULL;
+            s->mapped[s->next] = -1;
+            return NULL;
+        }
+        s->mapped[s->next] = chunk;
+        s->next = (s->next + 1) % SPILL_MAPPED;
+    }
+    return s->map[chunk] + b->off % SPILL_CHUNK;
+}
+
+static void drop_oldest(Scrollback *sb) {
+    /* restored history is older, it goes with the first block lost */
+    if (!sb->spill || spill_put(sb->spill, BLOCK(sb, 0), sb->ring + BLOCK(sb, 0)->off)) sb->saved.nblocks = 0;
+    sb->bfirst = (sb->bfirst + 1) % sb->bcap;
+    sb->nblocks--;
+}
+
+/* Room for len bytes at the ring head, dropping the oldest blocks in the way */
+static size_t reserve(Scrollback *sb, size_t len) {
+    size_t at, tail;
+
+    for (;;) {
+        if (!sb->nblocks) {
+            at = 0;
+            break;
+        }
+        tail = BLOCK(sb, 0)->off;
+        if (tail < sb->head) {
+            /* used [tail, head), free after head and before tail */
+            if (sb->head + len <= sb->size) {
+                at = sb->head;
+                break;
+            }
+            if (len <= tail) {
+                at = 0;
+                break;
+            }
+        } else if (sb->head + len <= tail) {
+            /* wrapped, free [head, tail) */
+            at = sb->head;
+            break;
+        }
+        drop_oldest(sb);
+    }
+    sb->head = at + len;
+    return at;
+}
+
+static void seal(Scrollback *sb) {
+    SbCache *h = &sb->hot;
+    SbBlock *b;
+    const uint8_t *data = sb->pack;
+    size_t len = lz_compress(sb->lz_table, h->raw, h->len, sb->pack, sizeof(sb->pack));
+
+    if (!len || len >= h->len) {
+        data = h->raw;
+        len = h->len;
+    }
+    if (sb->nblocks == sb->bcap) drop_oldest(sb);
+    b = BLOCK(sb, sb->nblocks);
+    b->off = reserve(sb, SB_BLOOM_SIZ + len);
+    memcpy(sb->ring + b->off, sb->hot_bloom, SB_BLOOM_SIZ);
+    memcpy(sb->ring + b->off + SB_BLOOM_SIZ, data, len);
+    b->first = h->first;
+    b->len = SB_BLOOM_SIZ + len;
+    b->raw = h->len;
+    b->nlines = h->nlines;
+    b->maxcells = sb->hot_maxcells;
+    b->wrapcols = sb->hot_wrapcols;
+    b->rows_cols = b->rows = 0;
+    sb->nblocks++;
+
+    h->first += h->nlines;
+    h->len = 0;
+    h->nlines = 0;
+    sb->hot_maxcells = 0;
+    sb->hot_wrapcols = 0;
+    memset(sb->hot_bloom, 0, SB_BLOOM_SIZ);
+}
+
+void sb_push(Scrollback *sb, const Glyph *line, int cols) {
+    SbCache *h = &sb->hot;
+    int cells, wrap;
+
+    /* prefer sealing between logical lines, a wrapped one split over two blocks rewraps as two */
+    if (h->nlines == SB_BLOCK_LINES || h->len + SB_LINE_MAX > SB_BLOCK_SIZ ||
+        (!sb->hot_wrapped && (h->nlines >= SB_BLOCK_LINES * 3 / 4 || h->len >= SB_BLOCK_SIZ / 2 + SB_BLOCK_SIZ / 4)))
+        seal(sb);
+    h->off[h->nlines] = h->len;
+    h->len += line_encode(line, cols, h->raw + h->len, &cells, &wrap);
+    h->nlines++;
+    sb->pushed++;
+
+    sb->hot_maxcells = MAX(sb->hot_maxcells, cells);
+    if (wrap) sb->hot_wrapcols = !sb->hot_wrapcols || sb->hot_wrapcols == cells ? cells : -1;
+    sb->hot_wrapped = wrap;
+    bloom_add(sb->hot_bloom, &sb->hot_win, line, cells);
+    if (!wrap) sb->hot_win = 0;
+    if (sb->cols != cols) sb->cols = sb->cols ? -1 : cols;
+}
+
+int sb_count(Scrollback *sb) {
+    if (sb->saved.nblocks) return sb->pushed - sb->saved.blocks[0].first;
+    if (sb->spill && sb->spill->nblocks) return sb->pushed - sb->spill->blocks[0].first;
+    return sb->pushed - (sb->nblocks ? BLOCK(sb, 0)->first : sb->hot.first);
+}
+
+/* Last of the n blocks from first in the circular array starting at or before line */
+static SbBlock *find(SbBlock *blocks, int first, int n, int cap, int64_t line) {
+    int lo = 0, hi = n - 1, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (blocks[(first + mid) % cap].first <= line) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return &blocks[(first + lo) % cap];
+}
+
+/* Decompress the lines of b (stored bytes after its bloom filter) into c. Returns 0 on corrupt input */
+static int unpack(SbCache *c, const SbBlock *b, const uint8_t *lines) {
+    size_t len;
+    int i;
+    uint32_t off;
+
+    c->first = -1;
+    c->view.cols = 0;
+    if (b->len - SB_BLOOM_SIZ == b->raw) {
+        memcpy(c->raw, lines, len = MIN(b->raw, SB_BLOCK_SIZ));
+    } else {
+        len = lz_decompress(lines, b->len - SB_BLOOM_SIZ, c->raw, SB_BLOCK_SIZ);
+    }
+    if (len != b->raw || b->nlines > SB_BLOCK_LINES) return 0;
+    for (i = 0, off = 0; i < b->nlines && off + 2 <= len; i++) {
+        c->off[i] = off;
+        off += 2 + get16(c->raw + off);
+    }
+    c->len = len;
+    c->nlines = i;
+    c->first = b->first;
+    return 1;
+}
+
+static SbCache *load(Scrollback *sb, const SbBlock *b, const uint8_t *data) {
+    SbCache *c = &sb->cache[0];
+
+    for (int i = 0; i < SB_CACHE; i++) {
+        if (sb->cache[i].first == b->first) {
+            c = &sb->cache[i];
+            c->stamp = ++sb->clock;
+            return c;
+        }
+        if (sb->cache[i].stamp < c->stamp) c = &sb->cache[i];
+    }
+    if (!unpack(c, b, data + SB_BLOOM_SIZ)) return NULL;
+    c->stamp = ++sb->clock;
+    return c;
+}
+
+/* Blocks before the hot one, oldest first: restored, spilled, then in the ring */
+static int desc_count(Scrollback *sb) {
+    return sb->saved.nblocks + (sb->spill ? __atomic_load_n(&sb->spill->nblocks, __ATOMIC_ACQUIRE) : 0) + sb->nblocks;
+}
+
+static SbBlock *desc_at(Scrollback *sb, int i) {
+    int spilled = sb->spill ? sb->spill->nblocks : 0;
+
+    if (i < sb->saved.nblocks) return &sb->saved.blocks[i];
+    i -= sb->saved.nblocks;
+    if (i < spilled) return &sb->spill->blocks[i];
+    return BLOCK(sb, i - spilled);
+}
+
+/* Stored bytes of block i, NULL if they cannot be mapped */
+static const uint8_t *desc_data(Scrollback *sb, int i, const SbBlock *b) {
+    if (i < sb->saved.nblocks) return sb->saved.data + b->off;
+    if (i < sb->saved.nblocks + (sb->spill ? sb->spill->nblocks : 0)) return spill_data(sb->spill, b);
+    return sb->ring + b->off;
+}
+
+static SbCache *desc_load(Scrollback *sb, int i, const SbBlock *b) {
+    const uint8_t *data = desc_data(sb, i, b);
+
+    return data ? load(sb, b, data) : NULL;
+}
+
+/* Whether a block's lines are its rows at width cols */
+static int identity(int maxcells, int wrapcols, int cols) {
+    return maxcells <= cols && (!wrapcols || wrapcols == cols);
+}
+
+/* Cut the logical lines of c into rows of cols cells */
+static SbLayout *layout(SbCache *c, int cols) {
+    SbLayout *v = &c->view;
+    int i = 0, start, wrap, n = 0;
+    uint32_t cells, off;
+
+    if (v->first == c->first && v->nlines == c->nlines && v->cols == cols) return v;
+    while (i < c->nlines) {
+        start = i;
+        cells = 0;
+        do {
+            cells += line_walk(c->raw + c->off[i++], c->raw + SB_BLOCK_SIZ, 0, NULL, 0, &wrap);
+        } while (wrap && i < c->nlines);
+        off = 0;
+        do {
+            if (n < SB_ROWS_MAX) {
+                v->row[n].line = start;
+                v->row[n++].off = off;
+            }
+            off += cols;
+        } while (off < cells);
+    }
+    v->first = c->first;
+    v->nlines = c->nlines;
+    v->cols = cols;
+    v->nrows = n;
+    return v;
+}
+
+/*
+ * Decode row r of c at width cols. Interior wrap marks are dropped, the
+ * last cell of a row that continues gets one; a blank there becomes a
+ * space so the mark counts.
+ */
+static void row_decode(SbCache *c, int r, int cols, Glyph *dst, int same) {
+    const uint8_t *limit = c->raw + SB_BLOCK_SIZ;
+    SbLayout *v;
+    uint32_t off;
+    int i, x = 0, cells, used, wrap, more = 0;
+
+    if (same) {
+        cells = line_walk(c->raw + c->off[r], limit, 0, dst, cols, &wrap);
+        if (cells < cols) memset(dst + MAX(cells, 0), 0, (cols - MAX(cells, 0)) * sizeof(Glyph));
+        return;
+    }
+    v = layout(c, cols);
+    i = v->row[r].line;
+    off = v->row[r].off;
+    for (; i < c->nlines; i++) {
+        cells = line_walk(c->raw + c->off[i], limit, off, dst + x, cols - x, &wrap);
+        used = (uint32_t)cells > off ? MIN(cells - (int)off, cols - x) : 0;
+        more = (uint32_t)cells > off + used || (wrap && i + 1 < c->nlines);
+        off = (uint32_t)cells > off ? 0 : off - cells;
+        x += used;
+        if (!wrap || x == cols) break;
+    }
+    for (i = 0; i < x; i++) dst[i].mode &= ~ATTR_WRAP;
+    if (x < cols) memset(dst + x, 0, (cols - x) * sizeof(Glyph));
+    if (more) {
+        if (!(dst[cols - 1].state & GLYPH_SET)) {
+            dst[cols - 1].c[0] = ' ';
+            dst[cols - 1].state = GLYPH_SET;
+        }
+        dst[cols - 1].mode |= ATTR_WRAP;
+    }
+}
+
+/*
+ * Rows of history at width cols. Blocks not rewrapped yet count as many as
+ * they could have, so scrolling reaches them; the count shrinks as they
+ * are viewed.
+ */
+int sb_rows(Scrollback *sb, int cols) {
+    SbBlock *b;
+    int rows, n = desc_count(sb);
+
+    if (sb->cols == cols || !sb->cols) return sb_count(sb);
+    rows = identity(sb->hot_maxcells, sb->hot_wrapcols, cols) ? sb->hot.nlines : layout(&sb->hot, cols)->nrows;
+    for (int i = 0; i < n; i++) {
+        b = desc_at(sb, i);
+        if (identity(b->maxcells, b->wrapcols, cols)) {
+            rows += b->nlines;
+        } else if (b->rows_cols == cols) {
+            rows += b->rows;
+        } else {
+            rows += MIN(b->nlines * MAX((b->maxcells + cols - 1) / cols, 1), SB_ROWS_MAX);
+        }
+    }
+    return rows;
+}
+
+/* Rows of block i at width cols, i == nb for the hot block. Sets *c when it had to be read, -1 on errors */
+static int block_rows(Scrollback *sb, int i, int nb, int cols, SbCache **c, int *same) {
+    SbBlock *b;
+
+    *c = NULL;
+    if (i == nb) {
+        *c = &sb->hot;
+        return (*same = identity(sb->hot_maxcells, sb->hot_wrapcols, cols)) ? sb->hot.nlines : layout(&sb->hot, cols)->nrows;
+    }
+    b = desc_at(sb, i);
+    if ((*same = identity(b->maxcells, b->wrapcols, cols))) return b->nlines;
+    if (b->rows_cols == cols) return b->rows;
+    if (!(*c = desc_load(sb, i, b))) return -1;
+    b->rows = layout(*c, cols)->nrows;
+    b->rows_cols = cols;
+    return b->rows;
+}
+
+/*
+ * sb_line() when lines were pushed at other widths: count rows back from
+ * the newest block, or from the block of the last lookup as a frame asks
+ * for neighbouring rows.
+ */
+static int row_back(Scrollback *sb, int n, Glyph *dst, int cols) {
+    SbWalk *w = &sb->walk;
+    SbCache *c;
+    int nb = desc_count(sb), i = nb, above = 0, rows, same;
+
+    if (w->pushed == sb->pushed && w->cols == cols && w->nblocks == nb) {
+        i = w->i;
+        above = w->above;
+    }
+    while (n <= above) {
+        if ((rows = block_rows(sb, ++i, nb, cols, &c, &same)) < 0) return 0;
+        above -= rows;
+    }
+    for (;;) {
+        if ((rows = block_rows(sb, i, nb, cols, &c, &same)) < 0) return 0;
+        if (n - above <= rows) break;
+        if (i == 0) return 0;
+        above += rows;
+        i--;
+    }
+    *w = (SbWalk){sb->pushed, cols, nb, i, above};
+    if (!c && !(c = desc_load(sb, i, desc_at(sb, i)))) return 0;
+    if (rows - (n - above) >= (same ? c->nlines : layout(c, cols)->nrows)) return 0;
+    row_decode(c, rows - (n - above), cols, dst, same);
+    return 1;
+}
+
+int sb_line(Scrollback *sb, int n, Glyph *dst, int cols) {
+    int64_t line = sb->pushed - n;
+    SbCache *c;
+    const SbBlock *b;
+    const uint8_t *data;
+    SbSpill *s = sb->spill;
+
+    if (n < 1) return 0;
+    if (sb->cols != cols && sb->cols) return row_back(sb, n, dst, cols);
+    if (n > sb_count(sb)) return 0;
+    if (line >= sb->hot.first) {
+        c = &sb->hot;
+    } else if (sb->nblocks && line >= BLOCK(sb, 0)->first) {
+        b = find(sb->blocks, sb->bfirst, sb->nblocks, sb->bcap, line);
+        if (!(c = load(sb, b, sb->ring + b->off))) return 0;
+    } else if (s && s->nblocks && line >= s->blocks[0].first) {
+        b = find(s->blocks, 0, __atomic_load_n(&s->nblocks, __ATOMIC_ACQUIRE), s->bcap, line);
+        if (!(data = spill_data(s, b)) || !(c = load(sb, b, data))) return 0;
+    } else if (sb->saved.nblocks) {
+        b = find(sb->saved.blocks, 0, sb->saved.nblocks, sb->saved.nblocks, line);
+        if (!(c = load(sb, b, sb->saved.data + b->off))) return 0;
+    } else {
+        return 0;
+    }
+    if (line - c->first >= c->nlines) return 0;
+    row_decode(c, line - c->first, cols, dst, 1);
+    return 1;
+}
+
+int64_t sb_end(Scrollback *sb) { return sb->pushed; }
+
+/* Index of the block holding line, nb for the hot block, -1 if it is older than history */
+static int block_of(Scrollback *sb, int64_t line, int nb) {
+    int lo = 0, hi = nb - 1, mid;
+
+    if (line >= sb->hot.first) return nb;
+    if (!nb || line < desc_at(sb, 0)->first) return -1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (desc_at(sb, mid)->first <= line) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+int sb_find(Scrollback *sb, const char *q, int older, int64_t *line, int *cell, int limit) {
+    size_t m = strlen(q), len, at, off, k;
+    int nb = desc_count(sb), i = block_of(sb, *line, nb), li, x, bx = 0, budget = limit * 64;
+    int64_t id, best;
+    const uint8_t *data;
+    SbBlock *b;
+    SbCache *c;
+
+    if (!m || (i < 0 && older)) return 0;
+    for (i = MAX(i, 0); i >= 0 && i <= nb; i += older ? -1 : 1) {
+        b = i < nb ? desc_at(sb, i) : NULL;
+        if (budget <= 0) {
+            /* go on from block i next time */
+            *line = b ? (older ? b->first + b->nlines - 1 : b->first) : sb->hot.first;
+            *cell = older ? INT_MAX : -1;
+            return -1;
+        }
+        /* a filter may have to be mapped in from the spill, a 64th of a block read */
+        budget--;
+        if (b && (!(data = desc_data(sb, i, b)) || !bloom_may(data, q, m))) continue;
+        if (!(c = b ? desc_load(sb, i, b) : &sb->hot)) continue;
+        budget -= 64;
+
+        /* matches come in order: keep the last before the position, or the first after it */
+        len = block_text(sb, c);
+        best = -1;
+        for (off = 0, li = 0; (at = off + cpu_find(sb->text + off, len - off, q, m)) < len; off = at + 1) {
+            while (li + 1 < c->nlines && sb->text_line[li + 1] <= at) li++;
+            for (x = 0, k = sb->text_line[li]; k < at; k++) x += ((uint8_t)sb->text[k] & 0xC0) != 0x80;
+            id = c->first + li;
+            if (older ? id > *line || (id == *line && x >= *cell) : id < *line || (id == *line && x <= *cell)) {
+                if (older) break;
+                continue;
+            }
+            best = id;
+            bx = x;
+            if (!older) break;
+        }
+        if (best >= 0) {
+            *line = best;
+            *cell = bx;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Cells of line i of c, *wrap if it is soft wrapped */
+static int line_cells(const SbCache *c, int i, int *wrap) {
+    return line_walk(c->raw + c->off[i], c->raw + SB_BLOCK_SIZ, 0, NULL, 0, wrap);
+}
+
+int sb_row_of(Scrollback *sb, int64_t line, int cell, int cols, int *x) {
+    int nb = desc_count(sb), i = block_of(sb, line, nb), above = 0, rows, same, li, s, r, wrap;
+    uint32_t off;
+    SbLayout *v;
+    SbCache *c;
+
+    if (i < 0 || line >= sb->pushed) return 0;
+    if (sb->cols == cols || !sb->cols) {
+        *x = cell;
+        return sb->pushed - line;
+    }
+    for (int k = nb; k > i; k--) {
+        if ((rows = block_rows(sb, k, nb, cols, &c, &same)) < 0) return 0;
+        above += rows;
+    }
+    if ((rows = block_rows(sb, i, nb, cols, &c, &same)) < 0) return 0;
+    li = line - (i < nb ? desc_at(sb, i)->first : sb->hot.first);
+    if (same) {
+        *x = cell;
+        return above + rows - li;
+    }
+    if (!c && !(c = desc_load(sb, i, desc_at(sb, i)))) return 0;
+    if (li >= c->nlines) return 0;
+    /* the cell counted from the start of its logical line */
+    for (s = li, off = cell; s > 0 && (line_cells(c, s - 1, &wrap), wrap); s--) off += line_cells(c, s - 1, &wrap);
+    v = layout(c, cols);
+    for (r = v->nrows - 1; r > 0 && (v->row[r].line > s || (v->row[r].line == s && v->row[r].off > off)); r--);
+    *x = off - v->row[r].off;
+    return above + v->nrows - r;
+}
+
+int64_t sb_start(Scrollback *sb) { return sb->pushed - sb_count(sb); }
+
+/* Block i of the history into the reader, copied out first: the index may change under it */
+static SbCache *reader_load(Scrollback *sb, int i) {
+    SbCache *c = &sb->reader;
+    SbBlock b = *desc_at(sb, i);
+    const uint8_t *lines;
+    int spilled = sb->spill ? __atomic_load_n(&sb->spill->nblocks, __ATOMIC_ACQUIRE) : 0;
+
+    if (c->first == b.first && c->nlines == b.nlines) return c;
+    if (b.len < SB_BLOOM_SIZ || b.len - SB_BLOOM_SIZ > SB_PACK_SIZ) return NULL;
+    if (i < sb->saved.nblocks) {
+        lines = sb->saved.data + b.off + SB_BLOOM_SIZ;
+    } else if (i < sb->saved.nblocks + spilled) {
+        /* the spill mappings belong to the main thread */
+        if (pread(sb->spill->fd, sb->reader_pack, b.len - SB_BLOOM_SIZ, b.off + SB_BLOOM_SIZ) != (ssize_t)(b.len - SB_BLOOM_SIZ)) return NULL;
+        lines = sb->reader_pack;
+    } else {
+        if (b.off + b.len > sb->size) return NULL;
+        lines = sb->ring + b.off + SB_BLOOM_SIZ;
+    }
+    return unpack(c, &b, lines) ? c : NULL;
+}
+
+int sb_read(Scrollback *sb, int64_t line, Glyph *dst, int cols, int *wrap) {
+    const SbCache *h = &sb->hot;
+    int64_t first = __atomic_load_n(&h->first, __ATOMIC_ACQUIRE);
+    int nb, i, n;
+    SbCache *c;
+
+    *wrap = 0;
+    if (line < sb_start(sb) || line >= sb->pushed) return -1;
+    if (line >= first) {
+        /* complete lines of the block being filled do not change until it is sealed */
+        if (line - first >= h->nlines) return -1;
+        n = line_walk(h->raw + h->off[line - first], h->raw + SB_BLOCK_SIZ, 0, dst, cols, wrap);
+        return __atomic_load_n(&h->first, __ATOMIC_ACQUIRE) == first ? n : sb_read(sb, line, dst, cols, wrap);
+    }
+    nb = desc_count(sb);
+    if ((i = block_of(sb, line, nb)) < 0 || i == nb || !(c = reader_load(sb, i)) || line - c->first >= c->nlines) return -1;
+    n = line_walk(c->raw + c->off[line - c->first], c->raw + SB_BLOCK_SIZ, 0, dst, cols, wrap);
+    /* dropped while it was read, the bytes may have been reused */
+    return line >= sb_start(sb) ? n : -1;
+}
+
+void sb_clear(Scrollback *sb) {
+    sb->head = 0;
+    sb->bfirst = sb->nblocks = 0;
+    sb->pushed = 0;
+    sb->hot.first = 0;
+    sb->hot.len = 0;
+    sb->hot.nlines = 0;
+    sb->hot.view.cols = 0;
+    memset(sb->hot_bloom, 0, SB_BLOOM_SIZ);
+    sb->hot_win = 0;
+    sb->hot_maxcells = 0;
+    sb->hot_wrapcols = 0;
+    sb->hot_wrapped = 0;
+    sb->cols = 0;
+    sb->walk.cols = 0;
+    if (sb->spill) spill_reset(sb->spill);
+    sb->saved.nblocks = 0;
+    for (int i = 0; i < SB_CACHE; i++) sb->cache[i].first = -1, sb->cache[i].stamp = 0;
+    sb->reader.first = -1;
+}
+
+Scrollback *sb_new(size_t budget) {
+    Scrollback *sb;
+
+    if (!budget) return NULL;
+    sb = x_calloc(ALLOC_SCROLLBACK, 1, sizeof(*sb));
+    /* untouched ring pages cost no RSS until history reaches them */
+    sb->size = MAX(budget, 4 * (SB_BLOOM_SIZ + SB_PACK_SIZ));
+    sb->ring = x_malloc(ALLOC_SCROLLBACK, sb->size);
+    sb->bcap = sb->size / 512;
+    sb->blocks = x_malloc(ALLOC_SCROLLBACK, sb->bcap * sizeof(*sb->blocks));
+    sb->hot_bloom = x_malloc(ALLOC_SCROLLBACK, SB_BLOOM_SIZ + SB_BLOCK_SIZ);
+    sb->hot.raw = sb->hot_bloom + SB_BLOOM_SIZ;
+    for (int i = 0; i < SB_CACHE; i++) sb->cache[i].raw = x_malloc(ALLOC_SCROLLBACK, SB_BLOCK_SIZ);
+    /* untouched until an export reads history */
+    sb->reader.raw = x_malloc(ALLOC_SCROLLBACK, SB_BLOCK_SIZ);
+    sb->reader_pack = x_malloc(ALLOC_SCROLLBACK, SB_PACK_SIZ);
+    sb_clear(sb);
+    return sb;
+}
+
+/*
+ * Snapshot section: SbSection, the SbBlock index with lines numbered from
+ * the first one saved and offsets from the end of the index, then the
+ * stored blocks. The block being filled is saved uncompressed.
+ */
+#define SB_SECTION_MAGIC "STSB0003"
+
+typedef struct {
+    char magic[8];
+    uint32_t block_size; /* sizeof(SbBlock), the index is read in place */
+    int32_t nblocks;
+    int64_t nlines;
+} SbSection;
+
+/* Block i of the history, oldest first: restored, spilled, in the ring, then the one being filled */
+static int block_at(Scrollback *sb, int i, SbBlock *b, const uint8_t **data) {
+    int spilled = sb->spill ? sb->spill->nblocks : 0;
+
+    if (i < sb->saved.nblocks) {
+        *b = sb->saved.blocks[i];
+        *data = sb->saved.data + b->off;
+        return 1;
+    }
+    i -= sb->saved.nblocks;
+    if (i < spilled) {
+        *b = sb->spill->blocks[i];
+        return (*data = spill_data(sb->spill, b)) != NULL;
+    }
+    i -= spilled;
+    if (i < sb->nblocks) {
+        *b = *BLOCK(sb, i);
+        *data = sb->ring + b->off;
+        return 1;
+    }
+    b->first = sb->hot.first;
+    b->raw = sb->hot.len;
+    b->len = SB_BLOOM_SIZ + b->raw;
+    b->nlines = sb->hot.nlines;
+    b->maxcells = sb->hot_maxcells;
+    b->wrapcols = sb->hot_wrapcols;
+    b->rows_cols = b->rows = 0;
+    *data = sb->hot_bloom;
+    return 1;
+}
+
+int sb_save(Scrollback *sb, FILE *f, size_t budget) {
+    SbSection h = {SB_SECTION_MAGIC, sizeof(SbBlock), 0, 0};
+    SbBlock b;
+    const uint8_t *data;
+    int total = sb->saved.nblocks + (sb->spill ? sb->spill->nblocks : 0) + sb->nblocks + (sb->hot.nlines > 0), cut;
+    size_t bytes = 0;
+    uint64_t off = 0;
+    int64_t base;
+
+    /* the newest blocks that fit the budget */
+    for (cut = total; cut > 0 && block_at(sb, cut - 1, &b, &data) && (cut == total || bytes + b.len <= budget); cut--) bytes += b.len;
+    if (cut == total) return fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -1;
+
+    block_at(sb, cut, &b, &data);
+    base = b.first;
+    h.nblocks = total - cut;
+    h.nlines = sb->pushed - base;
+    if (fwrite(&h, sizeof(h), 1, f) != 1) return -1;
+    for (int i = cut; i < total; i++) {
+        if (!block_at(sb, i, &b, &data)) memset(&b, 0, sizeof(b));
+        b.first -= base;
+        b.off = off;
+        off += b.len;
+        if (fwrite(&b, sizeof(b), 1, f) != 1) return -1;
+    }
+    for (int i = cut; i < total; i++) {
+        if (!block_at(sb, i, &b, &data)) return -1;
+        if (fwrite(data, 1, b.len, f) != b.len) return -1;
+    }
+    return 0;
+}
+
+int sb_restore(Scrollback *sb, uint8_t *p, size_t len) {
+    const SbSection *h = (const SbSection *)p;
+    SbBlock *blocks = (SbBlock *)(h + 1);
+    size_t index, data;
+    int64_t next = 0;
+
+    if (sb->pushed || len < sizeof(*h) || memcmp(h->magic, SB_SECTION_MAGIC, 8) || h->block_size != sizeof(SbBlock) || h->nblocks < 0) return -1;
+    index = sizeof(*h) + (size_t)h->nblocks * sizeof(SbBlock);
+    if (index > len) return -1;
+    data = len - index;
+    for (int i = 0; i < h->nblocks; i++) {
+        const SbBlock *b = &blocks[i];
+
+        if (b->first < next || b->off > data || b->len > data - b->off || b->len < SB_BLOOM_SIZ || b->len > SB_BLOOM_SIZ + SB_PACK_SIZ || b->raw > SB_BLOCK_SIZ || b->nlines < 1 ||
+            b->nlines > SB_BLOCK_LINES || b->rows > SB_ROWS_MAX)
+            return -1;
+        next = b->first + b->nlines;
+    }
+    if (next > h->nlines) return -1;
+    if (!h->nblocks) return 0;
+
+    sb->saved.blocks = blocks;
+    sb->saved.data = p + index;
+    sb->saved.nblocks = h->nblocks;
+    sb->pushed = sb->hot.first = h->nlines;
+    /* the widths it was pushed at are not known, rows are counted per block */
+    sb->cols = -1;
+    return h->nlines;
+}
+
+int sb_spill(Scrollback *sb, const char *path, size_t limit, int keep) {
+    SbSpill *s = x_calloc(ALLOC_SCROLLBACK, 1, sizeof(*s));
+
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    if ((s->fd = open(s->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0) {
+        fprintf(stderr, "Error opening %s:%s\n", s->path, strerror(errno));
+        x_free(s);
+        return -1;
+    }
+    /* an unlinked file is cleaned up however we exit */
+    if (!keep) unlink(s->path);
+    s->limit = MAX(limit, SPILL_CHUNK);
+    s->bcap = MIN(s->limit / 64, SPILL_BLOCKS_MAX);
+    s->blocks = mmap(NULL, s->bcap * sizeof(*s->blocks), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (s->blocks == MAP_FAILED) {
+        fprintf(stderr, "Unable to reserve the scrollback spill index:%s\n", strerror(errno));
+        close(s->fd);
+        x_free(s);
+        return -1;
+    }
+    s->map = x_calloc(ALLOC_SCROLLBACK, s->limit / SPILL_CHUNK + 1, sizeof(*s->map));
+    for (int i = 0; i < SPILL_MAPPED; i++) s->mapped[i] = -1;
+    sb->spill = s;
+    return 0;
+}
+
+static void spill_free(SbSpill *s) {
+    for (int i = 0; i < SPILL_MAPPED; i++) {
+        if (s->mapped[i] >= 0) munmap(s->map[s->mapped[i]], SPILL_CHUNK);
+    }
+    munmap(s->blocks, s->bcap * sizeof(*s->blocks));
+    close(s->fd);
+    x_free(s->map);
+    x_free(s);
+}
+
+void sb_free(Scrollback *sb) {
+    if (!sb) return;
+    if (sb->spill) spill_free(sb->spill);
+    for (int i = 0; i < SB_CACHE; i++) x_free(sb->cache[i].raw);
+    x_free(sb->reader.raw);
+    x_free(sb->reader_pack);
+    x_free(sb->hot_bloom);
+    x_free(sb->blocks);
+    x_free(sb->ring);
+    x_free(sb);
+}
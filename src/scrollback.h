@@ -0,0 +1,104 @@
+#ifndef __SCROLLBACK_H__
+#define __SCROLLBACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vt100.h"
+
+/*
+ * Compressed scrollback. Lines are stored without their trailing unset
+ * cells, as runs of cells sharing attributes, in blocks of up to
+ * SB_BLOCK_LINES lines. The block being filled stays raw; full blocks are
+ * LZ compressed into a byte ring of fixed size, which drops the oldest
+ * blocks when it is full, so history is bounded by bytes, not lines.
+ * Reading a line decompresses its block into a small cache, scrolling
+ * through history decompresses each block once.
+ *
+ * Lines keep the ATTR_WRAP mark of soft wraps. Read at another width than
+ * they were pushed at, the logical lines of a block are rewrapped when the
+ * block is first viewed; until then it counts a row per line.
+ *
+ * Pushing happens on the tty thread and reading on the main thread, without
+ * a lock like the rest of Term: a line read while its block is being
+ * replaced may come out garbled, never out of bounds.
+ */
+#define SB_BLOCK_SIZ 32768 /* raw bytes per block */
+#define SB_BLOCK_LINES 256
+#define SB_CACHE 4 /* decompressed blocks kept for reading */
+
+typedef struct Scrollback Scrollback;
+
+/* budget is the size of the compressed ring in bytes, 0 disables scrollback (NULL) */
+Scrollback *sb_new(size_t budget);
+void sb_free(Scrollback *sb);
+void sb_clear(Scrollback *sb);
+
+/*
+ * Instead of dropping them, append blocks that leave the ring to the file
+ * path, of at most limit bytes, mapped back in 4 MB chunks when read. The
+ * file is truncated, so no other scrollback may use it, and unlinked at
+ * once unless keep. Returns -1 if it cannot be created.
+ */
+int sb_spill(Scrollback *sb, const char *path, size_t limit, int keep);
+
+/*
+ * Write the newest blocks of history, at most budget bytes of them, to f
+ * as a section sb_restore() can use in place. Returns -1 on write errors.
+ */
+int sb_save(Scrollback *sb, FILE *f, size_t budget);
+
+/*
+ * Make the section at p (len bytes, 8 byte aligned, kept mapped and
+ * writable by the caller, row counts are cached in it) the oldest
+ * history of an empty sb. Nothing is copied or decompressed. Returns the
+ * lines restored, -1 if the section is invalid.
+ */
+int sb_restore(Scrollback *sb, uint8_t *p, size_t len);
+
+void sb_push(Scrollback *sb, const Glyph *line, int cols);
+
+/* Lines held */
+int sb_count(Scrollback *sb);
+
+/* Rows at width cols, see above. The main thread's count */
+int sb_rows(Scrollback *sb, int cols);
+
+/* Decode the n-th most recent row at width cols (1 is the newest) into dst. Returns 0 if there is no such row */
+int sb_line(Scrollback *sb, int n, Glyph *dst, int cols);
+
+/*
+ * Searching. Lines are numbered from 0 (the first pushed since sb_clear())
+ * to sb_end() - 1; cells count from the start of the line. Every block
+ * carries a bloom filter of the trigrams in its text, built as lines are
+ * pushed, so only blocks that may hold the query are decompressed and
+ * scanned with cpu_find().
+ */
+int64_t sb_end(Scrollback *sb);
+
+/*
+ * Find q (ASCII lowercase folded, matched ignoring ASCII case) in the text
+ * of history, soft wrapped lines joined: the last match before *line,*cell
+ * if older, else the first after it. At most limit blocks are read per
+ * call. Returns 1 with the match in *line,*cell, 0 if there is none, -1
+ * when out of blocks: call again with *line,*cell as left to go on.
+ */
+int sb_find(Scrollback *sb, const char *q, int older, int64_t *line, int *cell, int limit);
+
+/* Row at width cols (as sb_line() counts them) showing cell of line, and the column there in *x. 0 if gone */
+int sb_row_of(Scrollback *sb, int64_t line, int cell, int cols, int *x);
+
+/* First line still held, lines before it were dropped */
+int64_t sb_start(Scrollback *sb);
+
+/*
+ * Read line as it was pushed, for one more thread (exports) besides the
+ * main one: it decompresses into a block buffer of its own and reads
+ * spilled blocks with pread(), leaving the cache and mappings alone. At
+ * most cols cells go to dst. Returns the cells of the line, *wrap set if
+ * it is soft wrapped, or -1 if it is gone or not pushed yet.
+ */
+int sb_read(Scrollback *sb, int64_t line, Glyph *dst, int cols, int *wrap);
+
+#endif
@@ -0,0 +1,163 @@
+#include "search.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "perf.h"
+#include "scrollback.h"
+
+#define SEARCH_MAX 64          /* query bytes */
+#define SEARCH_SLICE 8000000   /* ns of searching per search_poll() */
+#define SEARCH_BLOCKS 4        /* blocks read between looks at the clock */
+#define SEARCH_COLS 1024       /* row cells search_mark() looks at */
+
+extern unsigned int defaultfg;
+extern unsigned int defaultbg;
+
+static struct {
+    int active;
+    char q[SEARCH_MAX + 1]; /* ASCII case folded */
+    int len;
+    int pending, older; /* a search under way, from line,cell */
+    int64_t line;
+    int cell;
+    int failed;
+    int found; /* the current match */
+    int64_t match_line;
+    int match_cell;
+    int64_t match_end; /* sb_end() when match_row was counted */
+    int match_row, match_x;
+} search;
+
+void search_start(void) {
+    if (!term->scrollback) return;
+    memset(&search, 0, sizeof(search));
+    search.active = 1;
+}
+
+void search_stop(void) {
+    search.active = 0;
+    search.pending = 0;
+    t_full_dirt();
+}
+
+int search_active(void) { return search.active; }
+
+/* Row and column of the current match as the view counts them */
+static void search_place(void) {
+    search.match_row = sb_row_of(term->scrollback, search.match_line, search.match_cell, term->col, &search.match_x);
+    search.match_end = sb_end(term->scrollback);
+}
+
+static void search_from(int64_t line, int cell, int older) {
+    search.pending = 1;
+    search.older = older;
+    search.line = line;
+    search.cell = cell;
+    search.failed = 0;
+    search_poll();
+}
+
+/* Search again after the query changed, the current match stays if it still matches */
+static void search_restart(void) {
+    if (!search.len) {
+        search.pending = search.found = search.failed = 0;
+        t_full_dirt();
+    } else if (search.found) {
+        search_from(search.match_line, search.match_cell + 1, 1);
+    } else {
+        search_from(sb_end(term->scrollback), 0, 1);
+    }
+}
+
+void search_input(const char *text) {
+    for (; *text && search.len < SEARCH_MAX; text++) {
+        if ((unsigned char)*text < 0x20 || *text == 0x7f) continue;
+        search.q[search.len++] = *text >= 'A' && *text <= 'Z' ? *text + 32 : *text;
+    }
+    search.q[search.len] = '\0';
+    search_restart();
+}
+
+void search_erase(void) {
+    /* a whole UTF-8 character */
+    while (search.len > 0 && ((unsigned char)search.q[--search.len] & 0xC0) == 0x80);
+    search.q[search.len] = '\0';
+    search_restart();
+}
+
+void search_next(int older) {
+    if (!search.len) return;
+    if (search.found) {
+        search_from(search.match_line, search.match_cell, older);
+    } else if (older) {
+        search_from(sb_end(term->scrollback), 0, 1);
+    }
+}
+
+int search_poll(void) {
+    uint64_t t = perf_now();
+    int r, offset;
+
+    if (!search.pending) return 0;
+    do {
+        r = sb_find(term->scrollback, search.q, search.older, &search.line, &search.cell, SEARCH_BLOCKS);
+    } while (r < 0 && perf_now() - t < SEARCH_SLICE);
+    if (r < 0) return 0;
+
+    search.pending = 0;
+    if (!r) {
+        search.failed = 1;
+        return 1;
+    }
+    search.found = 1;
+    search.match_line = search.line;
+    search.match_cell = search.cell;
+    search_place();
+    /* bring the match to the middle of the screen unless it is in view */
+    offset = t_get_scroll_offset();
+    if (search.match_row && (search.match_row > offset || search.match_row <= offset - term->row)) {
+        t_scroll_view_to(search.match_row + term->row / 2);
+    }
+    t_full_dirt(); /* the current match moved */
+    return 1;
+}
+
+void search_mark(Line row, int cols, int n) {
+    static char text[SEARCH_COLS * UTF_SIZ];
+    static uint16_t cell[SEARCH_COLS * UTF_SIZ];
+    size_t len = 0, at, end;
+    int x, l, current;
+
+    if (!search.active || !search.len) return;
+    if (search.found && search.match_end != sb_end(term->scrollback)) search_place();
+    cols = MIN(cols, SEARCH_COLS);
+    for (x = 0; x < cols; x++) {
+        l = row[x].state & GLYPH_SET ? utf8_size(row[x].c) : 1;
+        memcpy(text + len, row[x].state & GLYPH_SET ? row[x].c : " ", l);
+        for (; l > 0; l--) cell[len++] = x;
+    }
+    for (at = 0; (at += cpu_find(text + at, len - at, search.q, search.len)) < len; at++) {
+        end = cell[at + search.len - 1];
+        current = search.found && n == search.match_row && cell[at] == search.match_x;
+        for (x = cell[at]; x <= (int)end; x++) {
+            if (!(row[x].state & GLYPH_SET)) {
+                memset(&row[x], 0, sizeof(row[x]));
+                row[x].c[0] = ' ';
+                row[x].fg = defaultfg;
+                row[x].bg = defaultbg;
+                row[x].state = GLYPH_SET;
+            }
+            row[x].mode ^= ATTR_REVERSE;
+            if (current) row[x].mode |= ATTR_UNDERLINE | ATTR_BOLD;
+        }
+    }
+}
+
+int search_status(char *buf, size_t size) {
+    int n = snprintf(buf, size, "/%s%s", search.q, search.pending ? " ..." : search.failed ? " (not found)" : "");
+
+    return MIN(n, (int)size - 1);
+}
@@ -0,0 +1,32 @@
+#ifndef __SEARCH_H__
+#define __SEARCH_H__
+
+#include <stddef.h>
+
+#include "vt100.h"
+
+/*
+ * Incremental search of the scrollback (KEY_SEARCH). Typed text extends
+ * the query and jumps to the newest match at or above the current one;
+ * next/previous step through the matches. Searching runs in slices of a
+ * few milliseconds from search_poll(), so a long search does not hold up
+ * rendering. Main thread only.
+ */
+void search_start(void);
+void search_stop(void);
+int search_active(void);
+
+void search_input(const char *text);
+void search_erase(void);
+void search_next(int older);
+
+/* Go on with a search under way. Returns 1 if the view or the status changed */
+int search_poll(void);
+
+/* Highlight the matches in row, the n-th history row as drawn (see t_scrollback_line()) */
+void search_mark(Line row, int cols, int n);
+
+/* Query and state for the scroll indicator, returns its length */
+int search_status(char *buf, size_t size);
+
+#endif
@@ -0,0 +1,126 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "scrollback.h"
+#include "vt100.h"
+
+#define SNAPSHOT_MAGIC "STSNAP01"
+#define SNAPSHOT_MODES (MODE_WRAP | MODE_CRLF | MODE_REVERSE) /* restored, the rest belongs to the old shell */
+
+/*
+ * File: SnapshotHeader, rows * cols Glyphs, then at sb_off (8 byte aligned)
+ * the scrollback section of sb_save(). Written in host layout, the sizes
+ * in the header reject files of another build.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t glyph_size;
+    int32_t cols, rows;
+    int32_t x, y;
+    int32_t mode;
+    Glyph attr;
+    uint64_t sb_off, sb_len;
+} SnapshotHeader;
+
+static int row_used(Line line) {
+    for (int x = 0; x < term->col; x++) {
+        if (line[x].state & GLYPH_SET) return 1;
+    }
+    return 0;
+}
+
+int snapshot_save(const char *path, size_t budget) {
+    char tmp[PATH_MAX];
+    static const char pad[8];
+    SnapshotHeader h = {SNAPSHOT_MAGIC, sizeof(Glyph), term->col, term->row, term->c.x, term->c.y, term->mode, term->c.attr, 0, 0};
+    Line *grid = IS_SET(MODE_ALTSCREEN) ? term->alt : term->line;
+    uint64_t t = perf_now();
+    size_t grid_end = sizeof(h) + (size_t)term->row * term->col * sizeof(Glyph);
+    int ok = 1;
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (!(f = fopen(tmp, "wb"))) {
+        fprintf(stderr, "Error opening %s:%s\n", tmp, strerror(errno));
+        return 0;
+    }
+    if (IS_SET(MODE_ALTSCREEN)) {
+        /* the primary cursor is not kept, continue below the last line used */
+        for (h.y = term->row - 1; h.y > 0 && !row_used(grid[h.y - 1]); h.y--);
+        h.x = 0;
+    }
+    h.sb_off = (grid_end + 7) & ~7ull;
+
+    ok &= fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int y = 0; y < term->row; y++) ok &= fwrite(grid[y], sizeof(Glyph), term->col, f) == (size_t)term->col;
+    ok &= fwrite(pad, 1, h.sb_off - grid_end, f) == h.sb_off - grid_end;
+    if (term->scrollback) ok &= sb_save(term->scrollback, f, budget) == 0;
+    h.sb_len = ftell(f) - h.sb_off;
+    ok &= fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    ok &= fclose(f) == 0;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Error writing %s:%s\n", path, strerror(errno));
+        unlink(tmp);
+        return 0;
+    }
+    fprintf(stderr, "Saved snapshot %s in %.1f ms\n", path, (perf_now() - t) / 1e6);
+    return 1;
+}
+
+int snapshot_load(const char *path) {
+    const SnapshotHeader *h;
+    const Glyph *cells;
+    uint8_t *p;
+    struct stat st;
+    uint64_t t = perf_now();
+    int fd, x, y, lines = 0;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        if (errno != ENOENT) fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+        close(fd);
+        return 0;
+    }
+    p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+
+    h = (const SnapshotHeader *)p;
+    if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) || h->glyph_size != sizeof(Glyph) || h->cols < 1 || h->rows < 1 ||
+        sizeof(*h) + (uint64_t)h->rows * h->cols * sizeof(Glyph) > h->sb_off || h->sb_off % 8 || h->sb_off > (uint64_t)st.st_size ||
+        h->sb_len > st.st_size - h->sb_off) {
+        fprintf(stderr, "Ignoring invalid snapshot %s\n", path);
+        munmap(p, st.st_size);
+        return 0;
+    }
+
+    x = h->x;
+    y = h->y;
+    cells = (const Glyph *)(h + 1);
+    for (int r = 0; r < MIN(h->rows, term->row); r++) {
+        memcpy(term->line[r], cells + (size_t)r * h->cols, MIN(h->cols, term->col) * sizeof(Glyph));
+        term->dirty[r] = 1;
+    }
+    term->c.attr = h->attr;
+    term->mode = (term->mode & ~SNAPSHOT_MODES) | (h->mode & SNAPSHOT_MODES);
+    if (term->scrollback && h->sb_len) lines = sb_restore(term->scrollback, p + h->sb_off, h->sb_len);
+    /* the blocks are used in place, the mapping lives as long as we do */
+    if (lines <= 0) munmap(p, st.st_size);
+
+    t_move_to(x, y);
+    if (term->c.x > 0) t_newline(1); /* the new prompt starts on its own line */
+    fprintf(stderr, "Restored snapshot %s, %d lines of scrollback, in %.2f ms\n", path, MAX(lines, 0), (perf_now() - t) / 1e6);
+    return 1;
+}
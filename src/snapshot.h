@@ -0,0 +1,15 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+
+/*
+ * Session snapshot (-snapshot file): the primary screen, cursor, a few
+ * modes and the newest scrollback blocks, saved on exit and loaded on the
+ * next start before the shell runs. The file is mapped and its scrollback
+ * blocks are used in place, so loading does not depend on history size.
+ */
+int snapshot_save(const char *path, size_t budget);
+int snapshot_load(const char *path);
+
+#endif
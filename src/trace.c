@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_THREADS 8
+#define TRACE_RING_SIZE (1 << 15) /* events per thread, power of 2 */
+#define TRACE_FLUSH_MS 50
+
+typedef struct {
+    const char *name;
+    uint64_t start;
+    uint64_t dur;
+    long n;
+} TraceEvent;
+
+/* Single producer (the owning thread), single consumer (the writer) */
+typedef struct {
+    const char *name;
+    int tid;
+    int named;         /* thread_name metadata written */
+    uint64_t dropped;  /* events lost because the ring was full */
+    uint32_t head;     /* written by the producer */
+    uint32_t tail;     /* written by the writer */
+    TraceEvent ev[TRACE_RING_SIZE];
+} TraceRing;
+
+int trace_enabled = 0;
+
+static TraceRing *rings[TRACE_THREADS];
+static int ring_count;
+static __thread TraceRing *ring;
+static FILE *trace_file;
+static uint64_t trace_start;
+static pthread_t writer;
+static int writer_should_exit;
+
+void trace_emit(const char *name, uint64_t start, uint64_t end, long n) {
+    TraceRing *r = ring;
+    uint32_t head;
+
+    if (!r) return;
+    head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING_SIZE) {
+        r->dropped++;
+        return;
+    }
+    r->ev[head & (TRACE_RING_SIZE - 1)] = (TraceEvent){name, start, end - start, n};
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Give the calling thread its own ring and track in the trace */
+void trace_thread(const char *name) {
+    int i;
+
+    if (!trace_enabled || ring) return;
+    i = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+    if (i >= TRACE_THREADS) {
+        fprintf(stderr, "trace: too many threads, %s is not traced\n", name);
+        return;
+    }
+    if (!(ring = calloc(1, sizeof(TraceRing)))) {
+        fprintf(stderr, "trace: out of memory\n");
+        return;
+    }
+    ring->name = name;
+    ring->tid = i + 1;
+    __atomic_store_n(&rings[i], ring, __ATOMIC_RELEASE);
+}
+
+static void trace_drain(void) {
+    for (int i = 0; i < TRACE_THREADS; i++) {
+        TraceRing *r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        uint32_t tail, head;
+
+        if (!r) continue;
+        if (!r->named) {
+            fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", r->tid, r->name);
+            r->named = 1;
+        }
+        tail = r->tail;
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++) {
+            TraceEvent *e = &r->ev[tail & (TRACE_RING_SIZE - 1)];
+            fprintf(trace_file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", e->name, r->tid, (e->start - trace_start) / 1e3,
+                    e->dur / 1e3);
+            if (e->n >= 0)
+                fprintf(trace_file, ",\"args\":{\"n\":%ld}},\n", e->n);
+            else
+                fprintf(trace_file, "},\n");
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void *trace_writer(void *unused) {
+    struct timespec tv = {0, TRACE_FLUSH_MS * 1000000};
+    sigset_t set;
+    (void)unused;
+
+    /* SIGCHLD exits through trace_close(), which joins this thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    while (!__atomic_load_n(&writer_should_exit, __ATOMIC_ACQUIRE)) {
+        nanosleep(&tv, NULL);
+        trace_drain();
+    }
+    return NULL;
+}
+
+int trace_open(const char *path) {
+    if (!(trace_file = fopen(path, "w"))) {
+        fprintf(stderr, "Error opening %s:%s\n", path, strerror(errno));
+        return 0;
+    }
+    fprintf(trace_file, "{\"traceEvents\":[\n");
+    fprintf(trace_file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"simple-terminal\"}},\n");
+    trace_start = perf_now();
+    trace_enabled = 1;
+    trace_thread("main");
+
+    if (pthread_create(&writer, NULL, trace_writer, NULL)) {
+        fprintf(stderr, "Unable to create trace writer thread\n");
+        trace_enabled = 0;
+        fclose(trace_file);
+        trace_file = NULL;
+        return 0;
+    }
+    atexit(trace_close);
+    return 1;
+}
+
+void trace_close(void) {
+    uint64_t dropped = 0;
+
+    if (!trace_file) return;
+    trace_enabled = 0;
+    __atomic_store_n(&writer_should_exit, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    trace_drain();
+
+    for (int i = 0; i < TRACE_THREADS; i++)
+        if (rings[i]) dropped += rings[i]->dropped;
+    /* metadata last, so the array never ends with a trailing comma */
+    fprintf(trace_file, "{\"name\":\"trace_dropped\",\"ph\":\"M\",\"pid\":1,\"args\":{\"events\":%llu}}\n]}\n", (unsigned long long)dropped);
+    fclose(trace_file);
+    trace_file = NULL;
+    if (dropped) fprintf(stderr, "trace: %llu events dropped, rings were full\n", (unsigned long long)dropped);
+}
@@ -0,0 +1,33 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+#include "perf.h"
+
+/*
+ * Chrome trace-event spans (-trace file.json), viewable in Perfetto or
+ * chrome://tracing. Each thread appends to its own lock-free ring, a
+ * writer thread drains the rings to the file off the hot path.
+ */
+
+extern int trace_enabled;
+
+int trace_open(const char *path);
+void trace_close(void);
+void trace_thread(const char *name);
+void trace_emit(const char *name, uint64_t start, uint64_t end, long n);
+
+/* Start time of a span, 0 when tracing is off */
+static inline uint64_t trace_begin(void) { return trace_enabled ? perf_now() : 0; }
+
+static inline void trace_end(const char *name, uint64_t start) {
+    if (start) trace_emit(name, start, perf_now(), -1);
+}
+
+/* Same as trace_end, with a count (bytes, chars...) shown in the span args */
+static inline void trace_end_n(const char *name, uint64_t start, long n) {
+    if (start) trace_emit(name, start, perf_now(), n);
+}
+
+#endif
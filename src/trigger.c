@@ -0,0 +1,407 @@
+#include "trigger.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "marks.h"
+#include "scrollback.h"
+#include "vt100.h"
+
+#define TRIGGER_LINE 4096 /* bytes of a line a regex or popup sees */
+
+enum trigger_action { TRIGGER_HIGHLIGHT, TRIGGER_POPUP, TRIGGER_MARK };
+
+typedef struct {
+    int action;
+    int color; /* highlight color, -1 for reverse video */
+    char *lit; /* fed to the automaton */
+    int litlen, cells;
+    char *re; /* NULL for a literal pattern */
+} Trigger;
+
+int trigger_count = 0;
+
+static Trigger triggers[TRIGGER_MAX];
+static int8_t same[TRIGGER_MAX]; /* next trigger with the same literal, -1 for none */
+static uint64_t pending[SESSION_MAX]; /* matched on the line of each session, act when it ends */
+
+/* Trie of the literals, then the automaton built over it */
+static int nstates = 1;
+static uint16_t child[TRIGGER_STATES], sibling[TRIGGER_STATES];
+static uint8_t edge[TRIGGER_STATES];
+static uint8_t emit[TRIGGER_STATES];  /* 1 + the trigger whose literal ends here, 0 for none */
+static uint16_t dict[TRIGGER_STATES]; /* nearest state on the fail chain that emits, 0 for none */
+static uint8_t hit[TRIGGER_STATES];   /* emits or has dict */
+uint16_t trigger_class[256];          /* byte classes, 0 for bytes in no literal */
+static int nclass = 1;
+static uint32_t idle[1];              /* the table without triggers */
+uint32_t *trigger_delta = idle;       /* nstates x nclass, rows as offsets, TRIGGER_HIT on hits */
+
+static char text[TRIGGER_LINE];
+static char popup[256];
+static int popup_ready;
+
+/* Length of the regex item at re: a char, an escape, . or a [set] */
+static int re_len(const char *re) {
+    const char *p = re + 1;
+
+    if (*re == '\\' && re[1]) return 2;
+    if (*re != '[') return 1;
+    if (*p == '^') p++;
+    if (*p == ']') p++;
+    while (*p && *p != ']') p++;
+    return *p ? p + 1 - re : 0;
+}
+
+static int re_one(const char *re, int c) {
+    const char *p = re + 1;
+    int neg, in = 0;
+
+    if (*re == '.') return 1;
+    if (*re == '\\') return (uint8_t)re[1] == c;
+    if (*re != '[') return (uint8_t)*re == c;
+    if ((neg = *p == '^')) p++;
+    for (const char *set = p; *p && (*p != ']' || p == set); p++) {
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            in |= c >= (uint8_t)p[0] && c <= (uint8_t)p[2];
+            p += 2;
+        } else {
+            in |= (uint8_t)*p == c;
+        }
+    }
+    return in != neg;
+}
+
+/* Whether re matches at s, before end; the end of the match in *m */
+static int re_here(const char *re, const char *s, const char *end, const char **m) {
+    int n, k, min, max;
+
+    for (;;) {
+        if (!*re || (re[0] == '$' && !re[1])) {
+            *m = s;
+            return !*re || s == end;
+        }
+        n = re_len(re);
+        if (re[n] == '*' || re[n] == '+' || re[n] == '?') {
+            min = re[n] == '+';
+            max = re[n] == '?' ? 1 : INT_MAX;
+            for (k = 0; k < max && s + k < end && re_one(re, (uint8_t)s[k]); k++);
+            for (; k >= min; k--)
+                if (re_here(re + n + 1, s + k, end, m)) return 1;
+            return 0;
+        }
+        if (s == end || !re_one(re, (uint8_t)*s)) return 0;
+        re += n;
+        s++;
+    }
+}
+
+static int re_search(const char *re, const char *s, size_t len, int *start, int *stop) {
+    const char *m;
+
+    for (const char *p = s; p <= s + len; p++) {
+        if (re[0] == '^' ? p == s && re_here(re + 1, p, s + len, &m) : re_here(re, p, s + len, &m)) {
+            *start = p - s;
+            *stop = m - s;
+            return 1;
+        }
+        if (re[0] == '^') break;
+    }
+    return 0;
+}
+
+/* Longest run of characters re needs literally into lit, returns its length, -1 if re is invalid */
+static int re_literal(const char *re, char *lit) {
+    char run[strlen(re) + 1];
+    int n, q, plain, best = 0, len = 0;
+
+    for (const char *p = re; *p; p += n) {
+        if ((*p == '^' && p == re) || (*p == '$' && !p[1])) {
+            n = 1;
+            continue;
+        }
+        if (!(n = re_len(p)) || *p == '*' || *p == '+' || *p == '?') return -1;
+        plain = *p == '\\' || (*p != '.' && *p != '[');
+        q = p[n] == '*' || p[n] == '+' || p[n] == '?';
+        /* a char that may be left out ends the run, one that may repeat ends it after itself */
+        if (plain && p[n] != '*' && p[n] != '?') run[len++] = p[n - 1];
+        if (!plain || q) {
+            if (len > best) memcpy(lit, run, best = len);
+            len = 0;
+        }
+        n += q;
+    }
+    if (len > best) memcpy(lit, run, best = len);
+    return best;
+}
+
+/* Add lit to the trie, returns its last state or -1 when out of states */
+static int insert(const char *lit, int len) {
+    int s = 0, k;
+
+    for (int i = 0; i < len; i++) {
+        for (k = child[s]; k && edge[k] != (uint8_t)lit[i]; k = sibling[k]);
+        if (!k) {
+            if (nstates == TRIGGER_STATES) return -1;
+            k = nstates++;
+            edge[k] = lit[i];
+            sibling[k] = child[s];
+            child[s] = k;
+        }
+        s = k;
+    }
+    return s;
+}
+
+/* The full transition table from the trie, states in breadth first order follow their fail links */
+static void build(void) {
+    static uint16_t queue[TRIGGER_STATES], fail[TRIGGER_STATES];
+    uint16_t *cls = trigger_class, *delta;
+    int head = 0, tail = 0, s, f, k;
+
+    memset(cls, 0, sizeof(trigger_class));
+    nclass = 1;
+    for (s = 1; s < nstates; s++)
+        if (!cls[edge[s]]) cls[edge[s]] = nclass++;
+    delta = x_calloc(ALLOC_OTHER, (size_t)nstates * nclass, sizeof(*delta));
+    for (k = child[0]; k; k = sibling[k]) {
+        delta[cls[edge[k]]] = k;
+        fail[k] = 0;
+        queue[tail++] = k;
+    }
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+        dict[s] = emit[f] ? f : dict[f];
+        hit[s] = emit[s] || dict[s];
+        memcpy(&delta[s * nclass], &delta[f * nclass], nclass * sizeof(*delta));
+        for (k = child[s]; k; k = sibling[k]) {
+            fail[k] = delta[f * nclass + cls[edge[k]]];
+            delta[s * nclass + cls[edge[k]]] = k;
+            queue[tail++] = k;
+        }
+    }
+
+    /* the hot loop adds the class to the row directly, and tests the hit bit without a lookup */
+    trigger_delta = x_realloc(ALLOC_OTHER, trigger_delta == idle ? NULL : trigger_delta, (size_t)nstates * nclass * sizeof(*trigger_delta));
+    for (size_t i = 0; i < (size_t)nstates * nclass; i++) trigger_delta[i] = delta[i] * nclass | (hit[delta[i]] ? TRIGGER_HIT : 0);
+    x_free(delta);
+    for (int i = 0; i < SESSION_MAX; i++) sessions[i].trigger = 0;
+}
+
+int trigger_add(const char *spec) {
+    const char *colon = strchr(spec, ':'), *pat;
+    Trigger *tr = &triggers[trigger_count];
+    int len, s;
+
+    if (!colon || !colon[1]) {
+        fprintf(stderr, "Invalid trigger %s, want action:pattern\n", spec);
+        return 0;
+    }
+    if (trigger_count == TRIGGER_MAX) {
+        fprintf(stderr, "Too many triggers, %s ignored\n", spec);
+        return 0;
+    }
+    tr->color = -1;
+    if (!strncmp(spec, "highlight", 9) && (spec + 9 == colon || spec[9] == '=')) {
+        tr->action = TRIGGER_HIGHLIGHT;
+        if (spec[9] == '=') tr->color = atoi(spec + 10);
+    } else if (colon - spec == 5 && !strncmp(spec, "popup", 5)) {
+        tr->action = TRIGGER_POPUP;
+    } else if (colon - spec == 4 && !strncmp(spec, "mark", 4)) {
+        tr->action = TRIGGER_MARK;
+    } else {
+        fprintf(stderr, "Unknown trigger action in %s, want highlight[=color], popup or mark\n", spec);
+        return 0;
+    }
+
+    pat = colon + 1;
+    len = strlen(pat);
+    tr->re = NULL;
+    if (len > 2 && pat[0] == '/' && pat[len - 1] == '/') {
+        tr->re = x_malloc(ALLOC_OTHER, len - 1);
+        memcpy(tr->re, pat + 1, len - 2);
+        tr->re[len - 2] = '\0';
+        tr->lit = x_malloc(ALLOC_OTHER, len);
+        if ((tr->litlen = re_literal(tr->re, tr->lit)) <= 0) {
+            fprintf(stderr, "Invalid trigger regex in %s, it needs a literal character\n", spec);
+            x_free(tr->re);
+            x_free(tr->lit);
+            return 0;
+        }
+    } else {
+        tr->lit = x_malloc(ALLOC_OTHER, len + 1);
+        memcpy(tr->lit, pat, len + 1);
+        tr->litlen = len;
+    }
+    tr->cells = 0;
+    for (int i = 0; i < tr->litlen; i++) tr->cells += ((uint8_t)tr->lit[i] & 0xC0) != 0x80;
+
+    if ((s = insert(tr->lit, tr->litlen)) < 0) {
+        fprintf(stderr, "Too many trigger patterns, %s ignored\n", spec);
+        x_free(tr->re);
+        x_free(tr->lit);
+        return 0;
+    }
+    same[trigger_count] = emit[s] - 1;
+    emit[s] = trigger_count + 1;
+    trigger_count++;
+    build();
+    return 1;
+}
+
+static int row_wrapped(int y) { return (term->line[y][term->col - 1].state & GLYPH_SET) && (term->line[y][term->col - 1].mode & ATTR_WRAP); }
+
+/* First row of the line holding row y, rows joined by soft wraps */
+static int line_top(int y) {
+    while (y > 0 && row_wrapped(y - 1)) y--;
+    return y;
+}
+
+/* The cells of lit, if they end at x,y: their first one in *x,*y */
+static int spells(const Trigger *tr, int *x, int *y) {
+    int cx = *x - (tr->cells - 1), cy = *y, l;
+
+    for (; cx < 0; cx += term->col)
+        if (cy == 0 || !row_wrapped(--cy)) return 0;
+    *x = cx;
+    *y = cy;
+    for (int i = 0; i < tr->litlen; i += l) {
+        Glyph *g = &term->line[cy][cx];
+
+        l = utf8_size(g->c);
+        if (!(g->state & GLYPH_SET) || i + l > tr->litlen || memcmp(g->c, tr->lit + i, l)) return 0;
+        if (++cx == term->col) cx = 0, cy++;
+    }
+    return 1;
+}
+
+/* Recolor n cells from x,y on */
+static void paint(const Trigger *tr, int x, int y, int n) {
+    int y0 = y;
+
+    for (; n > 0 && y < term->row; n--) {
+        Glyph *g = &term->line[y][x];
+
+        if (tr->color < 0) {
+            g->mode |= ATTR_REVERSE;
+        } else {
+            g->fg = tr->color;
+            g->mode |= ATTR_BOLD;
+        }
+        if (++x == term->col) x = 0, y++;
+    }
+    t_set_dirt(y0, y);
+}
+
+static void mark(int y) {
+    if (!term->scrollback || IS_SET(MODE_ALTSCREEN)) return;
+    mark_line(sb_end(term->scrollback) + line_top(y));
+}
+
+static void fire(int t, int x, int y) {
+    const Trigger *tr = &triggers[t];
+
+    /* regexes and popups need the whole line */
+    if (tr->re || tr->action == TRIGGER_POPUP) {
+        pending[term->id] |= 1ull << t;
+        return;
+    }
+    if (!spells(tr, &x, &y)) return;
+    if (tr->action == TRIGGER_HIGHLIGHT) {
+        paint(tr, x, y, tr->cells);
+    } else {
+        mark(y);
+    }
+}
+
+void trigger_hit(uint32_t s) {
+    s = (s & ~TRIGGER_HIT) / nclass;
+    for (int e = emit[s] ? s : dict[s]; e; e = dict[e])
+        for (int t = emit[e] - 1; t >= 0; t = same[t]) fire(t, term->c.x, term->c.y);
+}
+
+/* Text of the line ending at row y, unset cells as spaces: a byte per cell but for UTF-8 */
+static size_t line_text(int top, int y) {
+    size_t n = 0;
+    int end, l;
+
+    for (int r = top; r <= y; r++) {
+        end = term->col;
+        if (r == y)
+            while (end > 0 && !(term->line[r][end - 1].state & GLYPH_SET)) end--;
+        for (int x = 0; x < end; x++) {
+            Glyph *g = &term->line[r][x];
+
+            l = g->state & GLYPH_SET ? utf8_size(g->c) : 1;
+            if (n + l >= sizeof(text)) return n;
+            memcpy(text + n, g->state & GLYPH_SET ? g->c : " ", l);
+            n += l;
+        }
+    }
+    return n;
+}
+
+/* Cells before byte off of the line text */
+static int cells_before(size_t off) {
+    int n = 0;
+
+    for (size_t i = 0; i < off; i++) n += ((uint8_t)text[i] & 0xC0) != 0x80;
+    return n;
+}
+
+void trigger_newline(int y) {
+    int top, start, stop, cells;
+    size_t len, off;
+    const char *s;
+
+    term->trigger = 0;
+    if (!pending[term->id]) return;
+    top = line_top(y);
+    len = line_text(top, y);
+    text[len] = '\0';
+    for (int t = 0; t < trigger_count; t++) {
+        const Trigger *tr = &triggers[t];
+
+        if (!(pending[term->id] & 1ull << t)) continue;
+        if (tr->re && !re_search(tr->re, text, len, &start, &stop)) continue;
+        switch (tr->action) {
+            case TRIGGER_HIGHLIGHT:
+                /* every match on the line, as for literals */
+                for (off = 0; re_search(tr->re, text + off, len - off, &start, &stop); off += MAX(stop, start + 1)) {
+                    cells = cells_before(off + start);
+                    paint(tr, cells % term->col, top + cells / term->col, cells_before(off + stop) - cells);
+                    if (tr->re[0] == '^' || off + MAX(stop, start + 1) > len) break;
+                }
+                break;
+            case TRIGGER_POPUP:
+                /* the last one is still to be shown */
+                if (__atomic_load_n(&popup_ready, __ATOMIC_ACQUIRE)) break;
+                for (s = text; *s == ' '; s++);
+                /* a longer line ends in "...", cut at a char boundary */
+                if ((off = strlen(s)) < sizeof(popup)) {
+                    memcpy(popup, s, off + 1);
+                } else {
+                    for (off = sizeof(popup) - 4; off > 0 && ((uint8_t)s[off] & 0xC0) == 0x80; off--);
+                    snprintf(popup, sizeof(popup), "%.*s...", (int)off, s);
+                }
+                __atomic_store_n(&popup_ready, 1, __ATOMIC_RELEASE);
+                break;
+            case TRIGGER_MARK:
+                mark(top);
+                break;
+        }
+    }
+    pending[term->id] = 0;
+}
+
+int trigger_popup(char *buf, size_t size) {
+    if (!__atomic_load_n(&popup_ready, __ATOMIC_ACQUIRE)) return 0;
+    snprintf(buf, size, "%s", popup);
+    __atomic_store_n(&popup_ready, 0, __ATOMIC_RELEASE);
+    return 1;
+}
@@ -0,0 +1,60 @@
+#ifndef __TRIGGER_H__
+#define __TRIGGER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vt100.h"
+
+/*
+ * Output triggers. Patterns are matched against the text as t_putc()
+ * prints it, one step of an Aho-Corasick automaton per byte, so the cost
+ * does not grow with the number of patterns. A trigger is
+ * "action:pattern" with action
+ *
+ *   highlight[=color]  recolor the match (color index and bold, reverse
+ *                      video without one)
+ *   popup              show the line in a popup
+ *   mark               make the line a target of the command jump keys
+ *
+ * A pattern in slashes is a limited regex: . [set] [^set] * + ? ^ $ and
+ * \ escapes, over bytes. Its longest run of required literal characters
+ * goes into the automaton; the regex itself only runs when the line
+ * holding that run ends. Patterns do not match across explicit newlines.
+ *
+ * trigger_add() is called before the tty thread starts, trigger_popup()
+ * by the main thread, the rest by the tty thread, for the session it reads.
+ */
+#define TRIGGER_MAX 64
+#define TRIGGER_STATES 2048 /* automaton states, about the bytes of all literals */
+#define TRIGGER_HIT (1u << 31) /* set on transitions into a state where a literal ends */
+
+extern int trigger_count;
+/* Transitions: the row of a state plus the class of a byte give the next row */
+extern uint32_t *trigger_delta;
+extern uint16_t trigger_class[256];
+
+/* Returns 0 with the reason on stderr if spec is invalid or there is no room */
+int trigger_add(const char *spec);
+
+/* Act on the literals ending in state s, for the char at the cursor */
+void trigger_hit(uint32_t s);
+
+/* A char printed at the cursor: with no trigger every byte stays in state 0 */
+static inline void trigger_putc(const char *c, int len) {
+    uint32_t s = term->trigger;
+
+    for (int i = 0; i < len; i++) {
+        s = trigger_delta[(s & ~TRIGGER_HIT) + trigger_class[(uint8_t)c[i]]];
+        if (s & TRIGGER_HIT) trigger_hit(s);
+    }
+    term->trigger = s;
+}
+
+/* The explicit end of row y's line */
+void trigger_newline(int y);
+
+/* Take the line of the last popup trigger, 0 if none is pending */
+int trigger_popup(char *buf, size_t size);
+
+#endif
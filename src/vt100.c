@@ -3,6 +3,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pty.h>
 #include <pwd.h>
 #include <signal.h>
@@ -15,27 +16,41 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+/* <pty.h> brings termios' B0 baud rate, which would hide the bit mask of vt100.h */
+#undef B0
+
+#include "alloc.h"
+#include "capture.h"
+#include "cpu.h"
+#include "latency.h"
+#include "marks.h"
+#include "perf.h"
+#include "scrollback.h"
+#include "trace.h"
+#include "trigger.h"
+
 /* External variables from config.h */
 extern unsigned int defaultfg;
 extern unsigned int defaultbg;
 extern unsigned int tabspaces;
 extern char default_shell[];
 extern char termname[];
-extern int scrollback_lines;
+extern int scrollback_kb;
 
 /* External variables from main.c */
 extern char *opt_io;
+extern int opt_io_format;
 extern char **opt_cmd;
 extern int opt_cmd_size;
 extern int show_help;
+extern int opt_batch;
+extern int opt_spill;
+extern int opt_spill_keep;
 
 /* VT100/Terminal global variables */
-Term term;
-CSIEscape csiescseq;
-STREscape strescseq;
-int cmdfd;
-int iofd = -1;
-static pid_t pid;
+Term sessions[SESSION_MAX];
+__thread Term *term = &sessions[0];
+Term *term_shown = &sessions[0];
 
 /* UTF-8 functions */
 int utf8_decode(char *s, long *u) {
@@ -157,7 +172,9 @@ void exec_sh(void) {
     unsetenv("COLUMNS");
     unsetenv("LINES");
     unsetenv("TERMCAP");
-    chdir(getenv("HOME"));
+    if (!opt_batch) chdir(getenv("HOME"));
+    /* the help and -r commands run in the first session only */
+    if (term->id) show_help = opt_cmd_size = 0;
 
     if (show_help != 0) {
         system("uname -a");
@@ -175,6 +192,18 @@ void exec_sh(void) {
     setenv("TERM", termname, 1);
     args = (char *[]){envshell, "-i", NULL};
 
+    if (opt_batch) {
+        /* headless: the commands are the whole session, no interactive shell */
+        size_t len = 1;
+        char *script;
+
+        for (int i = 0; i < opt_cmd_size; i++) len += strlen(opt_cmd[i]) + 1;
+        script = x_calloc(ALLOC_OTHER, 1, len);
+        for (int i = 0; i < opt_cmd_size; i++) strcat(strcat(script, opt_cmd[i]), "\n");
+        execvp(envshell, (char *[]){envshell, "-c", script, NULL});
+        exit(EXIT_FAILURE);
+    }
+
     // executing opt_cmd
     for (int i = 0; i < opt_cmd_size; i++) {
         char echo_cmd[255];
@@ -187,11 +216,32 @@ void exec_sh(void) {
     exit(EXIT_FAILURE);
 }
 
-void sig_chld(int a) {
+/* Exit status of the shell, for callers that did not install sig_chld */
+int tty_wait(void) {
     int stat = 0;
+
+    while (waitpid(term->pid, &stat, 0) < 0)
+        if (errno != EINTR) die("Waiting for pid %hd failed: %s\n", term->pid, strerror(errno));
+    return WIFEXITED(stat) ? WEXITSTATUS(stat) : EXIT_FAILURE;
+}
+
+void sig_chld(int a) {
+    int stat = 0, live = 0, reaped = 0;
+    pid_t p;
     (void)a;
 
-    if (waitpid(pid, &stat, 0) < 0) die("Waiting for pid %hd failed: %s\n", pid, strerror(errno));
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if (!sessions[i].pid) continue;
+        if ((p = waitpid(sessions[i].pid, &stat, WNOHANG)) < 0) die("Waiting for pid %hd failed: %s\n", sessions[i].pid, strerror(errno));
+        if (p) {
+            sessions[i].pid = 0;
+            reaped = 1;
+        } else {
+            live++;
+        }
+    }
+    /* another child, an export command, or a shell with others still running: its session closes with its pty */
+    if (!reaped || live) return;
 
     if (WIFEXITED(stat)) {
         exit(WEXITSTATUS(stat));
@@ -202,12 +252,13 @@ void sig_chld(int a) {
 
 void tty_new(void) {
     int m, s;
-    struct winsize w = {term.row, term.col, 0, 0};
+    struct winsize w = {term->row, term->col, 0, 0};
 
     /* seems to work fine on linux, openbsd and freebsd */
     if (openpty(&m, &s, NULL, NULL, &w) < 0) die("openpty failed: %s\n", strerror(errno));
+    fcntl(m, F_SETFD, FD_CLOEXEC); /* not held by the shells of later sessions */
 
-    switch (pid = fork()) {
+    switch (term->pid = fork()) {
         case -1:
             die("fork failed\n");
             break;
@@ -223,17 +274,48 @@ void tty_new(void) {
             break;
         default:
             close(s);
-            cmdfd = m;
-            signal(SIGCHLD, sig_chld);
-            if (opt_io) {
-                iofd = (!strcmp(opt_io, "-")) ? STDOUT_FILENO : open(opt_io, O_WRONLY | O_CREAT, 0666);
-                if (iofd < 0) {
-                    fprintf(stderr, "Error opening %s:%s\n", opt_io, strerror(errno));
-                }
-            }
+            term->cmdfd = m;
+            if (!opt_batch) signal(SIGCHLD, sig_chld); /* batch reads until EOF, then tty_wait() */
+            if (opt_io && !term->id) capture_open(opt_io, opt_io_format, term->col, term->row);
     }
 }
 
+Term *session_open(int col, int row) {
+    Term *caller = term, *t = NULL;
+
+    for (int i = 0; i < SESSION_MAX && !t; i++)
+        if (!sessions[i].line) t = &sessions[i];
+    if (!t) return NULL;
+    memset(t, 0, sizeof(*t));
+    t->id = t - sessions;
+    term = t;
+    t_new(col, row);
+    tty_new();
+    term = caller;
+    return t;
+}
+
+void session_free(Term *t) {
+    Term *caller = term;
+
+    term = t;
+    for (int i = 0; i < term->row; i++) {
+        x_free(term->line[i]);
+        x_free(term->alt[i]);
+    }
+    x_free(term->line);
+    x_free(term->alt);
+    x_free(term->dirty);
+    x_free(term->tabs);
+    sb_free(term->scrollback);
+    mark_clear();
+    if (term->cmdfd > 0) close(term->cmdfd);
+    term->line = NULL;
+    term->cmdfd = 0;
+    term->scrollback = NULL;
+    term = caller;
+}
+
 void dump(char c) {
     static int col;
 
@@ -241,67 +323,94 @@ void dump(char c) {
     if (++col % 10 == 0) fprintf(stderr, "\n");
 }
 
-void tty_read(void) {
-    static char buf[BUFSIZ];
-    static int buflen = 0;
-    char *ptr;
-    char s[UTF_SIZ];
-    int charsize; /* size of utf8 char in bytes */
-    long utf8c;
-    int ret;
+int tty_read(void) {
+    char *buf = term->buf;
+    int ret, written;
+    uint64_t t;
 
     /* append read bytes to unprocessed bytes */
-    if ((ret = read(cmdfd, buf + buflen, LEN(buf) - buflen)) < 0) die("Couldn't read from shell: %s\n", strerror(errno));
-
-    /* process every complete utf8 char */
-    buflen += ret;
-    ptr = buf;
-    while (buflen >= UTF_SIZ || is_full_utf8(ptr, buflen)) {
-        charsize = utf8_decode(ptr, &utf8c);
-        utf8_encode(&utf8c, s);
-        t_putc(s, charsize);
-        ptr += charsize;
-        buflen -= charsize;
+    if ((ret = read(term->cmdfd, buf + term->buflen, LEN(term->buf) - term->buflen)) < 0) {
+        if (errno == EIO) return -1; /* the shell and everything it started are gone */
+        if (errno == EINTR) return 0;
+        die("Couldn't read from shell: %s\n", strerror(errno));
     }
+    if (!ret) return -1;
+
+    /* process every complete utf8 char, output of sessions in the background is no reply to a key */
+    if (term == term_shown) latency_mark(LAT_READ);
+    perf_count(PERF_PTY_BYTES, ret);
+    if (!term->id) capture_write(buf + term->buflen, ret); /* -o records the first session */
+    term->buflen += ret;
+    t = trace_begin();
+    written = t_write(buf, term->buflen);
+    trace_end_n("tty_read", t, ret);
+    if (term == term_shown) latency_mark(LAT_PARSED);
+    term->buflen -= written;
 
     /* keep any uncomplete utf8 char for the next call */
-    memmove(buf, ptr, buflen);
+    memmove(buf, buf + written, term->buflen);
+    return ret;
+}
+
+/* Parse bytes that did not come from the shell (replay), in tty_read() sized chunks */
+void tty_feed(const char *s, size_t n) {
+    static char buf[BUFSIZ];
+    static int buflen = 0;
+    int len, written;
+    uint64_t t;
+
+    while (n > 0) {
+        len = MIN(n, LEN(buf) - buflen);
+        memcpy(buf + buflen, s, len);
+        perf_count(PERF_PTY_BYTES, len);
+        buflen += len;
+        t = trace_begin();
+        written = t_write(buf, buflen);
+        trace_end_n("tty_read", t, len);
+        buflen -= written;
+        memmove(buf, buf + written, buflen);
+        s += len;
+        n -= len;
+    }
 }
 
 void tty_write(const char *s, size_t n) {
-    if (write(cmdfd, s, n) == -1) die("write error on tty: %s\n", strerror(errno));
+    latency_mark(LAT_WRITE);
+    if (write(term->cmdfd, s, n) == -1) die("write error on tty: %s\n", strerror(errno));
 }
 
 void tty_resize(void) {
     struct winsize w;
 
-    w.ws_row = term.row;
-    w.ws_col = term.col;
+    if (!isatty(term->cmdfd)) return; /* no shell behind cmdfd (benchmarks) */
+    w.ws_row = term->row;
+    w.ws_col = term->col;
     w.ws_xpixel = 0; /* mainwindow.tw */
     w.ws_ypixel = 0; /* mainwindow.th */
-    if (ioctl(cmdfd, TIOCSWINSZ, &w) < 0) fprintf(stderr, "Couldn't set window size: %s\n", strerror(errno));
+    if (ioctl(term->cmdfd, TIOCSWINSZ, &w) < 0) fprintf(stderr, "Couldn't set window size: %s\n", strerror(errno));
+    if (!term->id) capture_resize(term->col, term->row);
 }
 
 void t_set_dirt(int top, int bot) {
     int i;
 
-    LIMIT(top, 0, term.row - 1);
-    LIMIT(bot, 0, term.row - 1);
+    LIMIT(top, 0, term->row - 1);
+    LIMIT(bot, 0, term->row - 1);
 
-    for (i = top; i <= bot; i++) term.dirty[i] = 1;
+    for (i = top; i <= bot; i++) term->dirty[i] = 1;
 }
 
-void t_full_dirt(void) { t_set_dirt(0, term.row - 1); }
+void t_full_dirt(void) { t_set_dirt(0, term->row - 1); }
 
 void t_cursor(int mode) {
-    static TCursor c[2];  // Separate cursor save for primary[0] and alt[1] screens
+    TCursor *c = term->saved;  // Separate cursor save for primary[0] and alt[1] screens
 
     if (mode == CURSOR_SAVE) {
         int screen_idx = IS_SET(MODE_ALTSCREEN) ? 1 : 0;
-        c[screen_idx] = term.c;
+        c[screen_idx] = term->c;
     } else if (mode == CURSOR_LOAD) {
         int screen_idx = IS_SET(MODE_ALTSCREEN) ? 1 : 0;
-        term.c = c[screen_idx];
+        term->c = c[screen_idx];
         t_move_to(c[screen_idx].x, c[screen_idx].y);
     }
 }
@@ -309,49 +418,49 @@ void t_cursor(int mode) {
 void t_reset(void) {
     uint i;
 
-    term.c = (TCursor){{.mode = ATTR_NULL, .fg = defaultfg, .bg = defaultbg}, .x = 0, .y = 0, .state = CURSOR_DEFAULT};
+    term->c = (TCursor){{.mode = ATTR_NULL, .fg = defaultfg, .bg = defaultbg}, .x = 0, .y = 0, .state = CURSOR_DEFAULT};
 
-    memset(term.tabs, 0, term.col * sizeof(*term.tabs));
-    for (i = tabspaces; i < term.col; i += tabspaces) term.tabs[i] = 1;
-    term.top = 0;
-    term.bot = term.row - 1;
-    term.mode = MODE_WRAP;
+    memset(term->tabs, 0, term->col * sizeof(*term->tabs));
+    for (i = tabspaces; i < term->col; i += tabspaces) term->tabs[i] = 1;
+    term->top = 0;
+    term->bot = term->row - 1;
+    term->mode = MODE_WRAP;
 
-    t_clear_region(0, 0, term.col - 1, term.row - 1);
+    t_clear_region(0, 0, term->col - 1, term->row - 1);
 }
 
 void t_new(int col, int row) {
     /* set screen size */
-    term.row = row;
-    term.col = col;
-    term.line = x_malloc(term.row * sizeof(Line));
-    term.alt = x_malloc(term.row * sizeof(Line));
-    term.dirty = x_malloc(term.row * sizeof(*term.dirty));
-    term.tabs = x_malloc(term.col * sizeof(*term.tabs));
-
-    for (row = 0; row < term.row; row++) {
-        term.line[row] = x_malloc(term.col * sizeof(Glyph));
-        term.alt[row] = x_malloc(term.col * sizeof(Glyph));
-        term.dirty[row] = 0;
+    term->row = row;
+    term->col = col;
+    term->line = x_malloc(ALLOC_GRID, term->row * sizeof(Line));
+    term->alt = x_malloc(ALLOC_GRID, term->row * sizeof(Line));
+    term->dirty = x_malloc(ALLOC_GRID, term->row * sizeof(*term->dirty));
+    term->tabs = x_malloc(ALLOC_GRID, term->col * sizeof(*term->tabs));
+
+    for (row = 0; row < term->row; row++) {
+        term->line[row] = x_malloc(ALLOC_GRID, term->col * sizeof(Glyph));
+        term->alt[row] = x_malloc(ALLOC_GRID, term->col * sizeof(Glyph));
+        term->dirty[row] = 0;
     }
-    memset(term.tabs, 0, term.col * sizeof(*term.tabs));
+    memset(term->tabs, 0, term->col * sizeof(*term->tabs));
     /* initialize scrollback buffer */
-    t_scrollback_init(scrollback_lines);
+    t_scrollback_init((size_t)scrollback_kb * 1024);
     /* setup screen */
     t_reset();
 }
 
 void t_swap_screen(void) {
-    Line *tmp = term.line;
+    Line *tmp = term->line;
 
-    term.line = term.alt;
-    term.alt = tmp;
-    term.mode ^= MODE_ALTSCREEN;
+    term->line = term->alt;
+    term->alt = tmp;
+    term->mode ^= MODE_ALTSCREEN;
     t_full_dirt();
 
     // Ensure cursor is within bounds after swap
-    LIMIT(term.c.x, 0, term.col - 1);
-    LIMIT(term.c.y, 0, term.row - 1);
+    LIMIT(term->c.x, 0, term->col - 1);
+    LIMIT(term->c.y, 0, term->row - 1);
 
     redraw();  // Force immediate redraw after screen swap
 }
@@ -360,41 +469,41 @@ void t_scroll_down(int orig, int n) {
     int i;
     Line temp;
 
-    LIMIT(n, 0, term.bot - orig + 1);
+    LIMIT(n, 0, term->bot - orig + 1);
 
-    t_clear_region(0, term.bot - n + 1, term.col - 1, term.bot);
+    t_clear_region(0, term->bot - n + 1, term->col - 1, term->bot);
 
-    for (i = term.bot; i >= orig + n; i--) {
-        temp = term.line[i];
-        term.line[i] = term.line[i - n];
-        term.line[i - n] = temp;
+    for (i = term->bot; i >= orig + n; i--) {
+        temp = term->line[i];
+        term->line[i] = term->line[i - n];
+        term->line[i - n] = temp;
 
-        term.dirty[i] = 1;
-        term.dirty[i - n] = 1;
+        term->dirty[i] = 1;
+        term->dirty[i - n] = 1;
     }
 }
 
 void t_scroll_up(int orig, int n) {
     int i;
     Line temp;
-    LIMIT(n, 0, term.bot - orig + 1);
+    LIMIT(n, 0, term->bot - orig + 1);
 
     /* Save scrolled lines to scrollback buffer (only from top of scroll region) */
-    if (orig == term.top) {
-        for (i = 0; i < n && orig + i <= term.bot; i++) {
-            t_scrollback_add_line(term.line[orig + i]);
+    if (orig == term->top) {
+        for (i = 0; i < n && orig + i <= term->bot; i++) {
+            t_scrollback_add_line(term->line[orig + i]);
         }
     }
 
-    t_clear_region(0, orig, term.col - 1, orig + n - 1);
+    t_clear_region(0, orig, term->col - 1, orig + n - 1);
 
-    for (i = orig; i <= term.bot - n; i++) {
-        temp = term.line[i];
-        term.line[i] = term.line[i + n];
-        term.line[i + n] = temp;
+    for (i = orig; i <= term->bot - n; i++) {
+        temp = term->line[i];
+        term->line[i] = term->line[i + n];
+        term->line[i + n] = temp;
 
-        term.dirty[i] = 1;
-        term.dirty[i + n] = 1;
+        term->dirty[i] = 1;
+        term->dirty[i + n] = 1;
     }
     
     /* Reset scroll view when content scrolls */
@@ -402,95 +511,120 @@ void t_scroll_up(int orig, int n) {
 }
 
 void t_newline(int first_col) {
-    int y = term.c.y;
+    int y = term->c.y;
 
-    if (y == term.bot) {
-        t_scroll_up(term.top, 1);
+    if (y == term->bot) {
+        t_scroll_up(term->top, 1);
     } else {
         y++;
     }
-    t_move_to(first_col ? 0 : term.c.x, y);
+    t_move_to(first_col ? 0 : term->c.x, y);
 }
 
 /* Scrollback buffer functions */
-void t_scrollback_init(int max_lines) {
-    int i;
-    term.scrollback_size = max_lines;
-    term.scrollback_count = 0;
-    term.scrollback_pos = 0;
-    term.scroll_offset = 0;
-    
-    if (max_lines > 0) {
-        term.scrollback = x_malloc(max_lines * sizeof(Line));
-        for (i = 0; i < max_lines; i++) {
-            term.scrollback[i] = x_malloc(term.col * sizeof(Glyph));
-        }
-    } else {
-        term.scrollback = NULL;
+static Line sb_row; /* line decoded by t_scrollback_line() */
+
+void t_scrollback_init(size_t budget) {
+    sb_free(term->scrollback);
+    term->scrollback = sb_new(budget);
+    if (term->scrollback && opt_spill) {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        char path[PATH_MAX];
+
+        if (!dir) dir = getenv("HOME");
+        /* a file per session: the old scrollback of this one was freed above */
+        snprintf(path, sizeof(path), "%s/simple-terminal-%d-%d.scrollback", dir ? dir : "/tmp", (int)getpid(), term->id);
+        sb_spill(term->scrollback, path, (size_t)opt_spill << 20, opt_spill_keep);
     }
+    term->scroll_offset = 0;
+    mark_clear();
+    sb_row = x_realloc(ALLOC_SCROLLBACK, sb_row, term->col * sizeof(Glyph));
+}
+
+void t_scrollback_clear(void) {
+    if (term->scrollback) sb_clear(term->scrollback);
+    mark_clear();
+    term->scroll_offset = 0;
 }
 
 void t_scrollback_add_line(Line line) {
-    if (term.scrollback_size <= 0 || !term.scrollback) return;
-    
-    /* Copy line data to scrollback buffer (circular buffer) */
-    memcpy(term.scrollback[term.scrollback_pos], line, term.col * sizeof(Glyph));
-    
-    /* Update circular buffer position */
-    term.scrollback_pos = (term.scrollback_pos + 1) % term.scrollback_size;
-    
-    /* Update count (max out at scrollback_size) */
-    if (term.scrollback_count < term.scrollback_size) {
-        term.scrollback_count++;
+    if (term->scrollback) sb_push(term->scrollback, line, term->col);
+}
+
+int t_scrollback_count(void) { return term->scrollback ? sb_rows(term->scrollback, term->col) : 0; }
+
+/* The n-th most recent history row (1 is the newest), valid until the next call, NULL if gone */
+Line t_scrollback_line(int n) {
+    if (!term->scrollback || !sb_line(term->scrollback, n, sb_row, term->col)) return NULL;
+    return sb_row;
+}
+
+/*
+ * The view moved n rows down (into history). Rows still on screen keep their
+ * pixels, moved by the renderer, so only the rows exposed at one edge and
+ * those whose pixels were stale are dirty.
+ */
+static void t_view_moved(int n) {
+    int y;
+
+    if (!n) return;
+    term->view_shift += n;
+    if (n >= term->row || -n >= term->row) {
+        t_full_dirt();
+    } else if (n > 0) {
+        for (y = term->row - 1; y >= n; y--) term->dirty[y] |= term->dirty[y - n];
+        t_set_dirt(0, n - 1);
+    } else {
+        for (y = 0; y < term->row + n; y++) term->dirty[y] |= term->dirty[y - n];
+        t_set_dirt(term->row + n, term->row - 1);
     }
 }
 
 void t_scroll_view_up(int n) {
-    if (term.scrollback_count == 0) return;
-    
-    term.scroll_offset += n;
-    LIMIT(term.scroll_offset, 0, term.scrollback_count);
-    
-    t_full_dirt();
+    t_scroll_view_to(term->scroll_offset + n);
 }
 
 void t_scroll_view_down(int n) {
-    if (term.scroll_offset == 0) return;
-    
-    term.scroll_offset -= n;
-    LIMIT(term.scroll_offset, 0, term.scrollback_count);
-    
-    t_full_dirt();
+    t_scroll_view_to(term->scroll_offset - n);
+}
+
+/* Scroll the view so that offset history rows are shown */
+void t_scroll_view_to(int offset) {
+    int old = term->scroll_offset;
+
+    LIMIT(offset, 0, t_scrollback_count());
+    term->scroll_offset = offset;
+    t_view_moved(offset - old);
 }
 
 void t_scroll_view_reset(void) {
-    if (term.scroll_offset == 0) return;
+    if (term->scroll_offset == 0) return;
     
-    term.scroll_offset = 0;
+    term->scroll_offset = 0;
     t_full_dirt();
 }
 
 int t_get_scroll_offset(void) {
-    return term.scroll_offset;
+    return term->scroll_offset;
 }
 
 void csi_parse(void) {
     /* int noarg = 1; */
-    char *p = csiescseq.buf;
+    char *p = term->csi.buf;
 
-    csiescseq.narg = 0;
-    if (*p == '?') csiescseq.priv = 1, p++;
+    term->csi.narg = 0;
+    if (*p == '?') term->csi.priv = 1, p++;
 
-    while (p < csiescseq.buf + csiescseq.len) {
+    while (p < term->csi.buf + term->csi.len) {
         while (isdigit(*p)) {
-            csiescseq.arg[csiescseq.narg] *= 10;
-            csiescseq.arg[csiescseq.narg] += *p++ - '0' /*, noarg = 0 */;
+            term->csi.arg[term->csi.narg] *= 10;
+            term->csi.arg[term->csi.narg] += *p++ - '0' /*, noarg = 0 */;
         }
-        if (*p == ';' && csiescseq.narg + 1 < ESC_ARG_SIZ) {
-            csiescseq.narg++, p++;
+        if (*p == ';' && term->csi.narg + 1 < ESC_ARG_SIZ) {
+            term->csi.narg++, p++;
         } else {
-            csiescseq.mode = *p;
-            csiescseq.narg++;
+            term->csi.mode = *p;
+            term->csi.narg++;
 
             return;
         }
@@ -498,11 +632,11 @@ void csi_parse(void) {
 }
 
 void t_move_to(int x, int y) {
-    LIMIT(x, 0, term.col - 1);
-    LIMIT(y, 0, term.row - 1);
-    term.c.state &= ~CURSOR_WRAPNEXT;
-    term.c.x = x;
-    term.c.y = y;
+    LIMIT(x, 0, term->col - 1);
+    LIMIT(y, 0, term->row - 1);
+    term->c.state &= ~CURSOR_WRAPNEXT;
+    term->c.x = x;
+    term->c.y = y;
 }
 
 void t_set_char(char *c, Glyph *attr, int x, int y) {
@@ -527,10 +661,10 @@ void t_set_char(char *c, Glyph *attr, int x, int y) {
         }
     }
 
-    term.dirty[y] = 1;
-    term.line[y][x] = *attr;
-    memcpy(term.line[y][x].c, c, UTF_SIZ);
-    term.line[y][x].state |= GLYPH_SET;
+    term->dirty[y] = 1;
+    term->line[y][x] = *attr;
+    memcpy(term->line[y][x].c, c, UTF_SIZ);
+    term->line[y][x].state |= GLYPH_SET;
 }
 
 void t_clear_region(int x1, int y1, int x2, int y2) {
@@ -539,59 +673,59 @@ void t_clear_region(int x1, int y1, int x2, int y2) {
     if (x1 > x2) temp = x1, x1 = x2, x2 = temp;
     if (y1 > y2) temp = y1, y1 = y2, y2 = temp;
 
-    LIMIT(x1, 0, term.col - 1);
-    LIMIT(x2, 0, term.col - 1);
-    LIMIT(y1, 0, term.row - 1);
-    LIMIT(y2, 0, term.row - 1);
+    LIMIT(x1, 0, term->col - 1);
+    LIMIT(x2, 0, term->col - 1);
+    LIMIT(y1, 0, term->row - 1);
+    LIMIT(y2, 0, term->row - 1);
 
     for (y = y1; y <= y2; y++) {
-        term.dirty[y] = 1;
-        for (x = x1; x <= x2; x++) term.line[y][x].state = 0;
+        term->dirty[y] = 1;
+        for (x = x1; x <= x2; x++) term->line[y][x].state = 0;
     }
 }
 
 void t_delete_char(int n) {
-    int src = term.c.x + n;
-    int dst = term.c.x;
-    int size = term.col - src;
+    int src = term->c.x + n;
+    int dst = term->c.x;
+    int size = term->col - src;
 
-    term.dirty[term.c.y] = 1;
+    term->dirty[term->c.y] = 1;
 
-    if (src >= term.col) {
-        t_clear_region(term.c.x, term.c.y, term.col - 1, term.c.y);
+    if (src >= term->col) {
+        t_clear_region(term->c.x, term->c.y, term->col - 1, term->c.y);
         return;
     }
 
-    memmove(&term.line[term.c.y][dst], &term.line[term.c.y][src], size * sizeof(Glyph));
-    t_clear_region(term.col - n, term.c.y, term.col - 1, term.c.y);
+    memmove(&term->line[term->c.y][dst], &term->line[term->c.y][src], size * sizeof(Glyph));
+    t_clear_region(term->col - n, term->c.y, term->col - 1, term->c.y);
 }
 
 void t_insert_blank(int n) {
-    int src = term.c.x;
+    int src = term->c.x;
     int dst = src + n;
-    int size = term.col - dst;
+    int size = term->col - dst;
 
-    term.dirty[term.c.y] = 1;
+    term->dirty[term->c.y] = 1;
 
-    if (dst >= term.col) {
-        t_clear_region(term.c.x, term.c.y, term.col - 1, term.c.y);
+    if (dst >= term->col) {
+        t_clear_region(term->c.x, term->c.y, term->col - 1, term->c.y);
         return;
     }
 
-    memmove(&term.line[term.c.y][dst], &term.line[term.c.y][src], size * sizeof(Glyph));
-    t_clear_region(src, term.c.y, dst - 1, term.c.y);
+    memmove(&term->line[term->c.y][dst], &term->line[term->c.y][src], size * sizeof(Glyph));
+    t_clear_region(src, term->c.y, dst - 1, term->c.y);
 }
 
 void t_insert_blank_line(int n) {
-    if (term.c.y < term.top || term.c.y > term.bot) return;
+    if (term->c.y < term->top || term->c.y > term->bot) return;
 
-    t_scroll_down(term.c.y, n);
+    t_scroll_down(term->c.y, n);
 }
 
 void t_delete_line(int n) {
-    if (term.c.y < term.top || term.c.y > term.bot) return;
+    if (term->c.y < term->top || term->c.y > term->bot) return;
 
-    t_scroll_up(term.c.y, n);
+    t_scroll_up(term->c.y, n);
 }
 
 void t_set_attr(int *attr, int l) {
@@ -600,40 +734,40 @@ void t_set_attr(int *attr, int l) {
     for (i = 0; i < l; i++) {
         switch (attr[i]) {
             case 0:
-                term.c.attr.mode &= ~(ATTR_REVERSE | ATTR_UNDERLINE | ATTR_BOLD | ATTR_ITALIC | ATTR_BLINK);
-                term.c.attr.fg = defaultfg;
-                term.c.attr.bg = defaultbg;
+                term->c.attr.mode &= ~(ATTR_REVERSE | ATTR_UNDERLINE | ATTR_BOLD | ATTR_ITALIC | ATTR_BLINK);
+                term->c.attr.fg = defaultfg;
+                term->c.attr.bg = defaultbg;
                 break;
             case 1:
-                term.c.attr.mode |= ATTR_BOLD;
+                term->c.attr.mode |= ATTR_BOLD;
                 break;
             case 3: /* enter standout (highlight) */
-                term.c.attr.mode |= ATTR_ITALIC;
+                term->c.attr.mode |= ATTR_ITALIC;
                 break;
             case 4:
-                term.c.attr.mode |= ATTR_UNDERLINE;
+                term->c.attr.mode |= ATTR_UNDERLINE;
                 break;
             case 5:
-                term.c.attr.mode |= ATTR_BLINK;
+                term->c.attr.mode |= ATTR_BLINK;
                 break;
             case 7:
-                term.c.attr.mode |= ATTR_REVERSE;
+                term->c.attr.mode |= ATTR_REVERSE;
                 break;
             case 21:
             case 22:
-                term.c.attr.mode &= ~ATTR_BOLD;
+                term->c.attr.mode &= ~ATTR_BOLD;
                 break;
             case 23: /* leave standout (highlight) mode */
-                term.c.attr.mode &= ~ATTR_ITALIC;
+                term->c.attr.mode &= ~ATTR_ITALIC;
                 break;
             case 24:
-                term.c.attr.mode &= ~ATTR_UNDERLINE;
+                term->c.attr.mode &= ~ATTR_UNDERLINE;
                 break;
             case 25:
-                term.c.attr.mode &= ~ATTR_BLINK;
+                term->c.attr.mode &= ~ATTR_BLINK;
                 break;
             case 27:
-                term.c.attr.mode &= ~ATTR_REVERSE;
+                term->c.attr.mode &= ~ATTR_REVERSE;
                 break;
             case 29: /* not crossed out (most terminals don't support crossed out anyway) */
                 /* ignore - we don't have a crossed out attribute to unset */
@@ -642,7 +776,7 @@ void t_set_attr(int *attr, int l) {
                 if (i + 2 < l && attr[i + 1] == 5) {
                     i += 2;
                     if (BETWEEN(attr[i], 0, 255)) {
-                        term.c.attr.fg = attr[i];
+                        term->c.attr.fg = attr[i];
                     } else {
                         fprintf(stderr, "erresc: bad fgcolor %d\n", attr[i]);
                     }
@@ -651,13 +785,13 @@ void t_set_attr(int *attr, int l) {
                 }
                 break;
             case 39:
-                term.c.attr.fg = defaultfg;
+                term->c.attr.fg = defaultfg;
                 break;
             case 48:
                 if (i + 2 < l && attr[i + 1] == 5) {
                     i += 2;
                     if (BETWEEN(attr[i], 0, 255)) {
-                        term.c.attr.bg = attr[i];
+                        term->c.attr.bg = attr[i];
                     } else {
                         fprintf(stderr, "erresc: bad bgcolor %d\n", attr[i]);
                     }
@@ -666,17 +800,17 @@ void t_set_attr(int *attr, int l) {
                 }
                 break;
             case 49:
-                term.c.attr.bg = defaultbg;
+                term->c.attr.bg = defaultbg;
                 break;
             default:
                 if (BETWEEN(attr[i], 30, 37)) {
-                    term.c.attr.fg = attr[i] - 30;
+                    term->c.attr.fg = attr[i] - 30;
                 } else if (BETWEEN(attr[i], 40, 47)) {
-                    term.c.attr.bg = attr[i] - 40;
+                    term->c.attr.bg = attr[i] - 40;
                 } else if (BETWEEN(attr[i], 90, 97)) {
-                    term.c.attr.fg = attr[i] - 90 + 8;
+                    term->c.attr.fg = attr[i] - 90 + 8;
                 } else if (BETWEEN(attr[i], 100, 107)) {
-                    term.c.attr.bg = attr[i] - 100 + 8;
+                    term->c.attr.bg = attr[i] - 100 + 8;
                 } else {
                     fprintf(stderr, "erresc(default): gfx attr %d unknown\n", attr[i]), csi_dump();
                 }
@@ -688,15 +822,15 @@ void t_set_attr(int *attr, int l) {
 void t_set_scroll(int t, int b) {
     int temp;
 
-    LIMIT(t, 0, term.row - 1);
-    LIMIT(b, 0, term.row - 1);
+    LIMIT(t, 0, term->row - 1);
+    LIMIT(b, 0, term->row - 1);
     if (t > b) {
         temp = t;
         t = b;
         b = temp;
     }
-    term.top = t;
-    term.bot = b;
+    term->top = t;
+    term->bot = b;
 }
 
 #define MODBIT(x, set, bit) ((set) ? ((x) |= (bit)) : ((x) &= ~(bit)))
@@ -709,17 +843,17 @@ void t_set_mode(bool priv, bool set, int *args, int narg) {
             switch (*args) {
                 break;
                 case 1: /* DECCKM -- Cursor key */
-                    MODBIT(term.mode, set, MODE_APPKEYPAD);
+                    MODBIT(term->mode, set, MODE_APPKEYPAD);
                     break;
                 case 5: /* DECSCNM -- Reverse video */
-                    mode = term.mode;
-                    MODBIT(term.mode, set, MODE_REVERSE);
-                    if (mode != term.mode) redraw();
+                    mode = term->mode;
+                    MODBIT(term->mode, set, MODE_REVERSE);
+                    if (mode != term->mode) redraw();
                     break;
                 case 6: /* XXX: DECOM -- Origin */
                     break;
                 case 7: /* DECAWM -- Auto wrap */
-                    MODBIT(term.mode, set, MODE_WRAP);
+                    MODBIT(term->mode, set, MODE_WRAP);
                     break;
                 case 8: /* XXX: DECARM -- Auto repeat */
                     break;
@@ -727,13 +861,13 @@ void t_set_mode(bool priv, bool set, int *args, int narg) {
                 case 12: /* att610 -- Start blinking cursor (IGNORED) */
                     break;
                 case 25:
-                    MODBIT(term.c.state, !set, CURSOR_HIDE);
+                    MODBIT(term->c.state, !set, CURSOR_HIDE);
                     break;
                 case 1000: /* 1000,1002: enable xterm mouse report */
-                    MODBIT(term.mode, set, MODE_MOUSEBTN);
+                    MODBIT(term->mode, set, MODE_MOUSEBTN);
                     break;
                 case 1002:
-                    MODBIT(term.mode, set, MODE_MOUSEMOTION);
+                    MODBIT(term->mode, set, MODE_MOUSEMOTION);
                     break;
                 case 1049: /* = 1047 and 1048 */
                     // Mode 1049 combines screen switching AND cursor save/restore
@@ -772,7 +906,7 @@ void t_set_mode(bool priv, bool set, int *args, int narg) {
                     t_cursor((set) ? CURSOR_SAVE : CURSOR_LOAD);
                     break;
                 case 2004: /* bracketed paste mode */
-                    // MODBIT(term.mode, set, MODE_BRACKETPASTE);
+                    // MODBIT(term->mode, set, MODE_BRACKETPASTE);
                     break;
                 default:
                     /* case 2:  DECANM -- ANSI/VT52 (NOT SUPPOURTED) */
@@ -789,15 +923,15 @@ void t_set_mode(bool priv, bool set, int *args, int narg) {
                 case 0: /* Error (IGNORED) */
                     break;
                 case 2: /* KAM -- keyboard action */
-                    MODBIT(term.mode, set, MODE_KBDLOCK);
+                    MODBIT(term->mode, set, MODE_KBDLOCK);
                     break;
                 case 4: /* IRM -- Insertion-replacement */
-                    MODBIT(term.mode, set, MODE_INSERT);
+                    MODBIT(term->mode, set, MODE_INSERT);
                     break;
                 case 12: /* XXX: SRM -- Send/Receive */
                     break;
                 case 20: /* LNM -- Linefeed/new line */
-                    MODBIT(term.mode, set, MODE_CRLF);
+                    MODBIT(term->mode, set, MODE_CRLF);
                     break;
                 default:
                     fprintf(stderr, "erresc: unknown set/reset mode %d\n", *args);
@@ -809,21 +943,21 @@ void t_set_mode(bool priv, bool set, int *args, int narg) {
 #undef MODBIT
 
 void csi_handle(void) {
-    switch (csiescseq.mode) {
+    switch (term->csi.mode) {
         case 't': /* Window manipulation */
             // See: https://invisible-island.net/xterm/ctlseqs/ctlseqs.html#h2-Window-manipulation
-            if (csiescseq.narg > 0) {
-                int op = csiescseq.arg[0];
+            if (term->csi.narg > 0) {
+                int op = term->csi.arg[0];
                 char buf[64];
                 switch (op) {
                     case 18:  // Report window size in pixels
                         // Response: ESC [ 4 ; height ; width t
-                        snprintf(buf, sizeof(buf), "\033[4;%d;%dt", term.row * 16, term.col * 8);
+                        snprintf(buf, sizeof(buf), "\033[4;%d;%dt", term->row * 16, term->col * 8);
                         tty_write(buf, strlen(buf));
                         break;
                     case 19:  // Report window size in characters
                         // Response: ESC [ 8 ; height ; width t
-                        snprintf(buf, sizeof(buf), "\033[8;%d;%dt", term.row, term.col);
+                        snprintf(buf, sizeof(buf), "\033[8;%d;%dt", term->row, term->col);
                         tty_write(buf, strlen(buf));
                         break;
                     case 22:  // Push window title to stack (ignore for now)
@@ -841,45 +975,45 @@ void csi_handle(void) {
             /* die(""); */
             break;
         case '@': /* ICH -- Insert <n> blank char */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_insert_blank(csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_insert_blank(term->csi.arg[0]);
             break;
         case 'A': /* CUU -- Cursor <n> Up */
         case 'e':
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(term.c.x, term.c.y - csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->c.x, term->c.y - term->csi.arg[0]);
             break;
         case 'B': /* CUD -- Cursor <n> Down */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(term.c.x, term.c.y + csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->c.x, term->c.y + term->csi.arg[0]);
             break;
         case 'c': /* DA -- Device Attributes */
-            if (csiescseq.arg[0] == 0) tty_write(VT102ID, sizeof(VT102ID) - 1);
+            if (term->csi.arg[0] == 0) tty_write(VT102ID, sizeof(VT102ID) - 1);
             break;
         case 'C': /* CUF -- Cursor <n> Forward */
         case 'a':
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(term.c.x + csiescseq.arg[0], term.c.y);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->c.x + term->csi.arg[0], term->c.y);
             break;
         case 'D': /* CUB -- Cursor <n> Backward */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(term.c.x - csiescseq.arg[0], term.c.y);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->c.x - term->csi.arg[0], term->c.y);
             break;
         case 'E': /* CNL -- Cursor <n> Down and first col */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(0, term.c.y + csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(0, term->c.y + term->csi.arg[0]);
             break;
         case 'F': /* CPL -- Cursor <n> Up and first col */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(0, term.c.y - csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(0, term->c.y - term->csi.arg[0]);
             break;
         case 'g': /* TBC -- Tabulation clear */
-            switch (csiescseq.arg[0]) {
+            switch (term->csi.arg[0]) {
                 case 0: /* clear current tab stop */
-                    term.tabs[term.c.x] = 0;
+                    term->tabs[term->c.x] = 0;
                     break;
                 case 3: /* clear all the tabs */
-                    memset(term.tabs, 0, term.col * sizeof(*term.tabs));
+                    memset(term->tabs, 0, term->col * sizeof(*term->tabs));
                     break;
                 default:
                     goto unknown;
@@ -887,102 +1021,102 @@ void csi_handle(void) {
             break;
         case 'G': /* CHA -- Move to <col> */
         case '`': /* HPA */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(csiescseq.arg[0] - 1, term.c.y);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->csi.arg[0] - 1, term->c.y);
             break;
         case 'H': /* CUP -- Move to <row> <col> */
         case 'f': /* HVP */
-            DEFAULT(csiescseq.arg[0], 1);
-            DEFAULT(csiescseq.arg[1], 1);
-            t_move_to(csiescseq.arg[1] - 1, csiescseq.arg[0] - 1);
+            DEFAULT(term->csi.arg[0], 1);
+            DEFAULT(term->csi.arg[1], 1);
+            t_move_to(term->csi.arg[1] - 1, term->csi.arg[0] - 1);
             break;
         case 'I': /* CHT -- Cursor Forward Tabulation <n> tab stops */
-            DEFAULT(csiescseq.arg[0], 1);
-            while (csiescseq.arg[0]--) t_put_tab(1);
+            DEFAULT(term->csi.arg[0], 1);
+            while (term->csi.arg[0]--) t_put_tab(1);
             break;
         case 'J': /* ED -- Clear screen */
-            switch (csiescseq.arg[0]) {
+            switch (term->csi.arg[0]) {
                 case 0: /* below */
-                    t_clear_region(term.c.x, term.c.y, term.col - 1, term.c.y);
-                    if (term.c.y < term.row - 1) t_clear_region(0, term.c.y + 1, term.col - 1, term.row - 1);
+                    t_clear_region(term->c.x, term->c.y, term->col - 1, term->c.y);
+                    if (term->c.y < term->row - 1) t_clear_region(0, term->c.y + 1, term->col - 1, term->row - 1);
                     break;
                 case 1: /* above */
-                    if (term.c.y > 1) t_clear_region(0, 0, term.col - 1, term.c.y - 1);
-                    t_clear_region(0, term.c.y, term.c.x, term.c.y);
+                    if (term->c.y > 1) t_clear_region(0, 0, term->col - 1, term->c.y - 1);
+                    t_clear_region(0, term->c.y, term->c.x, term->c.y);
                     break;
                 case 2: /* all */
-                    t_clear_region(0, 0, term.col - 1, term.row - 1);
+                    t_clear_region(0, 0, term->col - 1, term->row - 1);
                     break;
                 default:
                     goto unknown;
             }
             break;
         case 'K': /* EL -- Clear line */
-            switch (csiescseq.arg[0]) {
+            switch (term->csi.arg[0]) {
                 case 0: /* right */
-                    t_clear_region(term.c.x, term.c.y, term.col - 1, term.c.y);
+                    t_clear_region(term->c.x, term->c.y, term->col - 1, term->c.y);
                     break;
                 case 1: /* left */
-                    t_clear_region(0, term.c.y, term.c.x, term.c.y);
+                    t_clear_region(0, term->c.y, term->c.x, term->c.y);
                     break;
                 case 2: /* all */
-                    t_clear_region(0, term.c.y, term.col - 1, term.c.y);
+                    t_clear_region(0, term->c.y, term->col - 1, term->c.y);
                     break;
             }
             break;
         case 'S': /* SU -- Scroll <n> line up */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_scroll_up(term.top, csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_scroll_up(term->top, term->csi.arg[0]);
             break;
         case 'T': /* SD -- Scroll <n> line down */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_scroll_down(term.top, csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_scroll_down(term->top, term->csi.arg[0]);
             break;
         case 'L': /* IL -- Insert <n> blank lines */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_insert_blank_line(csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_insert_blank_line(term->csi.arg[0]);
             break;
         case 'l': /* RM -- Reset Mode */
-            t_set_mode(csiescseq.priv, 0, csiescseq.arg, csiescseq.narg);
+            t_set_mode(term->csi.priv, 0, term->csi.arg, term->csi.narg);
             break;
         case 'M': /* DL -- Delete <n> lines */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_delete_line(csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_delete_line(term->csi.arg[0]);
             break;
         case 'X': /* ECH -- Erase <n> char */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_clear_region(term.c.x, term.c.y, term.c.x + csiescseq.arg[0], term.c.y);
+            DEFAULT(term->csi.arg[0], 1);
+            t_clear_region(term->c.x, term->c.y, term->c.x + term->csi.arg[0], term->c.y);
             break;
         case 'P': /* DCH -- Delete <n> char */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_delete_char(csiescseq.arg[0]);
+            DEFAULT(term->csi.arg[0], 1);
+            t_delete_char(term->csi.arg[0]);
             break;
         case 'Z': /* CBT -- Cursor Backward Tabulation <n> tab stops */
-            DEFAULT(csiescseq.arg[0], 1);
-            while (csiescseq.arg[0]--) t_put_tab(0);
+            DEFAULT(term->csi.arg[0], 1);
+            while (term->csi.arg[0]--) t_put_tab(0);
             break;
         case 'd': /* VPA -- Move to <row> */
-            DEFAULT(csiescseq.arg[0], 1);
-            t_move_to(term.c.x, csiescseq.arg[0] - 1);
+            DEFAULT(term->csi.arg[0], 1);
+            t_move_to(term->c.x, term->csi.arg[0] - 1);
             break;
         case 'h': /* SM -- Set terminal mode */
-            t_set_mode(csiescseq.priv, 1, csiescseq.arg, csiescseq.narg);
+            t_set_mode(term->csi.priv, 1, term->csi.arg, term->csi.narg);
             break;
         case 'm': /* SGR -- Terminal attribute (color) */
-            if (csiescseq.buf[0] == '>') {
+            if (term->csi.buf[0] == '>') {
                 // Handle private SGR sequences like ESC[>4;2m (bracketed paste mode queries)
                 // These are usually capability queries that we can safely ignore
                 break;
             }
-            t_set_attr(csiescseq.arg, csiescseq.narg);
+            t_set_attr(term->csi.arg, term->csi.narg);
             break;
         case 'r': /* DECSTBM -- Set Scrolling Region */
-            if (csiescseq.priv) {
+            if (term->csi.priv) {
                 goto unknown;
             } else {
-                DEFAULT(csiescseq.arg[0], 1);
-                DEFAULT(csiescseq.arg[1], term.row);
-                t_set_scroll(csiescseq.arg[0] - 1, csiescseq.arg[1] - 1);
+                DEFAULT(term->csi.arg[0], 1);
+                DEFAULT(term->csi.arg[1], term->row);
+                t_set_scroll(term->csi.arg[0] - 1, term->csi.arg[1] - 1);
                 t_move_to(0, 0);
             }
             break;
@@ -1000,8 +1134,8 @@ void csi_dump(void) {
     uint c;
 
     printf("ESC[");
-    for (i = 0; i < csiescseq.len; i++) {
-        c = csiescseq.buf[i] & 0xff;
+    for (i = 0; i < term->csi.len; i++) {
+        c = term->csi.buf[i] & 0xff;
         if (isprint(c)) {
             putchar(c);
         } else if (c == '\n') {
@@ -1017,52 +1151,55 @@ void csi_dump(void) {
     putchar('\n');
 }
 
-void csi_reset(void) { memset(&csiescseq, 0, sizeof(csiescseq)); }
+void csi_reset(void) { memset(&term->csi, 0, sizeof(term->csi)); }
+
+void str_reset(void) { memset(&term->str, 0, sizeof(term->str)); }
+
+/* Only the OSC 133 shell integration marks are acted on, other strings are ignored */
+void str_handle(void) {
+    char *p = term->str.buf;
 
-void str_reset(void) { memset(&strescseq, 0, sizeof(strescseq)); }
+    term->str.buf[term->str.len] = '\0';
+    if (term->str.type != ']' || strncmp(p, "133;", 4) || !term->scrollback || IS_SET(MODE_ALTSCREEN)) return;
+    mark_add(p[4], sb_end(term->scrollback) + term->c.y, term->c.x, p[4] == 'D' && p[5] == ';' ? atoi(p + 6) : -1);
+}
 
 void t_put_tab(bool forward) {
-    uint x = term.c.x;
+    uint x = term->c.x;
 
     if (forward) {
-        if (x == term.col) return;
-        for (++x; x < term.col && !term.tabs[x]; ++x) /* nothing */
+        if (x == term->col) return;
+        for (++x; x < term->col && !term->tabs[x]; ++x) /* nothing */
             ;
     } else {
         if (x == 0) return;
-        for (--x; x > 0 && !term.tabs[x]; --x) /* nothing */
+        for (--x; x > 0 && !term->tabs[x]; --x) /* nothing */
             ;
     }
-    t_move_to(x, term.c.y);
+    t_move_to(x, term->c.y);
 }
 
 void t_putc(char *c, int len) {
     uchar ascii = *c;
     bool control = ascii < '\x20' || ascii == 0177;
 
-    if (iofd != -1) {
-        if (x_write(iofd, c, len) < 0) {
-            fprintf(stderr, "Error writting in %s:%s\n", opt_io, strerror(errno));
-            close(iofd);
-            iofd = -1;
-        }
-    }
     /*
      * STR sequences must be checked before of anything
      * because it can use some control codes as part of the sequence
      */
-    if (term.esc & ESC_STR) {
+    if (term->esc & ESC_STR) {
         switch (ascii) {
             case '\033':
-                term.esc = ESC_START | ESC_STR_END;
+                term->esc = ESC_START | ESC_STR_END;
                 break;
             case '\a': /* backwards compatibility to xterm */
-                term.esc = 0;
+                term->esc = 0;
+                str_handle();
                 break;
             default:
-                strescseq.buf[strescseq.len++] = ascii;
-                if (strescseq.len + 1 >= STR_BUF_SIZ) {
-                    term.esc = 0;
+                term->str.buf[term->str.len++] = ascii;
+                if (term->str.len + 1 >= STR_BUF_SIZ) {
+                    term->esc = 0;
                 }
         }
         return;
@@ -1078,14 +1215,15 @@ void t_putc(char *c, int len) {
                 t_put_tab(1);
                 return;
             case '\b': /* BS */
-                t_move_to(term.c.x - 1, term.c.y);
+                t_move_to(term->c.x - 1, term->c.y);
                 return;
             case '\r': /* CR */
-                t_move_to(0, term.c.y);
+                t_move_to(0, term->c.y);
                 return;
             case '\f': /* LF */
             case '\v': /* VT */
             case '\n': /* LF */
+                if (trigger_count) trigger_newline(term->c.y);
                 /* go to first col if the mode is set */
                 t_newline(IS_SET(MODE_CRLF));
                 return;
@@ -1093,13 +1231,13 @@ void t_putc(char *c, int len) {
                 return;
             case '\033': /* ESC */
                 csi_reset();
-                term.esc = ESC_START;
+                term->esc = ESC_START;
                 return;
             case '\016': /* SO */
-                term.c.attr.mode |= ATTR_GFX;
+                term->c.attr.mode |= ATTR_GFX;
                 return;
             case '\017': /* SI */
-                term.c.attr.mode &= ~ATTR_GFX;
+                term->c.attr.mode &= ~ATTR_GFX;
                 return;
             case '\032': /* SUB */
             case '\030': /* CAN */
@@ -1112,22 +1250,25 @@ void t_putc(char *c, int len) {
             case 0177:   /* DEL (IGNORED) */
                 return;
         }
-    } else if (term.esc & ESC_START) {
-        if (term.esc & ESC_CSI) {
-            csiescseq.buf[csiescseq.len++] = ascii;
-            if (BETWEEN(ascii, 0x40, 0x7E) || csiescseq.len >= ESC_BUF_SIZ) {
-                term.esc = 0;
+    } else if (term->esc & ESC_START) {
+        if (term->esc & ESC_CSI) {
+            term->csi.buf[term->csi.len++] = ascii;
+            if (BETWEEN(ascii, 0x40, 0x7E) || term->csi.len >= ESC_BUF_SIZ) {
+                uint64_t t = trace_begin();
+                term->esc = 0;
                 csi_parse(), csi_handle();
+                trace_end("csi_handle", t);
             }
-        } else if (term.esc & ESC_STR_END) {
-            term.esc = 0;
-        } else if (term.esc & ESC_ALTCHARSET) {
+        } else if (term->esc & ESC_STR_END) {
+            term->esc = 0;
+            if (ascii == '\\') str_handle();
+        } else if (term->esc & ESC_ALTCHARSET) {
             switch (ascii) {
                 case '0': /* Line drawing set */
-                    term.c.attr.mode |= ATTR_GFX;
+                    term->c.attr.mode |= ATTR_GFX;
                     break;
                 case 'B': /* USASCII */
-                    term.c.attr.mode &= ~ATTR_GFX;
+                    term->c.attr.mode &= ~ATTR_GFX;
                     break;
                 case 'A': /* UK (IGNORED) */
                 case '<': /* multinational charset (IGNORED) */
@@ -1138,24 +1279,24 @@ void t_putc(char *c, int len) {
                 default:
                     fprintf(stderr, "esc unhandled charset: ESC ( %c\n", ascii);
             }
-            term.esc = 0;
-        } else if (term.esc & ESC_TEST) {
+            term->esc = 0;
+        } else if (term->esc & ESC_TEST) {
             if (ascii == '8') { /* DEC screen alignment test. */
                 char E[UTF_SIZ] = "E";
                 int x, y;
 
-                for (x = 0; x < term.col; ++x) {
-                    for (y = 0; y < term.row; ++y) t_set_char(E, &term.c.attr, x, y);
+                for (x = 0; x < term->col; ++x) {
+                    for (y = 0; y < term->row; ++y) t_set_char(E, &term->c.attr, x, y);
                 }
             }
-            term.esc = 0;
+            term->esc = 0;
         } else {
             switch (ascii) {
                 case '[':
-                    term.esc |= ESC_CSI;
+                    term->esc |= ESC_CSI;
                     break;
                 case '#':
-                    term.esc |= ESC_TEST;
+                    term->esc |= ESC_TEST;
                     break;
                 case 'P': /* DCS -- Device Control String */
                 case '_': /* APC -- Application Program Command */
@@ -1163,71 +1304,71 @@ void t_putc(char *c, int len) {
                 case ']': /* OSC -- Operating System Command */
                 case 'k': /* old title set compatibility */
                     str_reset();
-                    strescseq.type = ascii;
-                    term.esc |= ESC_STR;
+                    term->str.type = ascii;
+                    term->esc |= ESC_STR;
                     break;
                 case '(': /* set primary charset G0 */
-                    term.esc |= ESC_ALTCHARSET;
+                    term->esc |= ESC_ALTCHARSET;
                     break;
                 case ')': /* set secondary charset G1 (IGNORED) */
                 case '*': /* set tertiary charset G2 (IGNORED) */
                 case '+': /* set quaternary charset G3 (IGNORED) */
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case 'D': /* IND -- Linefeed */
-                    if (term.c.y == term.bot) {
-                        t_scroll_up(term.top, 1);
+                    if (term->c.y == term->bot) {
+                        t_scroll_up(term->top, 1);
                     } else {
-                        t_move_to(term.c.x, term.c.y + 1);
+                        t_move_to(term->c.x, term->c.y + 1);
                     }
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case 'E':         /* NEL -- Next line */
                     t_newline(1); /* always go to first col */
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case 'H': /* HTS -- Horizontal tab stop */
-                    term.tabs[term.c.x] = 1;
-                    term.esc = 0;
+                    term->tabs[term->c.x] = 1;
+                    term->esc = 0;
                     break;
                 case 'M': /* RI -- Reverse index */
-                    if (term.c.y == term.top) {
-                        t_scroll_down(term.top, 1);
+                    if (term->c.y == term->top) {
+                        t_scroll_down(term->top, 1);
                     } else {
-                        t_move_to(term.c.x, term.c.y - 1);
+                        t_move_to(term->c.x, term->c.y - 1);
                     }
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case 'Z': /* DECID -- Identify Terminal */
                     tty_write(VT102ID, sizeof(VT102ID) - 1);
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case 'c': /* RIS -- Reset to inital state */
                     t_reset();
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case '=': /* DECPAM -- Application keypad */
-                    term.mode |= MODE_APPKEYPAD;
-                    term.esc = 0;
+                    term->mode |= MODE_APPKEYPAD;
+                    term->esc = 0;
                     break;
                 case '>': /* DECPNM -- Normal keypad */
-                    term.mode &= ~MODE_APPKEYPAD;
-                    term.esc = 0;
+                    term->mode &= ~MODE_APPKEYPAD;
+                    term->esc = 0;
                     break;
                 case '7': /* DECSC -- Save Cursor */
                     t_cursor(CURSOR_SAVE);
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case '8': /* DECRC -- Restore Cursor */
                     t_cursor(CURSOR_LOAD);
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 case '\\': /* ST -- Stop */
-                    term.esc = 0;
+                    term->esc = 0;
                     break;
                 default:
                     fprintf(stderr, "erresc: unknown sequence ESC 0x%02X '%c'\n", (uchar)ascii, isprint(ascii) ? ascii : '.');
-                    term.esc = 0;
+                    term->esc = 0;
             }
         }
         /*
@@ -1239,23 +1380,141 @@ void t_putc(char *c, int len) {
     /*
      * Display control codes only if we are in graphic mode
      */
-    if (control && !(term.c.attr.mode & ATTR_GFX)) return;
-    if (IS_SET(MODE_WRAP) && term.c.state & CURSOR_WRAPNEXT) t_newline(1); /* always go to first col */
-    t_set_char(c, &term.c.attr, term.c.x, term.c.y);
-    if (term.c.x + 1 < term.col)
-        t_move_to(term.c.x + 1, term.c.y);
+    if (control && !(term->c.attr.mode & ATTR_GFX)) return;
+    if (IS_SET(MODE_WRAP) && term->c.state & CURSOR_WRAPNEXT) {
+        term->line[term->c.y][term->c.x].mode |= ATTR_WRAP; /* for reflow */
+        t_newline(1);                                    /* always go to first col */
+    }
+    t_set_char(c, &term->c.attr, term->c.x, term->c.y);
+    trigger_putc(c, len);
+    if (term->c.x + 1 < term->col)
+        t_move_to(term->c.x + 1, term->c.y);
     else
-        term.c.state |= CURSOR_WRAPNEXT;
+        term->c.state |= CURSOR_WRAPNEXT;
+}
+
+/*
+ * Feed bytes to the terminal as if they were read from the shell.
+ * Returns the number of bytes consumed; an incomplete utf8 char at the
+ * end of buf is left for the caller to carry over.
+ */
+int t_write(char *buf, int buflen) {
+    char *ptr = buf;
+    char s[UTF_SIZ];
+    int charsize; /* size of utf8 char in bytes */
+    long utf8c;
+    uint64_t chars = 0;
+    size_t n;
+
+    while (buflen >= UTF_SIZ || is_full_utf8(ptr, buflen)) {
+        /* printable ASCII runs skip the utf8 decoder */
+        if ((uchar)*ptr >= 0x20 && (uchar)*ptr < 0x7f && (n = cpu_ascii_span(ptr, buflen)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                s[0] = ptr[i];
+                t_putc(s, 1);
+            }
+            ptr += n;
+            buflen -= n;
+            chars += n;
+            continue;
+        }
+        charsize = utf8_decode(ptr, &utf8c);
+        utf8_encode(&utf8c, s);
+        t_putc(s, charsize);
+        ptr += charsize;
+        buflen -= charsize;
+        chars++;
+    }
+    perf_count(PERF_PUTC, chars);
+
+    return ptr - buf;
+}
+
+static int row_len(Line line, int col) {
+    int x = col;
+
+    while (x > 0 && !(line[x - 1].state & GLYPH_SET)) x--;
+    return x;
+}
+
+static int row_wrapped(Line line, int col) {
+    return (line[col - 1].state & GLYPH_SET) && (line[col - 1].mode & ATTR_WRAP);
+}
+
+/*
+ * Rewrap the primary screen to col columns: rows ending in a soft wrap are
+ * joined into logical lines and cut again at the new width. Rows that do
+ * not fit above the cursor go to the scrollback, those below it are lost.
+ * Returns the row new rows and the cursor in *cx, *cy.
+ */
+static Line *t_reflow(int col, int row, int *cx, int *cy) {
+    int last = term->c.y, y, y0, k, len, off, nr, n = 0, top;
+    int per = (term->col + col - 1) / col; /* most new rows an old one needs */
+    Glyph *buf, *g;
+    Line *lines;
+
+    for (y = term->row - 1; y > last; y--) {
+        if (row_len(term->line[y], term->col)) last = y;
+    }
+    /* plus a row for a cursor past the end of its line */
+    buf = x_calloc(ALLOC_GRID, ((size_t)(last + 1) * per + 1) * col, sizeof(Glyph));
+    *cx = *cy = 0;
+    for (y = 0; y <= last; y = y0 + 1) {
+        for (y0 = y; y0 < last && row_wrapped(term->line[y0], term->col); y0++);
+        len = (y0 - y) * term->col + row_len(term->line[y0], term->col);
+        for (k = 0; k < len; k++) {
+            g = &buf[(size_t)n * col + k];
+            *g = term->line[y + k / term->col][k % term->col];
+            g->mode &= ~ATTR_WRAP;
+        }
+        nr = MAX((len + col - 1) / col, 1);
+        if (term->c.y >= y && term->c.y <= y0) {
+            /* a pending wrap puts the cursor after the last char */
+            off = (term->c.y - y) * term->col + term->c.x + !!(term->c.state & CURSOR_WRAPNEXT);
+            nr = MAX(nr, off / col + 1);
+            *cx = off % col;
+            *cy = n + off / col;
+        }
+        for (k = 1; k < nr; k++) {
+            g = &buf[(size_t)(n + k) * col - 1];
+            if (!(g->state & GLYPH_SET)) {
+                memset(g, 0, sizeof(*g));
+                g->c[0] = ' ';
+                g->fg = defaultfg;
+                g->bg = defaultbg;
+                g->state = GLYPH_SET;
+            }
+            g->mode |= ATTR_WRAP;
+        }
+        n += nr;
+    }
+
+    top = MIN(MAX(n - row, 0), *cy);
+    for (y = 0; term->scrollback && y < top; y++) sb_push(term->scrollback, buf + (size_t)y * col, col);
+    lines = x_malloc(ALLOC_GRID, row * sizeof(Line));
+    for (y = 0; y < row; y++) {
+        lines[y] = x_calloc(ALLOC_GRID, col, sizeof(Glyph));
+        if (top + y < n) memcpy(lines[y], buf + (size_t)(top + y) * col, col * sizeof(Glyph));
+    }
+    *cy -= top;
+    x_free(buf);
+    return lines;
 }
 
 int t_resize(int col, int row) {
-    int i, x;
-    int minrow = MIN(row, term.row);
-    int mincol = MIN(col, term.col);
-    int slide = term.c.y - row + 1;
+    int i, x, cx, cy;
+    int minrow = MIN(row, term->row);
+    int mincol = MIN(col, term->col);
+    int slide = term->c.y - row + 1;
     bool *bp;
+    Line *reflowed = NULL;
 
     if (col < 1 || row < 1) return 0;
+    if (term->line && col != term->col && !IS_SET(MODE_ALTSCREEN)) {
+        /* the marks on screen would point at the wrong rows */
+        if (term->scrollback) mark_drop(sb_end(term->scrollback));
+        reflowed = t_reflow(col, row, &cx, &cy);
+    }
 
     /* free unneeded rows */
     i = 0;
@@ -1264,53 +1523,66 @@ int t_resize(int col, int row) {
          * tscrollup would work here, but we can optimize to
          * memmove because we're freeing the earlier lines */
         for (/* i = 0 */; i < slide; i++) {
-            free(term.line[i]);
-            free(term.alt[i]);
+            x_free(term->line[i]);
+            x_free(term->alt[i]);
         }
-        memmove(term.line, term.line + slide, row * sizeof(Line));
-        memmove(term.alt, term.alt + slide, row * sizeof(Line));
+        memmove(term->line, term->line + slide, row * sizeof(Line));
+        memmove(term->alt, term->alt + slide, row * sizeof(Line));
     }
-    for (i += row; i < term.row; i++) {
-        free(term.line[i]);
-        free(term.alt[i]);
+    for (i += row; i < term->row; i++) {
+        x_free(term->line[i]);
+        x_free(term->alt[i]);
     }
 
     /* resize to new height */
-    term.line = x_realloc(term.line, row * sizeof(Line));
-    term.alt = x_realloc(term.alt, row * sizeof(Line));
-    term.dirty = x_realloc(term.dirty, row * sizeof(*term.dirty));
-    term.tabs = x_realloc(term.tabs, col * sizeof(*term.tabs));
+    term->line = x_realloc(ALLOC_GRID, term->line, row * sizeof(Line));
+    term->alt = x_realloc(ALLOC_GRID, term->alt, row * sizeof(Line));
+    term->dirty = x_realloc(ALLOC_GRID, term->dirty, row * sizeof(*term->dirty));
+    term->tabs = x_realloc(ALLOC_GRID, term->tabs, col * sizeof(*term->tabs));
+    sb_row = x_realloc(ALLOC_SCROLLBACK, sb_row, col * sizeof(Glyph));
 
     /* resize each row to new width, zero-pad if needed */
     for (i = 0; i < minrow; i++) {
-        term.dirty[i] = 1;
-        term.line[i] = x_realloc(term.line[i], col * sizeof(Glyph));
-        term.alt[i] = x_realloc(term.alt[i], col * sizeof(Glyph));
+        term->dirty[i] = 1;
+        term->line[i] = x_realloc(ALLOC_GRID, term->line[i], col * sizeof(Glyph));
+        term->alt[i] = x_realloc(ALLOC_GRID, term->alt[i], col * sizeof(Glyph));
         for (x = mincol; x < col; x++) {
-            term.line[i][x].state = 0;
-            term.alt[i][x].state = 0;
+            term->line[i][x].state = 0;
+            term->alt[i][x].state = 0;
         }
     }
 
     /* allocate any new rows */
     for (/* i == minrow */; i < row; i++) {
-        term.dirty[i] = 1;
-        term.line[i] = x_calloc(col, sizeof(Glyph));
-        term.alt[i] = x_calloc(col, sizeof(Glyph));
+        term->dirty[i] = 1;
+        term->line[i] = x_calloc(ALLOC_GRID, col, sizeof(Glyph));
+        term->alt[i] = x_calloc(ALLOC_GRID, col, sizeof(Glyph));
     }
-    if (col > term.col) {
-        bp = term.tabs + term.col;
+    if (col > term->col) {
+        bp = term->tabs + term->col;
 
-        memset(bp, 0, sizeof(*term.tabs) * (col - term.col));
-        while (--bp > term.tabs && !*bp) /* nothing */
+        memset(bp, 0, sizeof(*term->tabs) * (col - term->col));
+        while (--bp > term->tabs && !*bp) /* nothing */
             ;
-        for (bp += tabspaces; bp < term.tabs + col; bp += tabspaces) *bp = 1;
+        for (bp += tabspaces; bp < term->tabs + col; bp += tabspaces) *bp = 1;
     }
     /* update terminal size */
-    term.col = col;
-    term.row = row;
+    term->col = col;
+    term->row = row;
+    if (reflowed) {
+        for (i = 0; i < row; i++) {
+            x_free(term->line[i]);
+            term->line[i] = reflowed[i];
+        }
+        x_free(reflowed);
+        term->c.x = cx;
+        term->c.y = cy;
+        term->c.state &= ~CURSOR_WRAPNEXT;
+        slide = 1; /* every row may have moved */
+        term->scroll_offset = 0;
+    }
     /* make use of the LIMIT in t_move_to */
-    t_move_to(term.c.x, term.c.y);
+    t_move_to(term->c.x, term->c.y);
     /* reset scrolling region */
     t_set_scroll(0, row - 1);
 
@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
 
 /* VT100/Terminal related constants */
 #define ESC_BUF_SIZ 256
@@ -11,6 +14,7 @@
 #define STR_ARG_SIZ 16
 #define UTF_SIZ 4
 #define VT102ID "\033[?6c"
+#define SESSION_MAX 4 /* shells open at once, each with its Term */
 
 /* VT100/Terminal macros */
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -20,7 +24,7 @@
 #define BETWEEN(x, a, b) ((a) <= (x) && (x) <= (b))
 #define LIMIT(x, a, b) (x) = (x)<(a) ? (a) : (x)>(b) ? (b) : (x)
 #define ATTRCMP(a, b) ((a).mode != (b).mode || (a).fg != (b).fg || (a).bg != (b).bg)
-#define IS_SET(flag) (term.mode & (flag))
+#define IS_SET(flag) (term->mode & (flag))
 
 /* Type definitions */
 typedef unsigned char uchar;
@@ -37,6 +41,7 @@ enum glyph_attribute {
     ATTR_GFX = 8,
     ATTR_ITALIC = 16,
     ATTR_BLINK = 32,
+    ATTR_WRAP = 64, /* on the last cell of a soft wrapped line */
 };
 
 /* Cursor movements */
@@ -119,24 +124,42 @@ typedef struct {
     int esc;     /* escape state flags */
     bool *tabs;
     /* Scrollback buffer */
-    Line *scrollback;      /* scrollback buffer */
-    int scrollback_size;   /* max scrollback lines */
-    int scrollback_count;  /* current number of lines in scrollback */
-    int scrollback_pos;    /* current position in circular buffer */
-    int scroll_offset;     /* current scroll offset (0 = bottom) */
+    struct Scrollback *scrollback; /* compressed history, see scrollback.h */
+    int scroll_offset;             /* current scroll offset (0 = bottom) */
+    int view_shift;                /* rows the view moved down since drawn, the renderer moves their pixels */
+    /* Session: the shell behind the terminal and the parser state */
+    int id;                /* index in sessions[] */
+    int cmdfd;             /* pty master */
+    pid_t pid;             /* shell, 0 once it was reaped */
+    int exited;            /* the pty closed, the main thread frees the session */
+    CSIEscape csi;
+    STREscape str;
+    TCursor saved[2];      /* cursor saved on the primary and alternate screens */
+    char buf[BUFSIZ];      /* read from cmdfd, an incomplete UTF-8 char waits for the next read */
+    int buflen;
+    uint32_t trigger;      /* state of the output trigger automaton, see trigger.h */
 } Term;
 
-/* Global terminal state - extern declarations */
-extern Term term;
-extern CSIEscape csiescseq;
-extern STREscape strescseq;
-extern int cmdfd;
+/*
+ * Sessions. term is the session the calling thread works on: the main
+ * thread's is the one shown (term_shown), the tty thread points its own
+ * at each session it reads. Every thread starts on sessions[0].
+ */
+extern Term sessions[SESSION_MAX];
+extern __thread Term *term;
+extern Term *term_shown;
 
 /* TTY functions */
 void tty_new(void);
-void tty_read(void);
+int tty_read(void);
+void tty_feed(const char *s, size_t n);
 void tty_write(const char *s, size_t n);
 void tty_resize(void);
+int tty_wait(void);
+
+/* Session functions, from the main thread */
+Term *session_open(int col, int row);
+void session_free(Term *t);
 
 /* Terminal functions */
 void t_clear_region(int x1, int y1, int x2, int y2);
@@ -150,6 +173,7 @@ void t_new(int col, int row);
 void t_newline(int first_col);
 void t_put_tab(bool forward);
 void t_putc(char *c, int len);
+int t_write(char *buf, int buflen);
 void t_reset(void);
 int t_resize(int col, int row);
 void t_scroll_up(int orig, int n);
@@ -163,10 +187,14 @@ void t_set_mode(bool priv, bool set, int *args, int narg);
 void t_full_dirt(void);
 
 /* Scrollback functions */
-void t_scrollback_init(int max_lines);
+void t_scrollback_init(size_t budget);
+void t_scrollback_clear(void);
 void t_scrollback_add_line(Line line);
+int t_scrollback_count(void);
+Line t_scrollback_line(int n);
 void t_scroll_view_up(int n);
 void t_scroll_view_down(int n);
+void t_scroll_view_to(int offset);
 void t_scroll_view_reset(void);
 int t_get_scroll_offset(void);
 
@@ -176,6 +204,7 @@ void csi_handle(void);
 void csi_parse(void);
 void csi_reset(void);
 void str_reset(void);
+void str_handle(void);
 
 /* UTF-8 functions */
 int utf8_decode(char *c, long *u);
@@ -185,10 +214,6 @@ int is_full_utf8(char *c, int len);
 
 /* External dependencies from main.c */
 void die(const char *, ...);
-void *x_malloc(size_t);
-void *x_realloc(void *, size_t);
-void *x_calloc(size_t nmemb, size_t size);
-size_t x_write(int fd, char *s, size_t len);
 void redraw(void);
 
 #endif /* VT100_H */
\ No newline at end of file